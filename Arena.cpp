@@ -0,0 +1,79 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "Arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+// The first block is big enough for a small template; each one after that
+// doubles, up to the maximum, so a mainnet-sized template needs only a few
+const size_t FIRST_CHUNK_SIZE = 64 * 1024;
+const size_t MAX_CHUNK_SIZE = 4 * 1024 * 1024;
+
+Arena::Arena()
+ : _chunks(nullptr),
+   _cursor(nullptr),
+   _end(nullptr),
+   _nextChunkSize(FIRST_CHUNK_SIZE),
+   _bytesAllocated(0),
+   _blockCount(0)
+{
+}
+
+Arena::~Arena()
+{
+   while( _chunks != nullptr )
+   {
+      auto next = _chunks->next;
+      ::operator delete( _chunks );
+      _chunks = next;
+   }
+}
+
+void* Arena::allocate( size_t bytes, size_t alignment )
+{
+   auto aligned = [&]()
+   {
+      auto address = reinterpret_cast<uintptr_t>(_cursor);
+      return reinterpret_cast<char*>((address + alignment - 1) & ~(alignment - 1));
+   };
+
+   char* result = aligned();
+   if( _cursor == nullptr || result + bytes > _end )
+   {
+      _grow( bytes + alignment );
+      result = aligned();
+   }
+
+   _cursor = result + bytes;
+   _bytesAllocated += bytes;
+   return result;
+}
+
+void Arena::_grow( size_t minimumBytes )
+{
+   // Oversized requests get a block of their own
+   size_t size = std::max( _nextChunkSize, minimumBytes + sizeof(Chunk) );
+   _nextChunkSize = std::min( _nextChunkSize * 2, MAX_CHUNK_SIZE );
+
+   auto chunk = static_cast<Chunk*>(::operator new( size ));
+   chunk->next = _chunks;
+   chunk->size = size;
+   _chunks = chunk;
+   ++_blockCount;
+
+   _cursor = reinterpret_cast<char*>(chunk + 1);
+   _end = reinterpret_cast<char*>(chunk) + size;
+}
+
+size_t Arena::bytesAllocated() const
+{
+   return _bytesAllocated;
+}
+
+size_t Arena::blockCount() const
+{
+   return _blockCount;
+}
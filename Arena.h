@@ -0,0 +1,183 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Monotonic allocator: memory is carved sequentially out of a few large
+ * blocks, individual frees are no-ops, and everything is released at once
+ * when the arena is destroyed. Used to give everything belonging to a block
+ * template (transactions, scripts, merkle nodes) the template's lifetime.
+ *
+ * Not thread-safe.
+ */
+class Arena
+{
+public:
+   Arena();
+   ~Arena();
+
+   Arena( const Arena& ) = delete;
+   Arena& operator =( const Arena& ) = delete;
+
+   void* allocate( size_t bytes, size_t alignment );
+
+   /*
+    * Statistics
+    */
+   size_t bytesAllocated() const;
+   size_t blockCount() const;
+
+private:
+   struct Chunk
+   {
+      Chunk* next;
+      size_t size;
+   };
+
+   void _grow( size_t minimumBytes );
+
+private:
+   Chunk*   _chunks;
+   char*    _cursor;
+   char*    _end;
+   size_t   _nextChunkSize;
+   size_t   _bytesAllocated;
+   size_t   _blockCount;
+};
+
+/*
+ * Standard allocator over an Arena. A null arena means the global heap, so
+ * containers using this work unchanged outside of a template.
+ *
+ * Copies of a container are always made on the heap, since a copy may
+ * outlive the arena. Moves and swaps keep the arena.
+ */
+template<typename T>
+class ArenaAllocator
+{
+public:
+   typedef T value_type;
+
+   typedef std::true_type propagate_on_container_move_assignment;
+   typedef std::true_type propagate_on_container_swap;
+
+   template<typename U>
+   struct rebind
+   {
+      typedef ArenaAllocator<U> other;
+   };
+
+public:
+   ArenaAllocator() noexcept
+    : _arena(nullptr)
+   {
+   }
+
+   ArenaAllocator( Arena* arena ) noexcept
+    : _arena(arena)
+   {
+   }
+
+   template<typename U>
+   ArenaAllocator( const ArenaAllocator<U>& other ) noexcept
+    : _arena(other.arena())
+   {
+   }
+
+   T* allocate( size_t n )
+   {
+      if( _arena != nullptr )
+      {
+         return static_cast<T*>(_arena->allocate( n * sizeof(T), alignof(T) ));
+      }
+      return static_cast<T*>(::operator new( n * sizeof(T) ));
+   }
+
+   void deallocate( T* p, size_t ) noexcept
+   {
+      if( _arena == nullptr )
+      {
+         ::operator delete( p );
+      }
+   }
+
+   ArenaAllocator select_on_container_copy_construction() const
+   {
+      return ArenaAllocator();
+   }
+
+   Arena* arena() const
+   {
+      return _arena;
+   }
+
+private:
+   Arena* _arena;
+};
+
+template<typename T, typename U>
+bool operator ==( const ArenaAllocator<T>& a, const ArenaAllocator<U>& b )
+{
+   return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator !=( const ArenaAllocator<T>& a, const ArenaAllocator<U>& b )
+{
+   return a.arena() != b.arena();
+}
+
+/*
+ * Deleter for objects that may live in an arena: those only have their
+ * destructor run, since the arena owns the memory.
+ */
+template<typename T>
+struct ArenaDelete
+{
+   ArenaDelete( Arena* arena = nullptr )
+    : arena(arena)
+   {
+   }
+
+   void operator ()( T* p ) const
+   {
+      if( arena != nullptr )
+      {
+         p->~T();
+      }
+      else
+      {
+         delete p;
+      }
+   }
+
+   Arena* arena;
+};
+
+template<typename T>
+using ArenaPtr = std::unique_ptr<T, ArenaDelete<T>>;
+
+/*
+ * Construct an object in the arena (or on the heap, if it's null).
+ */
+template<typename T, typename... Args>
+ArenaPtr<T> makeArenaPtr( Arena* arena, Args&&... args )
+{
+   if( arena == nullptr )
+   {
+      return ArenaPtr<T>( new T(std::forward<Args>(args)...) );
+   }
+
+   void* memory = arena->allocate( sizeof(T), alignof(T) );
+   return ArenaPtr<T>( new (memory) T(std::forward<Args>(args)...), ArenaDelete<T>(arena) );
+}
+
+#endif // !ARENA_H
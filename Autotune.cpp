@@ -0,0 +1,155 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "Autotune.h"
+#include "Benchmark.h"
+#include "SelfTest.h"
+#include "Topology.h"
+#include "Miner.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// How long to time each kernel/thread count combination
+const std::chrono::milliseconds BURST_DURATION( 1000 );
+
+Autotune::Config Autotune::run( int threads, const std::string& cacheFile )
+{
+   auto& topology = Topology::host();
+
+   // Cached results are only valid for the same processor and CPU count
+   std::ostringstream key;
+   key << Topology::cpuModel() << " x" << topology.logicalCpuCount();
+
+   // Reject any kernels that give wrong answers on this machine
+   std::vector<std::string> verifiedTypes;
+   for( auto& type : Miner::types() )
+   {
+      try
+      {
+         SelfTest::verifyMiner( type );
+         verifiedTypes.push_back( type );
+      }
+      catch( std::exception& e )
+      {
+         std::cout << "Autotune: rejecting kernel \"" << type << "\": " << e.what() << std::endl;
+      }
+   }
+
+   if( verifiedTypes.empty() )
+   {
+      throw std::runtime_error( "No kernel implementation passed verification" );
+   }
+
+   Config best;
+   if( !cacheFile.empty() && _loadCache(cacheFile, key.str(), best)
+       && std::find(verifiedTypes.begin(), verifiedTypes.end(), best.minerType) != verifiedTypes.end()
+       && (threads == 0 || threads == best.threads) )
+   {
+      std::cout << "Autotune: using cached configuration for " << key.str() << ": kernel \""
+                << best.minerType << "\" with " << best.threads << " threads" << std::endl;
+      return best;
+   }
+
+   // Try one thread per physical core, and one per logical CPU
+   std::vector<int> threadCounts;
+   if( threads > 0 )
+   {
+      threadCounts.push_back( threads );
+   }
+   else
+   {
+      threadCounts.push_back( topology.physicalCoreCount() );
+      if( topology.logicalCpuCount() != topology.physicalCoreCount() )
+      {
+         threadCounts.push_back( topology.logicalCpuCount() );
+      }
+   }
+
+   best.hashRate = -1;
+   for( auto& type : verifiedTypes )
+   {
+      for( int threadCount : threadCounts )
+      {
+         auto result = Benchmark::run( type, threadCount, BURST_DURATION );
+         std::cout << "Autotune: kernel \"" << type << "\" with " << threadCount << " threads: "
+                   << formatHashRate( result.totalHashRate() ) << std::endl;
+
+         if( result.totalHashRate() > best.hashRate )
+         {
+            best.minerType = type;
+            best.threads = threadCount;
+            best.hashRate = result.totalHashRate();
+         }
+      }
+   }
+
+   std::cout << "Autotune: selected kernel \"" << best.minerType << "\" with "
+             << best.threads << " threads (" << formatHashRate(best.hashRate) << ")" << std::endl;
+
+   if( !cacheFile.empty() )
+   {
+      _saveCache( cacheFile, key.str(), best );
+   }
+
+   return best;
+}
+
+// The cache is a text file with one tab-separated line per CPU model:
+//    <key> <type> <threads> <hash rate>
+bool Autotune::_loadCache( const std::string& cacheFile, const std::string& key, Config& config )
+{
+   std::ifstream file( cacheFile );
+   std::string line;
+   while( std::getline(file, line) )
+   {
+      std::istringstream fields( line );
+      std::string lineKey;
+      if( !std::getline(fields, lineKey, '\t') || lineKey != key )
+      {
+         continue;
+      }
+
+      if( std::getline(fields, config.minerType, '\t') && (fields >> config.threads >> config.hashRate) )
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+void Autotune::_saveCache( const std::string& cacheFile, const std::string& key, const Config& config )
+{
+   // Keep the entries for other CPU models
+   std::vector<std::string> lines;
+   {
+      std::ifstream file( cacheFile );
+      std::string line;
+      while( std::getline(file, line) )
+      {
+         if( line.compare(0, key.size() + 1, key + '\t') != 0 )
+         {
+            lines.push_back( line );
+         }
+      }
+   }
+
+   std::ofstream file( cacheFile, std::ios::trunc );
+   if( !file )
+   {
+      std::cerr << "Autotune: unable to write cache file " << cacheFile << std::endl;
+      return;
+   }
+
+   for( auto& line : lines )
+   {
+      file << line << '\n';
+   }
+   file << key << '\t' << config.minerType << '\t' << config.threads << '\t' << config.hashRate << '\n';
+}
@@ -0,0 +1,40 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <string>
+
+// Kernel type name that selects the autotuner
+#define AUTOTUNE_MINER_TYPE "auto"
+
+/*
+ * Chooses the fastest kernel and thread count for this host. Every registered
+ * kernel is verified with SelfTest first, and only kernels that pass are
+ * timed.
+ */
+class Autotune
+{
+public:
+   struct Config
+   {
+      std::string minerType;
+      int         threads;
+      double      hashRate;
+   };
+
+public:
+   /*
+    * If threads is non-zero, only that thread count is tried. If cacheFile is
+    * non-empty, a previous result for the same CPU model is reused (after
+    * verification), and new results are saved there.
+    */
+   static Config run( int threads, const std::string& cacheFile );
+
+private:
+   static bool _loadCache( const std::string& cacheFile, const std::string& key, Config& config );
+   static void _saveCache( const std::string& cacheFile, const std::string& key, const Config& config );
+};
+
+#endif // !AUTOTUNE_H
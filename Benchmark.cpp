@@ -0,0 +1,134 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "Benchmark.h"
+#include "Scheduler.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <limits>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cassert>
+#include <ctime>
+
+// A zero mantissa gives a zero target, which no hash can be below
+const uint32_t IMPOSSIBLE_BITS = 0x03000000;
+
+double Benchmark::Result::totalHashRate() const
+{
+   uint64_t total = 0;
+   for( auto hashes : threadHashes )
+   {
+      total += hashes;
+   }
+   return seconds > 0 ? total / seconds : 0;
+}
+
+double Benchmark::Result::threadHashRate( int thread ) const
+{
+   return seconds > 0 ? threadHashes[thread] / seconds : 0;
+}
+
+Benchmark::Result Benchmark::run( const std::string& minerType,
+                                  int threads,
+                                  std::chrono::milliseconds duration,
+                                  int64_t hashes )
+{
+   auto block = syntheticBlock();
+   Scheduler scheduler( minerType, threads );
+
+   uint32_t lastNonce = std::numeric_limits<uint32_t>::max();
+   if( hashes > 0 && hashes <= lastNonce )
+   {
+      lastNonce = hashes - 1;
+   }
+
+   // Only time-limited runs need someone to stop the workers
+   std::mutex mutex;
+   std::condition_variable doneCondition;
+   bool done = false;
+   std::thread timer;
+   if( hashes <= 0 )
+   {
+      timer = std::thread( [&]()
+      {
+         std::unique_lock<std::mutex> lock( mutex );
+         if( !doneCondition.wait_for(lock, duration, [&](){return done;}) )
+         {
+            scheduler.abort();
+         }
+      } );
+   }
+
+   auto start = std::chrono::steady_clock::now();
+   auto minerResult = scheduler.mine( *block, 0, lastNonce );
+   auto end = std::chrono::steady_clock::now();
+   assert( minerResult == Miner::NoSolutionFound );
+   (void)minerResult;
+
+   if( timer.joinable() )
+   {
+      {
+         std::lock_guard<std::mutex> lock( mutex );
+         done = true;
+      }
+      doneCondition.notify_all();
+      timer.join();
+   }
+
+   Result result;
+   result.minerType = minerType;
+   result.seconds = std::chrono::duration<double>( end - start ).count();
+   for( int i = 0; i < threads; ++i )
+   {
+      result.threadHashes.push_back( scheduler.hashCount(i) );
+   }
+
+   return result;
+}
+
+void Benchmark::print( std::ostream& outStream, const Result& result )
+{
+   outStream << "Kernel \"" << result.minerType << "\", "
+             << result.threadHashes.size() << " threads, "
+             << std::fixed << std::setprecision(2) << result.seconds << " s" << std::endl;
+
+   for( unsigned i = 0; i < result.threadHashes.size(); ++i )
+   {
+      outStream << "\tThread " << std::setw(3) << std::setfill(' ') << std::dec << i << ": "
+                << formatHashRate( result.threadHashRate(i) ) << std::endl;
+   }
+
+   outStream << "\tTotal:      " << formatHashRate( result.totalHashRate() ) << std::endl;
+}
+
+std::unique_ptr<Block> Benchmark::syntheticBlock()
+{
+   std::unique_ptr<Block> block( new Block(2, std::time(nullptr), IMPOSSIBLE_BITS) );
+
+   ByteArray pubKeyHash( 20, 0 );
+   block->setCoinbase( Transaction::createCoinbase(0, 50LL * SATOSHIS_PER_BITCOIN, pubKeyHash, block->arena()) );
+   block->updateHeader();
+
+   return block;
+}
+
+std::string formatHashRate( double hashesPerSecond )
+{
+   static const char* prefixes[] = { "", "k", "M", "G", "T", "P" };
+
+   int prefix = 0;
+   while( hashesPerSecond >= 1000 && prefix < ARRAY_SIZE(prefixes) - 1 )
+   {
+      hashesPerSecond /= 1000;
+      ++prefix;
+   }
+
+   std::ostringstream stream;
+   stream << std::fixed << std::setprecision(2) << hashesPerSecond << " " << prefixes[prefix] << "H/s";
+   return stream.str();
+}
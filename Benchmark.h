@@ -0,0 +1,51 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "Block.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Offline hash rate measurement. Kernels are run against a synthetic block
+ * whose target can never be met, so every nonce in the run gets hashed.
+ */
+class Benchmark
+{
+public:
+   struct Result
+   {
+      double totalHashRate() const;
+      double threadHashRate( int thread ) const;
+
+      std::string             minerType;
+      double                  seconds;
+      std::vector<uint64_t>   threadHashes;
+   };
+
+public:
+   /*
+    * Run the kernel on the given number of threads, until either the duration
+    * elapses or the hash count is reached (if non-zero).
+    */
+   static Result run( const std::string& minerType,
+                      int threads,
+                      std::chrono::milliseconds duration,
+                      int64_t hashes = 0 );
+
+   static void print( std::ostream& outStream, const Result& result );
+
+   static std::unique_ptr<Block> syntheticBlock();
+};
+
+/*
+ * Pretty-print a hash rate with an SI prefix (e.g. "12.34 MH/s").
+ */
+std::string formatHashRate( double hashesPerSecond );
+
+#endif // !BENCHMARK_H
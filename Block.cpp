@@ -3,12 +3,20 @@
 **/
 
 #include "Block.h"
+#include "MerkleTree.h"
+#include "TaskPool.h"
+#include "Trace.h"
 
+#include <algorithm>
 #include <sstream>
 #include <cassert>
 #include <cstring>
 
+// Below this many transactions, the second tree isn't worth a pool task
+const size_t PARALLEL_MERKLE_MIN_TXNS = 1024;
+
 Block::Block()
+ : _branchesValid(false)
 {
    std::memset( &header, 0, sizeof(header) );
 }
@@ -21,28 +29,109 @@ Block::Block( int version, int time, int bits )
    header.bits = bits;
 }
 
+Arena* Block::arena()
+{
+   return &_arena;
+}
+
 void Block::setPrevBlockHash( const ByteArray& prevBlockHash )
 {
    assert( prevBlockHash.size() == sizeof(header.prevBlock) );
    std::copy( prevBlockHash.begin(), prevBlockHash.end(), header.prevBlock.begin() );
 }
 
-void Block::appendTransaction( std::unique_ptr<Transaction> txn )
+void Block::setCoinbase( TransactionPtr coinbase )
 {
-   _merkleTree.append( txn->id() );
-   _txns.push_back( std::move(txn) );
+   _coinbase = std::move( coinbase );
+}
+
+const Transaction& Block::coinbase() const
+{
+   assert( _coinbase != nullptr );
+   return *_coinbase;
+}
+
+void Block::setTransactions( TransactionList&& txns )
+{
+   _txns = std::move( txns );
+   _branchesValid = false;
+}
+
+TransactionList& Block::transactions()
+{
+   // The caller may change them
+   _branchesValid = false;
+   return _txns;
+}
+
+const TransactionList& Block::transactions() const
+{
+   return _txns;
 }
 
 void Block::updateHeader()
 {
-   auto merkleRoot = _merkleTree.rootHash();
-   assert( merkleRoot.size() == sizeof(header.merkleRoot) );
-   std::copy( merkleRoot.begin(), merkleRoot.end(), header.merkleRoot.begin() );
+   assert( _coinbase != nullptr );
+
+   if( !_branchesValid )
+   {
+      _computeBranches();
+   }
+
+   if( _txns.hasWitness() )
+   {
+      _coinbase->setWitnessCommitment( _witnessRoot );
+   }
+
+   auto txid = _coinbase->id();
+   Sha256::RawDigest coinbaseTxid;
+   std::copy( txid.begin(), txid.end(), coinbaseTxid.begin() );
+   header.merkleRoot = MerkleTree::rootFromBranch( coinbaseTxid, _merkleBranch );
+}
+
+const std::vector<Sha256::RawDigest>& Block::merkleBranch() const
+{
+   return _merkleBranch;
 }
 
-ByteArray Block::merkleRoot()
+// Both trees come from the IDs computed in the single pass over each
+// transaction as it was added, and are built at the same time
+void Block::_computeBranches()
 {
-   return _merkleTree.rootHash();
+   TRACE_SCOPE( "Block::computeBranches" );
+
+   // The coinbase's own IDs don't matter here; its wtxid is defined as zero
+   auto leaves = [](const std::vector<Sha256::RawDigest>& ids)
+   {
+      std::vector<Sha256::RawDigest> leaves;
+      leaves.reserve( 1 + ids.size() );
+      leaves.push_back( Sha256::RawDigest() );
+      leaves.insert( leaves.end(), ids.begin(), ids.end() );
+      return leaves;
+   };
+
+   _witnessRoot = Sha256::RawDigest();
+   auto witnessRoot = [&]()
+   {
+      _witnessRoot = MerkleTree::computeRoot( leaves(_txns.wtxids()) );
+   };
+
+   TaskPool::Group group;
+   if( _txns.hasWitness() )
+   {
+      if( _txns.count() >= PARALLEL_MERKLE_MIN_TXNS )
+      {
+         group.run( witnessRoot );
+      }
+      else
+      {
+         witnessRoot();
+      }
+   }
+
+   _merkleBranch = MerkleTree::computeBranch( leaves(_txns.txids()) );
+   group.wait();
+   _branchesValid = true;
 }
 
 ByteArray Block::headerData() const
@@ -60,10 +149,18 @@ ByteArray Block::headerData() const
 
 void Block::serialize( std::ostream& serialStream ) const
 {
+   TRACE_SCOPE( "Block::serialize" );
+
+   assert( _coinbase != nullptr );
+
    serialStream << headerData();
-   writeVarInt( serialStream, _txns.size() );
-   for( auto& txn : _txns )
-   {
-      txn->serialize( serialStream );
-   }
+   writeVarInt( serialStream, 1 + _txns.count() );
+   _coinbase->serialize( serialStream );
+   writeHex( serialStream, _txns.bytes().data(), _txns.bytes().size() );
+}
+
+bool Block::hashMeetsTarget( const Header& header, const ByteArray& target )
+{
+   auto hash = Sha256::doubleHash( &header, sizeof(header) );
+   return !std::lexicographical_compare( target.begin(), target.end(), hash.rbegin(), hash.rend() );
 }
@@ -6,7 +6,8 @@
 
 #include "Sha256.h"
 #include "Transaction.h"
-#include "MerkleTree.h"
+#include "TransactionList.h"
+#include "Arena.h"
 
 #include <cstdint>
 
@@ -29,22 +30,67 @@ public:
    Block();
    Block( int version, int time, int bits );
 
+   Block( const Block& ) = delete;
+   Block& operator =( const Block& ) = delete;
+
+   /*
+    * Arena for transaction objects belonging to this block (the coinbase, and
+    * any decoded from the list), released in one go when the block is
+    * destroyed.
+    */
+   Arena* arena();
+
    void setPrevBlockHash( const ByteArray& prevBlockHash );
-   void appendTransaction( std::unique_ptr<Transaction> txn );
 
+   /*
+    * The coinbase is kept as an object, since miners modify it. The other
+    * transactions are kept raw and contiguous, and follow it in the block.
+    */
+   void setCoinbase( TransactionPtr coinbase );
+   const Transaction& coinbase() const;
+   void setTransactions( TransactionList&& txns );
+   TransactionList& transactions();
+   const TransactionList& transactions() const;
+
+   /*
+    * Commit the coinbase to the witness root, if any transaction has a
+    * witness, and recompute the merkle root. Only the coinbase's path to the
+    * root is rehashed unless the other transactions have changed.
+    */
    void updateHeader();
 
+   /*
+    * The coinbase's merkle branch (its siblings, from the leaves up), as of
+    * the last updateHeader().
+    */
+   const std::vector<Sha256::RawDigest>& merkleBranch() const;
+
    ByteArray headerData() const;
-   ByteArray merkleRoot();
 
    void serialize( std::ostream& serialStream ) const;
 
+   /*
+    * Whether the header's hash is at most the (big-endian) target.
+    */
+   static bool hashMeetsTarget( const Header& header, const ByteArray& target );
+
 public:
    Header   header;
 
 private:
-   MerkleTree  _merkleTree;
-   std::vector<std::unique_ptr<Transaction>> _txns;
+   void _computeBranches();
+
+private:
+   // Must outlive everything allocated in it
+   Arena             _arena;
+
+   TransactionPtr    _coinbase;
+   TransactionList   _txns;
+
+   // Derived from the transactions other than the coinbase
+   bool                             _branchesValid;
+   std::vector<Sha256::RawDigest>   _merkleBranch;
+   Sha256::RawDigest                _witnessRoot;
 };
 
 #endif // !BLOCK_H
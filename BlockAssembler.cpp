@@ -0,0 +1,457 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "BlockAssembler.h"
+#include "Block.h"
+#include "Hex.h"
+#include "Settings.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+
+// Consensus limit, less room for the header and coinbase (as Bitcoin Core's
+// default -blockreservedweight)
+const int64_t MAX_BLOCK_WEIGHT = 4000000;
+const int64_t RESERVED_WEIGHT = 8000;
+
+// Nothing smaller fits once the block is this full
+const int64_t MIN_TXN_WEIGHT = 240;
+
+// Raw transactions fetched per batch request
+const size_t FETCH_BATCH_SIZE = 500;
+
+static int64_t toSatoshis( const Json::Value& amount )
+{
+   return std::llround( amount.asDouble() * SATOSHIS_PER_BITCOIN );
+}
+
+BlockAssembler::Entry::Entry()
+ : fee(0),
+   baseFee(0),
+   weight(0),
+   packageFee(0),
+   packageWeight(0),
+   ancestorCount(0),
+   orphan(false),
+   score(-1)
+{
+}
+
+BlockAssembler::BlockAssembler( JsonRpc& rpc, TransactionCache* cache )
+ : _rpc(rpc),
+   _cache(cache),
+   _subsidy(0)
+{
+}
+
+void BlockAssembler::setBase( const Json::Value& blockTemplate, int64_t templateFees )
+{
+   _base = blockTemplate;
+   _base.removeMember( "transactions" );
+   _subsidy = blockTemplate["coinbasevalue"].asInt64() - templateFees;
+}
+
+void BlockAssembler::blockAccepted( const Block& block )
+{
+   if( _base.isNull() )
+   {
+      return;
+   }
+
+   auto hash = Sha256::doubleHash( &block.header, sizeof(block.header) );
+   std::reverse( hash.begin(), hash.end() );
+   std::ostringstream displayHash;
+   displayHash << hash;
+
+   _base["previousblockhash"] = displayHash.str();
+   _base["height"] = _base["height"].asInt() + 1;
+}
+
+void BlockAssembler::reset()
+{
+   _base = Json::Value();
+}
+
+bool BlockAssembler::assemble( Json::Value& fields, TransactionList& txns )
+{
+   TRACE_SCOPE( "BlockAssembler::assemble" );
+
+   // The first template fills the transaction cache, so the mirror can be
+   // filled from it rather than fetching everything
+   if( _base.isNull() && _mempool.empty() )
+   {
+      return false;
+   }
+
+   Json::Value verbose;
+   verbose[0u] = true;
+   auto replies = _rpc.batch( { JsonRpc::Call("getbestblockhash"), JsonRpc::Call("getrawmempool", verbose) } );
+   if( replies[1].failed() )
+   {
+      throw std::runtime_error( "getrawmempool failed: " + replies[1].error["message"].asString() );
+   }
+
+   // Kept up to date even when a template is needed, ready for the next call
+   _updateMempool( replies[1].result );
+
+   if( _base.isNull() || replies[0].failed() ||
+       replies[0].result.asString() != _base["previousblockhash"].asString() )
+   {
+      return false;
+   }
+
+   txns = TransactionList();
+   _select( txns );
+
+   fields = _base;
+   fields["coinbasevalue"] = static_cast<Json::Int64>( _subsidy + txns.totalFees() );
+   fields["curtime"] = static_cast<Json::Int64>( std::max<int64_t>(std::time(nullptr), _base["mintime"].asInt64()) );
+
+   if( Settings::debug() )
+   {
+      std::cout << "Assembled " << txns.count() << " of " << _mempool.size() << " mempool transactions, "
+                << txns.bytes().size() << " bytes, " << txns.totalFees() << " in fees" << std::endl;
+   }
+
+   return true;
+}
+
+void BlockAssembler::_updateMempool( const Json::Value& listing )
+{
+   TRACE_SCOPE( "BlockAssembler::updateMempool" );
+
+   if( !listing.isObject() )
+   {
+      throw std::runtime_error( "getrawmempool result is not an object" );
+   }
+
+   // Entries whose packages need scoring again
+   std::set<std::string> dirty;
+
+   // Drop whatever was mined or evicted; that changes its descendants' packages
+   for( auto it = _mempool.begin(); it != _mempool.end(); )
+   {
+      if( listing.isMember(it->first) )
+      {
+         ++it;
+         continue;
+      }
+
+      _markDescendants( it->first, dirty );
+      for( auto& parentId : it->second.parents )
+      {
+         auto parent = _mempool.find( parentId );
+         if( parent != _mempool.end() )
+         {
+            auto& children = parent->second.children;
+            children.erase( std::remove(children.begin(), children.end(), it->first), children.end() );
+         }
+      }
+
+      // Its outputs are confirmed now (or its children are gone too), or
+      // the children would look orphaned
+      for( auto& childId : it->second.children )
+      {
+         auto child = _mempool.find( childId );
+         if( child != _mempool.end() )
+         {
+            auto& parents = child->second.parents;
+            parents.erase( std::remove(parents.begin(), parents.end(), it->first), parents.end() );
+         }
+      }
+
+      _index.erase( std::make_pair(it->second.score, &it->first) );
+      it = _mempool.erase( it );
+   }
+
+   // Only transactions that weren't known already are fetched
+   auto txids = listing.getMemberNames();
+   std::vector<std::string> missing;
+   for( auto& txid : txids )
+   {
+      if( _mempool.find(txid) == _mempool.end() )
+      {
+         missing.push_back( txid );
+      }
+   }
+
+   std::unordered_map<std::string, Entry> fetched;
+   _fetchTransactions( missing, fetched );
+   for( auto& item : fetched )
+   {
+      _mempool.emplace( item.first, std::move(item.second) );
+   }
+
+   // Fees and weights can change (prioritisetransaction), so they're always
+   // refreshed; parents can only change by being mined, which was handled
+   // above by dropping them from their children
+   for( auto& txid : txids )
+   {
+      auto found = _mempool.find( txid );
+      if( found == _mempool.end() )
+      {
+         continue;
+      }
+
+      auto& info = listing[txid];
+      auto& entry = found->second;
+      // Selection goes by the fee prioritisetransaction left it with, as
+      // Bitcoin Core's does, but only what's actually paid goes to the coinbase
+      int64_t baseFee;
+      int64_t fee;
+      if( info.isMember("fees") )
+      {
+         baseFee = toSatoshis( info["fees"]["base"] );
+         fee = info["fees"].isMember("modified") ? toSatoshis( info["fees"]["modified"] ) : baseFee;
+      }
+      else
+      {
+         baseFee = toSatoshis( info["fee"] );
+         fee = info.isMember("modifiedfee") ? toSatoshis( info["modifiedfee"] ) : baseFee;
+      }
+      auto weight = info.isMember("weight") ? info["weight"].asInt64() : info["vsize"].asInt64() * 4;
+
+      if( fetched.count(txid) != 0 )
+      {
+         for( auto& parentId : info["depends"] )
+         {
+            entry.parents.push_back( parentId.asString() );
+
+            auto parent = _mempool.find( entry.parents.back() );
+            if( parent != _mempool.end() )
+            {
+               parent->second.children.push_back( txid );
+            }
+         }
+      }
+      else if( fee == entry.fee && baseFee == entry.baseFee && weight == entry.weight )
+      {
+         continue;
+      }
+
+      entry.fee = fee;
+      entry.baseFee = baseFee;
+      entry.weight = weight;
+      dirty.insert( txid );
+      _markDescendants( txid, dirty );
+   }
+
+   for( auto& txid : dirty )
+   {
+      if( _mempool.find(txid) != _mempool.end() )
+      {
+         _rescore( txid );
+      }
+   }
+
+   if( Settings::debug() )
+   {
+      std::cout << "Mempool: " << _mempool.size() << " transactions, " << fetched.size() << " new, "
+                << dirty.size() << " packages rescored" << std::endl;
+   }
+}
+
+void BlockAssembler::_fetchTransactions( const std::vector<std::string>& txids,
+                                         std::unordered_map<std::string, Entry>& fetched )
+{
+   TRACE_SCOPE( "BlockAssembler::fetchTransactions" );
+
+   for( size_t first = 0; first < txids.size(); first += FETCH_BATCH_SIZE )
+   {
+      size_t last = std::min( first + FETCH_BATCH_SIZE, txids.size() );
+
+      std::vector<JsonRpc::Call> calls;
+      std::vector<const std::string*> requested;
+      for( size_t i = first; i < last; ++i )
+      {
+         // Most will have been in a template already
+         auto cached = _cache != nullptr ? _cache->find( txids[i] ) : nullptr;
+         if( cached != nullptr )
+         {
+            auto& entry = fetched[txids[i]];
+            entry.raw = cached->raw;
+            entry.txid = cached->txid;
+            entry.wtxid = cached->wtxid;
+            continue;
+         }
+
+         Json::Value params;
+         params[0u] = txids[i];
+         calls.emplace_back( "getrawtransaction", params );
+         requested.push_back( &txids[i] );
+      }
+
+      if( calls.empty() )
+      {
+         continue;
+      }
+
+      auto replies = _rpc.batch( calls );
+      for( size_t i = 0; i < replies.size(); ++i )
+      {
+         // It left the mempool since it was listed
+         if( replies[i].failed() )
+         {
+            continue;
+         }
+
+         auto& txid = *requested[i];
+         auto hex = replies[i].result.asString();
+         Entry entry;
+         entry.raw.resize( hex.size() / 2 );
+         if( !Hex::decode(hex.data(), hex.size(), entry.raw.data()) ||
+             TransactionList::hashRaw(entry.raw.data(), entry.raw.size(), entry.txid, entry.wtxid, _scratch) != entry.raw.size() )
+         {
+            throw std::runtime_error( "Invalid raw transaction " + txid );
+         }
+
+         if( _cache != nullptr )
+         {
+            _cache->insert( txid, entry.raw.data(), entry.raw.size(), entry.txid, entry.wtxid );
+         }
+
+         fetched.emplace( txid, std::move(entry) );
+      }
+   }
+}
+
+void BlockAssembler::_markDescendants( const std::string& txid, std::set<std::string>& dirty ) const
+{
+   std::vector<const std::string*> pending( 1, &txid );
+   while( !pending.empty() )
+   {
+      auto found = _mempool.find( *pending.back() );
+      pending.pop_back();
+      if( found == _mempool.end() )
+      {
+         continue;
+      }
+
+      for( auto& child : found->second.children )
+      {
+         if( dirty.insert(child).second )
+         {
+            pending.push_back( &child );
+         }
+      }
+   }
+}
+
+void BlockAssembler::_rescore( const std::string& txid )
+{
+   auto found = _mempool.find( txid );
+   auto& entry = found->second;
+   _index.erase( std::make_pair(entry.score, &found->first) );
+
+   std::vector<const Entry*> ancestors;
+   entry.orphan = !_collectAncestors( entry, ancestors );
+   entry.ancestorCount = ancestors.size();
+   entry.packageFee = entry.fee;
+   entry.packageWeight = entry.weight;
+   for( auto ancestor : ancestors )
+   {
+      entry.packageFee += ancestor->fee;
+      entry.packageWeight += ancestor->weight;
+   }
+
+   if( entry.orphan || entry.packageWeight <= 0 )
+   {
+      entry.score = -1;
+      return;
+   }
+
+   entry.score = static_cast<double>( entry.packageFee ) / entry.packageWeight;
+   _index.insert( std::make_pair(entry.score, &found->first) );
+}
+
+// Returns false if an ancestor is missing from the mirror
+bool BlockAssembler::_collectAncestors( const Entry& entry, std::vector<const Entry*>& ancestors ) const
+{
+   std::unordered_set<const Entry*> seen;
+   std::vector<const Entry*> pending( 1, &entry );
+   while( !pending.empty() )
+   {
+      auto current = pending.back();
+      pending.pop_back();
+
+      for( auto& parentId : current->parents )
+      {
+         auto parent = _mempool.find( parentId );
+         if( parent == _mempool.end() )
+         {
+            return false;
+         }
+
+         if( seen.insert(&parent->second).second )
+         {
+            ancestors.push_back( &parent->second );
+            pending.push_back( &parent->second );
+         }
+      }
+   }
+
+   return true;
+}
+
+void BlockAssembler::_select( TransactionList& txns )
+{
+   TRACE_SCOPE( "BlockAssembler::select" );
+
+   // Unlike Bitcoin Core, packages aren't re-scored as their ancestors are
+   // included, which costs a little in fees but keeps this a single pass
+   int64_t blockWeight = RESERVED_WEIGHT;
+   std::unordered_set<const Entry*> included;
+   std::vector<const Entry*> package;
+   for( auto& scored : _index )
+   {
+      if( blockWeight + MIN_TXN_WEIGHT > MAX_BLOCK_WEIGHT )
+      {
+         break;
+      }
+
+      auto& entry = _mempool.find( *scored.second )->second;
+      if( included.count(&entry) != 0 )
+      {
+         continue;
+      }
+
+      package.clear();
+      _collectAncestors( entry, package );
+      package.push_back( &entry );
+      package.erase( std::remove_if(package.begin(), package.end(), [&](const Entry* e)
+      {
+         return included.count( e ) != 0;
+      }), package.end() );
+
+      int64_t packageWeight = 0;
+      for( auto member : package )
+      {
+         packageWeight += member->weight;
+      }
+
+      if( blockWeight + packageWeight > MAX_BLOCK_WEIGHT )
+      {
+         continue;
+      }
+
+      // Parents before children: an ancestor always has fewer ancestors
+      std::stable_sort( package.begin(), package.end(), [](const Entry* a, const Entry* b)
+      {
+         return a->ancestorCount < b->ancestorCount;
+      } );
+
+      for( auto member : package )
+      {
+         txns.append( member->raw.data(), member->raw.size(), member->txid, member->wtxid, member->baseFee );
+         included.insert( member );
+      }
+      blockWeight += packageWeight;
+   }
+}
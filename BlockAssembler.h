@@ -0,0 +1,109 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef BLOCK_ASSEMBLER_H
+#define BLOCK_ASSEMBLER_H
+
+#include "JsonRpc.h"
+#include "TransactionCache.h"
+#include "TransactionList.h"
+
+#include <json/json.h>
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class Block;
+
+/*
+ * Builds block templates locally from a mirror of the node's mempool, instead
+ * of having the node build a whole new one with getblocktemplate.
+ *
+ * The mirror is brought up to date from "getrawmempool true" on every call:
+ * only transactions that weren't already known are fetched, and only the
+ * packages whose ancestors changed are re-scored. Selection is by ancestor
+ * package fee rate, as in Bitcoin Core.
+ *
+ * The header fields (version, bits, subsidy) come from the last template
+ * fetched with getblocktemplate, so one is needed to start with and whenever
+ * the chain tip moves other than by a block we found ourselves. Assembled
+ * blocks should be checked with a getblocktemplate proposal before mining,
+ * since the mirror can't see everything the node checks (sigops, retargets,
+ * halvings).
+ */
+class BlockAssembler
+{
+public:
+   BlockAssembler( JsonRpc& rpc, TransactionCache* cache = nullptr );
+
+   /*
+    * Start from a template fetched with getblocktemplate.
+    */
+   void setBase( const Json::Value& blockTemplate, int64_t templateFees );
+
+   /*
+    * A block built on the base was accepted, so the next one builds on it.
+    */
+   void blockAccepted( const Block& block );
+
+   /*
+    * Forget the base, so the next template comes from getblocktemplate.
+    */
+   void reset();
+
+   /*
+    * Bring the mempool mirror up to date and, if the base is still on the
+    * chain tip, fill in the template fields and transactions of a new
+    * block. Returns false if a getblocktemplate is needed instead.
+    */
+   bool assemble( Json::Value& fields, TransactionList& txns );
+
+private:
+   struct Entry
+   {
+      Entry();
+
+      ByteArray                  raw;
+      Sha256::RawDigest          txid;
+      Sha256::RawDigest          wtxid;
+      int64_t                    fee;           // Modified by prioritisetransaction
+      int64_t                    baseFee;       // Actually paid
+      int64_t                    weight;
+      std::vector<std::string>   parents;
+      std::vector<std::string>   children;
+
+      // The entry and all its in-mempool ancestors
+      int64_t                    packageFee;
+      int64_t                    packageWeight;
+      size_t                     ancestorCount;
+      bool                       orphan;        // An ancestor couldn't be fetched
+      double                     score;         // As indexed
+   };
+
+   // Highest package fee rate first
+   typedef std::set<std::pair<double, const std::string*>, std::greater<std::pair<double, const std::string*>>> ScoreIndex;
+
+   void _updateMempool( const Json::Value& listing );
+   void _fetchTransactions( const std::vector<std::string>& txids, std::unordered_map<std::string, Entry>& fetched );
+   void _markDescendants( const std::string& txid, std::set<std::string>& dirty ) const;
+   void _rescore( const std::string& txid );
+   bool _collectAncestors( const Entry& entry, std::vector<const Entry*>& ancestors ) const;
+   void _select( TransactionList& txns );
+
+private:
+   JsonRpc&                                  _rpc;
+   TransactionCache*                         _cache;
+
+   Json::Value                               _base;
+   int64_t                                   _subsidy;
+
+   std::unordered_map<std::string, Entry>    _mempool;
+   ScoreIndex                                _index;
+   ByteArray                                 _scratch;
+};
+
+#endif // !BLOCK_ASSEMBLER_H
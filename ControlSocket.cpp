@@ -0,0 +1,265 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "ControlSocket.h"
+#include "SelfTest.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+// How often the loops check whether they should stop
+const int POLL_MS = 200;
+
+// Drop connections that send longer lines than this
+const size_t MAX_LINE_SIZE = 4096;
+
+static bool sendAll( int fd, const std::string& data )
+{
+   size_t sent = 0;
+   while( sent < data.size() )
+   {
+      auto bytes = ::send( fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL );
+      if( bytes <= 0 )
+      {
+         return false;
+      }
+      sent += bytes;
+   }
+   return true;
+}
+
+ControlSocket::ControlSocket( const std::string& path, Scheduler& scheduler )
+ : _path(path),
+   _scheduler(scheduler),
+   _listenSocket(-1),
+   _stop(false),
+   _activeConnections(0),
+   _lastStats(std::chrono::steady_clock::now()),
+   _lastHashes(scheduler.hashCount())
+{
+   sockaddr_un addr;
+   std::memset( &addr, 0, sizeof(addr) );
+   addr.sun_family = AF_UNIX;
+   if( path.empty() || path.size() >= sizeof(addr.sun_path) )
+   {
+      throw std::runtime_error( "Invalid control socket path: " + path );
+   }
+   path.copy( addr.sun_path, path.size() );
+
+   // A socket left behind is stale: bind would fail on it
+   struct stat status;
+   if( ::lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode) )
+   {
+      ::unlink( path.c_str() );
+   }
+
+   _listenSocket = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+   if( _listenSocket < 0 )
+   {
+      throw std::runtime_error( std::string("Failed to create socket: ") + std::strerror(errno) );
+   }
+
+   // Nobody else may connect, which is settled before anyone can
+   if( ::bind(_listenSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+       || ::chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0
+       || ::listen(_listenSocket, SOMAXCONN) != 0 )
+   {
+      std::string error = std::strerror( errno );
+      ::close( _listenSocket );
+      throw std::runtime_error( "Failed to listen on " + path + ": " + error );
+   }
+
+   _acceptThread = std::thread( &ControlSocket::_acceptLoop, this );
+}
+
+ControlSocket::~ControlSocket()
+{
+   _stop = true;
+   _acceptThread.join();
+   ::close( _listenSocket );
+   ::unlink( _path.c_str() );
+
+   std::unique_lock<std::mutex> lock( _mutex );
+   _idleCondition.wait( lock, [this](){return _activeConnections == 0;} );
+}
+
+std::string ControlSocket::execute( const std::string& line )
+{
+   std::istringstream stream( line );
+   std::string command;
+   std::string argument;
+   std::string extra;
+   stream >> command >> argument >> extra;
+   if( !extra.empty() )
+   {
+      return "error: too many arguments";
+   }
+
+   try
+   {
+      if( command == "threads" )
+      {
+         int threads = 0;
+         std::istringstream number( argument );
+         if( !(number >> threads) || !number.eof() || threads <= 0 )
+         {
+            return "error: threads takes a positive number";
+         }
+         _scheduler.setThreadCount( threads );
+         std::cout << "Control: mining with " << threads << (threads == 1 ? " thread" : " threads") << std::endl;
+      }
+      else if( command == "kernel" )
+      {
+         if( argument.empty() )
+         {
+            return "error: kernel takes a kernel type";
+         }
+
+         // Never mine with a kernel that gives wrong answers
+         SelfTest::verifyMiner( argument );
+         _scheduler.setMinerType( argument );
+         std::cout << "Control: mining with the \"" << argument << "\" kernel" << std::endl;
+      }
+      else if( command == "pause" || command == "resume" )
+      {
+         if( !argument.empty() )
+         {
+            return "error: " + command + " takes no arguments";
+         }
+
+         if( command == "pause" )
+         {
+            _scheduler.pause();
+         }
+         else
+         {
+            _scheduler.resume();
+         }
+         std::cout << "Control: mining " << (command == "pause" ? "paused" : "resumed") << std::endl;
+      }
+      else if( command == "stats" )
+      {
+         return _stats();
+      }
+      else
+      {
+         return "error: unknown command \"" + command + "\" (threads, kernel, pause, resume or stats)";
+      }
+   }
+   catch( std::exception& e )
+   {
+      return std::string( "error: " ) + e.what();
+   }
+
+   return "ok";
+}
+
+void ControlSocket::_acceptLoop()
+{
+   while( !_stop )
+   {
+      pollfd pfd = { _listenSocket, POLLIN, 0 };
+      if( ::poll(&pfd, 1, POLL_MS) <= 0 )
+      {
+         continue;
+      }
+
+      int connection = ::accept( _listenSocket, nullptr, nullptr );
+      if( connection < 0 )
+      {
+         continue;
+      }
+
+      {
+         std::lock_guard<std::mutex> lock( _mutex );
+         ++_activeConnections;
+      }
+
+      std::thread( [this,connection]()
+      {
+         _serve( connection );
+         ::close( connection );
+
+         std::lock_guard<std::mutex> lock( _mutex );
+         --_activeConnections;
+         _idleCondition.notify_all();
+      } ).detach();
+   }
+}
+
+// Answer each line until the other end closes, or the socket is shut
+void ControlSocket::_serve( int connection )
+{
+   std::string data;
+   char buffer[512];
+   while( !_stop )
+   {
+      pollfd pfd = { connection, POLLIN, 0 };
+      if( ::poll(&pfd, 1, POLL_MS) <= 0 )
+      {
+         continue;
+      }
+
+      auto bytes = ::recv( connection, buffer, sizeof(buffer), 0 );
+      if( bytes <= 0 )
+      {
+         return;
+      }
+      data.append( buffer, bytes );
+
+      size_t newline;
+      while( (newline = data.find('\n')) != std::string::npos )
+      {
+         auto line = data.substr( 0, newline );
+         data.erase( 0, newline + 1 );
+         if( !line.empty() && line.back() == '\r' )
+         {
+            line.pop_back();
+         }
+
+         if( line.find_first_not_of(" \t") != std::string::npos && !sendAll(connection, execute(line) + "\n") )
+         {
+            return;
+         }
+      }
+
+      if( data.size() > MAX_LINE_SIZE )
+      {
+         sendAll( connection, "error: line too long\n" );
+         return;
+      }
+   }
+}
+
+std::string ControlSocket::_stats()
+{
+   auto now = std::chrono::steady_clock::now();
+   auto hashes = _scheduler.hashCount();
+
+   double rate;
+   {
+      std::lock_guard<std::mutex> lock( _mutex );
+      double seconds = std::chrono::duration<double>( now - _lastStats ).count();
+      rate = seconds > 0 ? (hashes - _lastHashes) / seconds : 0;
+      _lastStats = now;
+      _lastHashes = hashes;
+   }
+
+   std::ostringstream stats;
+   stats << "ok kernel=" << _scheduler.minerType()
+         << " threads=" << _scheduler.threadCount()
+         << " paused=" << (_scheduler.paused() ? 1 : 0)
+         << " hashes=" << hashes
+         << " hashrate=" << static_cast<uint64_t>( rate );
+   return stats.str();
+}
@@ -0,0 +1,76 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include "Scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * A Unix-domain socket for retuning the miner while it runs, e.g. to shed
+ * load when power is dear. Commands are one per line, each answered with a
+ * line starting "ok" or "error:":
+ *
+ *    threads <n>     mine with n threads
+ *    kernel <type>   switch kernels, once the new one passes its self test
+ *    pause           stop hashing, keeping the block being mined
+ *    resume          carry on hashing
+ *    stats           "ok kernel=<type> threads=<n> paused=<0|1> hashes=<n>
+ *                    hashrate=<hashes per second since the last stats>"
+ *
+ * Changes reach each thread at its next step, within hundredths of a second,
+ * and mining carries on over the same nonce range (see Scheduler). Only the
+ * user running the miner can connect, e.g. with socat - UNIX-CONNECT:<path>.
+ */
+class ControlSocket
+{
+public:
+   /*
+    * Listen at the given path, replacing a socket left there by a miner that
+    * didn't exit cleanly. Throws std::runtime_error if it can't.
+    */
+   ControlSocket( const std::string& path, Scheduler& scheduler );
+
+   /*
+    * Stop listening, close the connections and remove the socket.
+    */
+   ~ControlSocket();
+
+   ControlSocket( const ControlSocket& ) = delete;
+   ControlSocket& operator =( const ControlSocket& ) = delete;
+
+   /*
+    * Run a command line, returning its answer (without a newline).
+    */
+   std::string execute( const std::string& line );
+
+private:
+   void _acceptLoop();
+   void _serve( int connection );
+   std::string _stats();
+
+private:
+   std::string             _path;
+   Scheduler&              _scheduler;
+   int                     _listenSocket;
+   std::atomic<bool>       _stop;
+   std::thread             _acceptThread;
+
+   std::mutex              _mutex;
+   std::condition_variable _idleCondition;
+   int                     _activeConnections;
+
+   // Where the last stats left off, for the hash rate since
+   std::chrono::steady_clock::time_point  _lastStats;
+   uint64_t                               _lastHashes;
+};
+
+#endif // !CONTROL_SOCKET_H
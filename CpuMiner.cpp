@@ -19,11 +19,13 @@ public:
    }
 
 protected:
-   virtual Result _mine( const Sha256& preHash, const ByteArray& reverseTarget, uint32_t& nonce )
+   virtual Result _mine( const Sha256& preHash,
+                         const ByteArray& reverseTarget,
+                         uint32_t& nonce,
+                         uint32_t lastNonce )
    {
       assert( reverseTarget.size() == sizeof(Sha256::Digest) );
 
-      nonce = 0;
       do
       {
          // Complete the first hash
@@ -36,19 +38,20 @@ protected:
          // Do it again
          auto result = Sha256::hash( digest.toByteArray() );
 
-         for( int i = result.size() - 1; i >= 0; --i )
+         // Compare from the most significant byte. Equal counts as a solution.
+         int i = result.size() - 1;
+         while( i >= 0 && result[i] == reverseTarget[i] )
          {
-            if( result[i] > reverseTarget[i] )
-            {
-               break;
-            }
-
-            if( result[i] < reverseTarget[i] )
-            {
-               return SolutionFound;
-            }
+            --i;
          }
-      } while( nonce++ < std::numeric_limits<uint32_t>::max() );
+
+         if( i < 0 || result[i] < reverseTarget[i] )
+         {
+            return SolutionFound;
+         }
+      } while( nonce++ < lastNonce );
+
+      nonce = lastNonce;
 
       return NoSolutionFound;
    }
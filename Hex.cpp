@@ -0,0 +1,305 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "Hex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HEX_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+struct Tables
+{
+   Tables()
+   {
+      for( int i = 0; i < 256; ++i )
+      {
+         encode[i * 2]     = HEX_DIGITS[i >> 4];
+         encode[i * 2 + 1] = HEX_DIGITS[i & 0xf];
+         decode[i] = -1;
+      }
+      for( int i = 0; i < 16; ++i )
+      {
+         decode[static_cast<uint8_t>(HEX_DIGITS[i])] = i;
+      }
+      for( int i = 10; i < 16; ++i )
+      {
+         decode['A' + i - 10] = i;
+      }
+   }
+
+   char     encode[512];
+   int8_t   decode[256];
+};
+
+const Tables& tables()
+{
+   static const Tables t;
+   return t;
+}
+
+void encodeScalar( const uint8_t* data, size_t size, char* hex )
+{
+   auto& table = tables().encode;
+   for( size_t i = 0; i < size; ++i )
+   {
+      hex[i * 2]     = table[data[i] * 2];
+      hex[i * 2 + 1] = table[data[i] * 2 + 1];
+   }
+}
+
+bool decodeScalar( const char* hex, size_t pairs, uint8_t* data )
+{
+   auto& table = tables().decode;
+
+   // Invalid characters decode to -1; check for them once at the end
+   int invalid = 0;
+   for( size_t i = 0; i < pairs; ++i )
+   {
+      int hi = table[static_cast<uint8_t>(hex[i * 2])];
+      int lo = table[static_cast<uint8_t>(hex[i * 2 + 1])];
+      invalid |= hi | lo;
+      data[i] = static_cast<uint8_t>(hi << 4 | lo);
+   }
+
+   return invalid >= 0;
+}
+
+#ifdef HEX_X86
+
+//
+// SSE4.1: 16 bytes <-> 32 characters per iteration
+//
+
+__attribute__((target("sse4.1")))
+inline __m128i hexNibbles128( __m128i chars, __m128i& valid )
+{
+   // Characters below '0' or 'a' wrap around, so one unsigned range check
+   // each is enough. Or-ing in 0x20 folds upper case onto lower case.
+   const __m128i zero = _mm_setzero_si128();
+   __m128i digits = _mm_sub_epi8( chars, _mm_set1_epi8('0') );
+   __m128i letters = _mm_sub_epi8( _mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a') );
+   __m128i isDigit = _mm_cmpeq_epi8( _mm_subs_epu8(digits, _mm_set1_epi8(9)), zero );
+   __m128i isLetter = _mm_cmpeq_epi8( _mm_subs_epu8(letters, _mm_set1_epi8(5)), zero );
+
+   valid = _mm_and_si128( valid, _mm_or_si128(isDigit, isLetter) );
+   return _mm_blendv_epi8( _mm_add_epi8(letters, _mm_set1_epi8(10)), digits, isDigit );
+}
+
+__attribute__((target("sse4.1")))
+bool decodeSse41( const char* hex, size_t pairs, uint8_t* data )
+{
+   // Each 16-bit lane holds (high nibble, low nibble); multiply-add them
+   // into one byte value
+   const __m128i weights = _mm_set1_epi16( 0x0110 );
+   __m128i valid = _mm_set1_epi8( -1 );
+
+   size_t i = 0;
+   for( ; i + 16 <= pairs; i += 16 )
+   {
+      auto src = reinterpret_cast<const __m128i*>(hex + i * 2);
+      __m128i first = hexNibbles128( _mm_loadu_si128(src), valid );
+      __m128i second = hexNibbles128( _mm_loadu_si128(src + 1), valid );
+      __m128i bytes = _mm_packus_epi16( _mm_maddubs_epi16(first, weights),
+                                        _mm_maddubs_epi16(second, weights) );
+      _mm_storeu_si128( reinterpret_cast<__m128i*>(data + i), bytes );
+   }
+
+   if( _mm_movemask_epi8(valid) != 0xffff )
+   {
+      return false;
+   }
+   return decodeScalar( hex + i * 2, pairs - i, data + i );
+}
+
+__attribute__((target("sse4.1")))
+void encodeSse41( const uint8_t* data, size_t size, char* hex )
+{
+   const __m128i digits = _mm_loadu_si128( reinterpret_cast<const __m128i*>(HEX_DIGITS) );
+   const __m128i mask = _mm_set1_epi8( 0x0f );
+
+   size_t i = 0;
+   for( ; i + 16 <= size; i += 16 )
+   {
+      __m128i bytes = _mm_loadu_si128( reinterpret_cast<const __m128i*>(data + i) );
+      __m128i hi = _mm_and_si128( _mm_srli_epi16(bytes, 4), mask );
+      __m128i lo = _mm_and_si128( bytes, mask );
+
+      auto dest = reinterpret_cast<__m128i*>(hex + i * 2);
+      _mm_storeu_si128( dest,     _mm_shuffle_epi8(digits, _mm_unpacklo_epi8(hi, lo)) );
+      _mm_storeu_si128( dest + 1, _mm_shuffle_epi8(digits, _mm_unpackhi_epi8(hi, lo)) );
+   }
+
+   encodeScalar( data + i, size - i, hex + i * 2 );
+}
+
+//
+// AVX2: 32 bytes <-> 64 characters per iteration
+//
+
+__attribute__((target("avx2")))
+inline __m256i hexNibbles256( __m256i chars, __m256i& valid )
+{
+   const __m256i zero = _mm256_setzero_si256();
+   __m256i digits = _mm256_sub_epi8( chars, _mm256_set1_epi8('0') );
+   __m256i letters = _mm256_sub_epi8( _mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a') );
+   __m256i isDigit = _mm256_cmpeq_epi8( _mm256_subs_epu8(digits, _mm256_set1_epi8(9)), zero );
+   __m256i isLetter = _mm256_cmpeq_epi8( _mm256_subs_epu8(letters, _mm256_set1_epi8(5)), zero );
+
+   valid = _mm256_and_si256( valid, _mm256_or_si256(isDigit, isLetter) );
+   return _mm256_blendv_epi8( _mm256_add_epi8(letters, _mm256_set1_epi8(10)), digits, isDigit );
+}
+
+__attribute__((target("avx2")))
+bool decodeAvx2( const char* hex, size_t pairs, uint8_t* data )
+{
+   const __m256i weights = _mm256_set1_epi16( 0x0110 );
+   __m256i valid = _mm256_set1_epi8( -1 );
+
+   size_t i = 0;
+   for( ; i + 32 <= pairs; i += 32 )
+   {
+      auto src = reinterpret_cast<const __m256i*>(hex + i * 2);
+      __m256i first = hexNibbles256( _mm256_loadu_si256(src), valid );
+      __m256i second = hexNibbles256( _mm256_loadu_si256(src + 1), valid );
+      // The pack works within 128-bit lanes, so put the quarters back in order
+      __m256i bytes = _mm256_packus_epi16( _mm256_maddubs_epi16(first, weights),
+                                           _mm256_maddubs_epi16(second, weights) );
+      bytes = _mm256_permute4x64_epi64( bytes, _MM_SHUFFLE(3, 1, 2, 0) );
+      _mm256_storeu_si256( reinterpret_cast<__m256i*>(data + i), bytes );
+   }
+
+   if( _mm256_movemask_epi8(valid) != -1 )
+   {
+      return false;
+   }
+   return decodeSse41( hex + i * 2, pairs - i, data + i );
+}
+
+__attribute__((target("avx2")))
+void encodeAvx2( const uint8_t* data, size_t size, char* hex )
+{
+   const __m256i digits = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(HEX_DIGITS)) );
+   const __m256i mask = _mm256_set1_epi8( 0x0f );
+
+   size_t i = 0;
+   for( ; i + 32 <= size; i += 32 )
+   {
+      __m256i bytes = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(data + i) );
+      __m256i hi = _mm256_and_si256( _mm256_srli_epi16(bytes, 4), mask );
+      __m256i lo = _mm256_and_si256( bytes, mask );
+
+      // Unpacking works within 128-bit lanes, giving bytes 0-7 and 16-23 in
+      // the first register and 8-15 and 24-31 in the second
+      __m256i first = _mm256_shuffle_epi8( digits, _mm256_unpacklo_epi8(hi, lo) );
+      __m256i second = _mm256_shuffle_epi8( digits, _mm256_unpackhi_epi8(hi, lo) );
+
+      auto dest = reinterpret_cast<__m256i*>(hex + i * 2);
+      _mm256_storeu_si256( dest,     _mm256_permute2x128_si256(first, second, 0x20) );
+      _mm256_storeu_si256( dest + 1, _mm256_permute2x128_si256(first, second, 0x31) );
+   }
+
+   encodeSse41( data + i, size - i, hex + i * 2 );
+}
+
+#endif // HEX_X86
+
+Hex::Implementation detect()
+{
+#ifdef HEX_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports("avx2") )
+      return Hex::Avx2;
+   if( __builtin_cpu_supports("sse4.1") )
+      return Hex::Sse41;
+#endif
+   return Hex::Scalar;
+}
+
+// Use the scalar code for implementations the CPU can't run. They're listed
+// in order of capability.
+Hex::Implementation resolve( Hex::Implementation impl )
+{
+   auto best = Hex::best();
+   if( impl == Hex::Best )
+      return best;
+   if( impl > best )
+      return Hex::Scalar;
+   return impl;
+}
+
+} // namespace
+
+void Hex::encode( const uint8_t* data, size_t size, char* hex )
+{
+   encode( data, size, hex, Best );
+}
+
+bool Hex::decode( const char* hex, size_t size, uint8_t* data )
+{
+   return decode( hex, size, data, Best );
+}
+
+void Hex::encode( const uint8_t* data, size_t size, char* hex, Implementation impl )
+{
+   switch( resolve(impl) )
+   {
+#ifdef HEX_X86
+   case Avx2:
+      encodeAvx2( data, size, hex );
+      break;
+   case Sse41:
+      encodeSse41( data, size, hex );
+      break;
+#endif
+   default:
+      encodeScalar( data, size, hex );
+      break;
+   }
+}
+
+bool Hex::decode( const char* hex, size_t size, uint8_t* data, Implementation impl )
+{
+   if( size % 2 != 0 )
+   {
+      return false;
+   }
+
+   switch( resolve(impl) )
+   {
+#ifdef HEX_X86
+   case Avx2:
+      return decodeAvx2( hex, size / 2, data );
+   case Sse41:
+      return decodeSse41( hex, size / 2, data );
+#endif
+   default:
+      return decodeScalar( hex, size / 2, data );
+   }
+}
+
+Hex::Implementation Hex::best()
+{
+   static const Implementation impl = detect();
+   return impl;
+}
+
+const char* Hex::name( Implementation impl )
+{
+   switch( resolve(impl) )
+   {
+   case Avx2:
+      return "avx2";
+   case Sse41:
+      return "sse4.1";
+   default:
+      return "scalar";
+   }
+}
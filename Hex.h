@@ -0,0 +1,54 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef HEX_H
+#define HEX_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Base 16 codec for the hex strings that carry all transaction and block data
+ * to and from the node. Works on caller-provided buffers, and uses AVX2 or
+ * SSE4.1 when the CPU has them, with a table-driven scalar fallback.
+ */
+class Hex
+{
+public:
+   enum Implementation
+   {
+      Best,
+      Scalar,
+      Sse41,
+      Avx2
+   };
+
+public:
+   /*
+    * Encode size bytes of data as 2 * size lowercase hex characters. The
+    * output is not null-terminated.
+    */
+   static void encode( const uint8_t* data, size_t size, char* hex );
+
+   /*
+    * Decode size hex characters (either case) into size / 2 bytes. Returns
+    * false if size is odd or a character isn't a hex digit, in which case
+    * the output is undefined.
+    */
+   static bool decode( const char* hex, size_t size, uint8_t* data );
+
+   /*
+    * Versions of the above using a specific implementation, for testing.
+    * Passing one the CPU doesn't support falls back to the scalar code.
+    */
+   static void encode( const uint8_t* data, size_t size, char* hex, Implementation impl );
+   static bool decode( const char* hex, size_t size, uint8_t* data, Implementation impl );
+
+   /*
+    * The implementation selected for this CPU.
+    */
+   static Implementation best();
+   static const char* name( Implementation impl );
+};
+
+#endif // !HEX_H
@@ -0,0 +1,277 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "HttpServer.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+// How often the accept loop checks whether it should stop
+const int ACCEPT_POLL_MS = 200;
+
+// Refuse requests larger than this
+const size_t MAX_REQUEST_SIZE = 64 * 1024 * 1024;
+
+// Drop clients that go quiet for this long mid-request
+const int RECEIVE_TIMEOUT_SECONDS = 30;
+
+static const char* statusText( int status )
+{
+   switch( status )
+   {
+   case 200: return "OK";
+   case 400: return "Bad Request";
+   case 404: return "Not Found";
+   case 405: return "Method Not Allowed";
+   case 500: return "Internal Server Error";
+   default:  return "Unknown";
+   }
+}
+
+static bool sendAll( int fd, const std::string& data )
+{
+   size_t sent = 0;
+   while( sent < data.size() )
+   {
+      auto bytes = ::send( fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL );
+      if( bytes <= 0 )
+      {
+         return false;
+      }
+      sent += bytes;
+   }
+   return true;
+}
+
+static bool sendResponse( int fd, const HttpServer::Response& response )
+{
+   std::ostringstream header;
+   header << "HTTP/1.1 " << response.status << " " << statusText(response.status) << "\r\n"
+          << "Content-Type: " << response.contentType << "\r\n"
+          << "Content-Length: " << response.body.size() << "\r\n"
+          << "Connection: close\r\n"
+          << "\r\n";
+
+   return sendAll( fd, header.str() ) && sendAll( fd, response.body );
+}
+
+// A Content-Length value: digits only, and no larger than we'd accept
+static bool parseLength( const std::string& text, size_t& length )
+{
+   if( text.empty() || text.size() > 10 || text.find_first_not_of("0123456789") != std::string::npos )
+   {
+      return false;
+   }
+
+   length = 0;
+   for( auto c : text )
+   {
+      length = length * 10 + (c - '0');
+   }
+   return length <= MAX_REQUEST_SIZE;
+}
+
+HttpServer::Response::Response()
+ : status(200),
+   contentType("text/plain")
+{
+}
+
+HttpServer::HttpServer( const std::string& address, int port, Handler handler )
+ : _handler(handler),
+   _listenSocket(-1),
+   _port(port),
+   _stop(false),
+   _activeConnections(0)
+{
+   sockaddr_in addr;
+   std::memset( &addr, 0, sizeof(addr) );
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons( port );
+   if( inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1 )
+   {
+      throw std::runtime_error( "Invalid listen address: " + address );
+   }
+
+   _listenSocket = ::socket( AF_INET, SOCK_STREAM, 0 );
+   if( _listenSocket < 0 )
+   {
+      throw std::runtime_error( std::string("Failed to create socket: ") + std::strerror(errno) );
+   }
+
+   int reuse = 1;
+   ::setsockopt( _listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse) );
+
+   if( ::bind(_listenSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+       || ::listen(_listenSocket, SOMAXCONN) != 0 )
+   {
+      std::string error = std::strerror( errno );
+      ::close( _listenSocket );
+      throw std::runtime_error( "Failed to listen on " + address + ":" + std::to_string(port) + ": " + error );
+   }
+
+   socklen_t addrLen = sizeof(addr);
+   ::getsockname( _listenSocket, reinterpret_cast<sockaddr*>(&addr), &addrLen );
+   _port = ntohs( addr.sin_port );
+
+   _acceptThread = std::thread( &HttpServer::_acceptLoop, this );
+}
+
+HttpServer::~HttpServer()
+{
+   _stop = true;
+   _acceptThread.join();
+   ::close( _listenSocket );
+
+   std::unique_lock<std::mutex> lock( _mutex );
+   _idleCondition.wait( lock, [this](){return _activeConnections == 0;} );
+}
+
+int HttpServer::port() const
+{
+   return _port;
+}
+
+void HttpServer::_acceptLoop()
+{
+   while( !_stop )
+   {
+      pollfd pfd = { _listenSocket, POLLIN, 0 };
+      if( ::poll(&pfd, 1, ACCEPT_POLL_MS) <= 0 )
+      {
+         continue;
+      }
+
+      int connection = ::accept( _listenSocket, nullptr, nullptr );
+      if( connection < 0 )
+      {
+         continue;
+      }
+
+      // Or a silent client would hold up the destructor forever
+      timeval timeout = { RECEIVE_TIMEOUT_SECONDS, 0 };
+      ::setsockopt( connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+
+      {
+         std::lock_guard<std::mutex> lock( _mutex );
+         ++_activeConnections;
+      }
+
+      std::thread( [this,connection]()
+      {
+         _serve( connection );
+         ::close( connection );
+
+         std::lock_guard<std::mutex> lock( _mutex );
+         --_activeConnections;
+         _idleCondition.notify_all();
+      } ).detach();
+   }
+}
+
+void HttpServer::_serve( int connection )
+{
+   // Read until the end of the headers
+   std::string data;
+   size_t headerEnd = std::string::npos;
+   char buffer[4096];
+   while( headerEnd == std::string::npos )
+   {
+      auto bytes = ::recv( connection, buffer, sizeof(buffer), 0 );
+      if( bytes <= 0 || data.size() > MAX_REQUEST_SIZE )
+      {
+         return;
+      }
+      data.append( buffer, bytes );
+      headerEnd = data.find( "\r\n\r\n" );
+   }
+
+   Request request;
+   std::istringstream headerStream( data.substr(0, headerEnd) );
+   std::string line;
+   std::getline( headerStream, line );
+   std::istringstream requestLine( line );
+   requestLine >> request.method >> request.path;
+
+   while( std::getline(headerStream, line) )
+   {
+      if( !line.empty() && line.back() == '\r' )
+      {
+         line.pop_back();
+      }
+
+      auto colon = line.find( ':' );
+      if( colon == std::string::npos )
+      {
+         continue;
+      }
+
+      auto name = line.substr( 0, colon );
+      std::transform( name.begin(), name.end(), name.begin(), ::tolower );
+      auto valueStart = line.find_first_not_of( ' ', colon + 1 );
+      request.headers[name] = (valueStart == std::string::npos) ? "" : line.substr( valueStart );
+   }
+
+   // Read the rest of the body
+   request.body = data.substr( headerEnd + 4 );
+   auto lengthHeader = request.headers.find( "content-length" );
+   if( lengthHeader != request.headers.end() )
+   {
+      size_t length;
+      if( !parseLength(lengthHeader->second, length) )
+      {
+         Response response;
+         response.status = 400;
+         response.body = "Invalid Content-Length\n";
+         sendResponse( connection, response );
+         return;
+      }
+
+      // Clients that asked wait for this before sending a large body
+      auto expect = request.headers.find( "expect" );
+      if( request.body.size() < length && expect != request.headers.end() )
+      {
+         auto value = expect->second;
+         std::transform( value.begin(), value.end(), value.begin(), ::tolower );
+         if( value == "100-continue" && !sendAll(connection, "HTTP/1.1 100 Continue\r\n\r\n") )
+         {
+            return;
+         }
+      }
+
+      while( request.body.size() < length )
+      {
+         auto bytes = ::recv( connection, buffer, sizeof(buffer), 0 );
+         if( bytes <= 0 )
+         {
+            return;
+         }
+         request.body.append( buffer, bytes );
+      }
+   }
+
+   Response response;
+   try
+   {
+      response = _handler( request );
+   }
+   catch( std::exception& e )
+   {
+      response.status = 500;
+      response.contentType = "text/plain";
+      response.body = e.what();
+   }
+
+   sendResponse( connection, response );
+}
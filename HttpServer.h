@@ -0,0 +1,72 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * Minimal HTTP/1.1 server for local endpoints. Each connection is served on
+ * its own thread and closed after a single request, which is all that
+ * monitoring scrapers and cURL-based clients need.
+ */
+class HttpServer
+{
+public:
+   struct Request
+   {
+      std::string                         method;
+      std::string                         path;
+      std::map<std::string,std::string>   headers;   // Names in lower case
+      std::string                         body;
+   };
+
+   struct Response
+   {
+      Response();
+
+      int         status;
+      std::string contentType;
+      std::string body;
+   };
+
+   typedef std::function<Response(const Request&)> Handler;
+
+public:
+   /*
+    * Start listening. A port of 0 picks any free port. Throws
+    * std::runtime_error if the socket can't be set up.
+    */
+   HttpServer( const std::string& address, int port, Handler handler );
+
+   /*
+    * Stop accepting connections and wait for requests in progress.
+    */
+   ~HttpServer();
+
+   int port() const;
+
+private:
+   void _acceptLoop();
+   void _serve( int connection );
+
+private:
+   Handler                 _handler;
+   int                     _listenSocket;
+   int                     _port;
+   std::atomic<bool>       _stop;
+   std::thread             _acceptThread;
+
+   std::mutex              _mutex;
+   std::condition_variable _idleCondition;
+   int                     _activeConnections;
+};
+
+#endif // !HTTP_SERVER_H
@@ -4,15 +4,22 @@
 
 #include "JsonRpc.h"
 #include "Settings.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 #include <curl/curl.h>
 
 #include <stdexcept>
 #include <cstring>
 #include <cassert>
-#include <thread>
-#include <functional>
+#include <algorithm>
 #include <iostream>
+#include <chrono>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
@@ -65,6 +72,28 @@ static std::string encodeBase64( std::string str )
    return ret;
 }
 
+// Records the duration of a call in Metrics when it goes out of scope. Calls
+// count as failed unless marked otherwise before then.
+struct CallTimer
+{
+   CallTimer( const std::string& method )
+    : method(method),
+      start(chrono::steady_clock::now()),
+      failed(true)
+   {
+   }
+
+   ~CallTimer()
+   {
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      Metrics::rpcCall( method, elapsed.count(), failed );
+   }
+
+   std::string                      method;
+   chrono::steady_clock::time_point start;
+   bool                             failed;
+};
+
 size_t recvPostData( char* ptr, size_t size, size_t nmemb, void* userdata )
 {
    string& recvBuf = *reinterpret_cast<string*>(userdata);
@@ -73,11 +102,341 @@ size_t recvPostData( char* ptr, size_t size, size_t nmemb, void* userdata )
    return bytes;
 }
 
+// Splits a streamed reply into its envelope members, which are kept, and its
+// result, which is passed through to another handler
+class ReplyHandler : public JsonStreamParser::Handler
+{
+public:
+   ReplyHandler( JsonStreamParser::Handler& resultHandler )
+    : _resultHandler(resultHandler),
+      _target(nullptr),
+      _depth(0)
+   {
+   }
+
+   virtual void startObject()
+   {
+      if( _depth == 0 )
+      {
+         ++_depth;
+         _envelope = Json::objectValue;
+         return;
+      }
+      _beginMember();
+      ++_depth;
+      _target->startObject();
+   }
+
+   virtual void endObject()
+   {
+      if( --_depth > 0 )
+      {
+         _target->endObject();
+      }
+   }
+
+   virtual void startArray()
+   {
+      _beginMember();
+      ++_depth;
+      _target->startArray();
+   }
+
+   virtual void endArray()
+   {
+      --_depth;
+      _target->endArray();
+   }
+
+   virtual void key( std::string& name )
+   {
+      if( _depth == 1 )
+      {
+         _member = name;
+         _sawMember[name] = true;
+      }
+      else
+      {
+         _target->key( name );
+      }
+   }
+
+   virtual void string( std::string& value )         { _beginMember(); _target->string( value ); }
+   virtual void number( const std::string& text )    { _beginMember(); _target->number( text ); }
+   virtual void boolean( bool value )                { _beginMember(); _target->boolean( value ); }
+   virtual void null()                               { _beginMember(); _target->null(); }
+
+   const Json::Value& envelope() const
+   {
+      return _envelope;
+   }
+
+   bool hasMember( const std::string& name ) const
+   {
+      return _sawMember.count( name ) > 0;
+   }
+
+private:
+   void _beginMember()
+   {
+      if( _depth == 0 )
+      {
+         throw runtime_error( "Invalid response received from JSON-RPC server" );
+      }
+
+      if( _depth > 1 )
+      {
+         return;
+      }
+
+      if( _member == "result" )
+      {
+         _target = &_resultHandler;
+      }
+      else
+      {
+         _builder.reset( new JsonValueBuilder(_envelope[_member]) );
+         _target = _builder.get();
+      }
+   }
+
+private:
+   JsonStreamParser::Handler&          _resultHandler;
+   JsonStreamParser::Handler*          _target;
+   std::unique_ptr<JsonValueBuilder>   _builder;
+   int                                 _depth;
+   std::string                         _member;
+   std::map<std::string,bool>          _sawMember;
+   Json::Value                         _envelope;
+};
+
+struct StreamState
+{
+   StreamState( JsonStreamParser& parser )
+    : parser(parser),
+      bytes(0)
+   {
+   }
+
+   JsonStreamParser&    parser;
+   size_t               bytes;
+   std::exception_ptr   error;
+};
+
+size_t recvStreamData( char* ptr, size_t size, size_t nmemb, void* userdata )
+{
+   auto& state = *reinterpret_cast<StreamState*>(userdata);
+   size_t bytes = size * nmemb;
+
+   // Exceptions can't propagate through cURL, so stop the transfer and
+   // rethrow afterward
+   try
+   {
+      state.parser.feed( ptr, bytes );
+      state.bytes += bytes;
+   }
+   catch( ... )
+   {
+      state.error = std::current_exception();
+      return 0;
+   }
+
+   return bytes;
+}
+
+// Drives every asynchronous transfer on one thread with cURL's multi
+// interface. Each transfer's completion function is called on that thread,
+// with cURL's result, after which its handle is cleaned up.
+class EventLoop
+{
+public:
+   typedef std::function<void(CURLcode)> DoneFn;
+
+   static EventLoop& get()
+   {
+      static EventLoop loop;
+      return loop;
+   }
+
+   uint64_t add( CURL* curl, DoneFn done )
+   {
+      std::lock_guard<std::mutex> lock( _mutex );
+      auto id = ++_lastId;
+      _added.push_back( Transfer{id, curl, std::move(done)} );
+      curl_multi_wakeup( _multi );
+      return id;
+   }
+
+   void cancel( uint64_t id )
+   {
+      std::lock_guard<std::mutex> lock( _mutex );
+      _cancelled.push_back( id );
+      curl_multi_wakeup( _multi );
+   }
+
+private:
+   struct Transfer
+   {
+      uint64_t id;
+      CURL*    curl;
+      DoneFn   done;
+   };
+
+   EventLoop()
+    : _multi(curl_multi_init()),
+      _lastId(0),
+      _stop(false)
+   {
+      if( _multi == NULL )
+         throw std::runtime_error( "Failed to initialize cURL" );
+
+      _thread = std::thread( &EventLoop::_run, this );
+   }
+
+   ~EventLoop()
+   {
+      {
+         std::lock_guard<std::mutex> lock( _mutex );
+         _stop = true;
+         curl_multi_wakeup( _multi );
+      }
+      _thread.join();
+      curl_multi_cleanup( _multi );
+   }
+
+   void _run()
+   {
+      std::map<CURL*, Transfer> active;
+      for( ;; )
+      {
+         std::vector<Transfer> added;
+         std::vector<uint64_t> cancelled;
+         bool stop;
+         {
+            std::lock_guard<std::mutex> lock( _mutex );
+            added.swap( _added );
+            cancelled.swap( _cancelled );
+            stop = _stop;
+         }
+
+         for( auto& transfer : added )
+         {
+            curl_multi_add_handle( _multi, transfer.curl );
+            active.emplace( transfer.curl, std::move(transfer) );
+         }
+
+         for( auto it = active.begin(); it != active.end(); )
+         {
+            if( stop || std::find(cancelled.begin(), cancelled.end(), it->second.id) != cancelled.end() )
+            {
+               _finish( it->second, CURLE_ABORTED_BY_CALLBACK );
+               it = active.erase( it );
+            }
+            else
+            {
+               ++it;
+            }
+         }
+
+         if( stop )
+         {
+            return;
+         }
+
+         int running = 0;
+         curl_multi_perform( _multi, &running );
+
+         int queued = 0;
+         while( auto message = curl_multi_info_read(_multi, &queued) )
+         {
+            auto found = active.find( message->easy_handle );
+            if( message->msg != CURLMSG_DONE || found == active.end() )
+               continue;
+
+            _finish( found->second, message->data.result );
+            active.erase( found );
+         }
+
+         curl_multi_poll( _multi, NULL, 0, 1000, NULL );
+      }
+   }
+
+   void _finish( Transfer& transfer, CURLcode code )
+   {
+      curl_multi_remove_handle( _multi, transfer.curl );
+      try
+      {
+         transfer.done( code );
+      }
+      catch( ... )
+      {
+         // Nothing to report it to; completion functions shouldn't throw
+      }
+      curl_easy_cleanup( transfer.curl );
+   }
+
+private:
+   CURLM*                  _multi;
+   std::thread             _thread;
+
+   std::mutex              _mutex;
+   uint64_t                _lastId;
+   std::vector<Transfer>   _added;
+   std::vector<uint64_t>   _cancelled;
+   bool                    _stop;
+};
+
+JsonRpc::Call::Call( const std::string& method, const Json::Value& params )
+ : method(method),
+   params(params)
+{
+}
+
+bool JsonRpc::Reply::failed() const
+{
+   return !error.isNull();
+}
+
+JsonRpc::AsyncCall::AsyncCall()
+ : _transfer(0)
+{
+}
+
+JsonRpc::AsyncCall::AsyncCall( uint64_t transfer, std::future<Json::Value>&& result )
+ : _transfer(transfer),
+   _result(std::move(result))
+{
+}
+
+bool JsonRpc::AsyncCall::valid() const
+{
+   return _result.valid();
+}
+
+bool JsonRpc::AsyncCall::ready() const
+{
+   return _result.wait_for( chrono::seconds(0) ) == std::future_status::ready;
+}
+
+Json::Value JsonRpc::AsyncCall::get()
+{
+   return _result.get();
+}
+
+void JsonRpc::AsyncCall::cancel()
+{
+   if( _transfer != 0 && !ready() )
+   {
+      EventLoop::get().cancel( _transfer );
+   }
+}
+
 JsonRpc::JsonRpc( const std::string& url, 
                   int port,
                   const std::string& username, 
                   const std::string& password )
- : _headers(NULL)
+ : _headers(NULL),
+   _nextId(0)
 {
    _url = url + ":" + to_string( port );
 
@@ -89,6 +448,9 @@ JsonRpc::JsonRpc( const std::string& url,
 
    _headers = curl_slist_append( _headers, authHeader.c_str() );
    _headers = curl_slist_append( _headers, "Content-Type: application/json" );
+   // cURL would otherwise wait up to a second for "100 Continue" before
+   // sending a large body, such as a block
+   _headers = curl_slist_append( _headers, "Expect:" );
 }
 
 JsonRpc::~JsonRpc()
@@ -98,62 +460,281 @@ JsonRpc::~JsonRpc()
 
 Json::Value JsonRpc::call( const std::string& method, const Json::Value& params )
 {
-   auto curl = curl_easy_init();
-   if( curl == NULL )
-      throw std::runtime_error( "Failed to initialize cURL" );
+   TRACE_SCOPE( "JsonRpc::call", method );
+   CallTimer timer( method );
 
-   Json::Value req;
-   req["jsonrpc"] = "1.0";
-   req["id"]      = static_cast<unsigned int>(hash<thread::id>()(this_thread::get_id()));
-   req["method"]  = method;
-   req["params"]  = params;
+   auto req = _makeRequest( method, params, _nextId++ );
+   auto response = _post( req );
 
-   if( Settings::debug() )
+   _checkReply( response );
+
+   if( !response["error"].isNull() )
+      throw runtime_error( string("JSON-RPC Error: ") + response["error"]["message"].asString() );
+
+   if( response["id"].asUInt() != req["id"].asUInt() )
+      throw runtime_error( "Received response with wrong ID" );
+
+   timer.failed = false;
+   return response["result"];
+}
+
+void JsonRpc::call( const std::string& method,
+                    const Json::Value& params,
+                    JsonStreamParser::Handler& resultHandler )
+{
+   TRACE_SCOPE( "JsonRpc::call", method );
+   CallTimer timer( method );
+
+   auto req = _makeRequest( method, params, _nextId++ );
+
+   ReplyHandler replyHandler( resultHandler );
+   JsonStreamParser parser( replyHandler );
+   _post( req, parser );
+
+   auto& response = replyHandler.envelope();
+   if( !replyHandler.hasMember("result") || !response.isMember("error") || !response.isMember("id") )
+      throw runtime_error( "Invalid response received from JSON-RPC server" );
+
+   if( !response["error"].isNull() )
+      throw runtime_error( string("JSON-RPC Error: ") + response["error"]["message"].asString() );
+
+   if( response["id"].asUInt() != req["id"].asUInt() )
+      throw runtime_error( "Received response with wrong ID" );
+
+   timer.failed = false;
+}
+
+std::vector<JsonRpc::Reply> JsonRpc::batch( const std::vector<Call>& calls )
+{
+   if( calls.empty() )
+      throw runtime_error( "Empty JSON-RPC batch" );
+
+   // IDs are reserved as a block, as other threads may be making calls too,
+   // so that replies can be matched by their offset from the first
+   const unsigned firstId = _nextId.fetch_add( calls.size() );
+   std::string methods;
+   Json::Value req = Json::arrayValue;
+   for( auto& call : calls )
    {
-      cout << "REQUEST: " << endl << req << endl;
+      req.append( _makeRequest(call.method, call.params, firstId + req.size()) );
+      methods += (methods.empty() ? "" : ",") + call.method;
    }
 
-   Json::FastWriter writer;
-   string data = writer.write( req );
+   TRACE_SCOPE( "JsonRpc::batch", methods );
+   CallTimer timer( "batch" );
 
-   string recvData;
+   auto response = _post( req );
 
-   curl_easy_setopt( curl, CURLOPT_URL, _url.c_str() );
-   curl_easy_setopt( curl, CURLOPT_HTTPHEADER, _headers );
-   curl_easy_setopt( curl, CURLOPT_POSTFIELDS, data.c_str() );
-   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, recvPostData );
-   curl_easy_setopt( curl, CURLOPT_WRITEDATA, &recvData );
+   if( !response.isArray() )
+   {
+      // Servers answer a batch they can't handle with a single error
+      if( response.isObject() && response.isMember("error") && !response["error"].isNull() )
+         throw runtime_error( string("JSON-RPC Error: ") + response["error"]["message"].asString() );
 
-   auto code = curl_easy_perform( curl );
-   if( code != CURLE_OK )
-      throw runtime_error( curl_easy_strerror(code) );
+      throw runtime_error( "Invalid batch response received from JSON-RPC server" );
+   }
+
+   // Replies may come back in any order
+   std::vector<Reply> replies( calls.size() );
+   std::vector<bool> matched( calls.size(), false );
+   for( auto& reply : response )
+   {
+      _checkReply( reply );
+
+      unsigned index = reply["id"].asUInt() - firstId;
+      if( index >= calls.size() || matched[index] )
+         throw runtime_error( "Received response with wrong ID" );
+
+      matched[index] = true;
+      replies[index].result = reply["result"];
+      replies[index].error = reply["error"];
+   }
+
+   if( std::find(matched.begin(), matched.end(), false) != matched.end() )
+      throw runtime_error( "Missing response in JSON-RPC batch" );
+
+   timer.failed = false;
+   return replies;
+}
+
+JsonRpc::AsyncCall JsonRpc::callAsync( const std::string& method,
+                                       const Json::Value& params,
+                                       Callback callback,
+                                       std::chrono::milliseconds timeout )
+{
+   auto req = _makeRequest( method, params, _nextId++ );
+   auto id = req["id"].asUInt();
+
+   // Everything the transfer needs is its own, so it can outlive this object
+   curl_slist* headers = NULL;
+   for( auto header = _headers; header != NULL; header = header->next )
+   {
+      headers = curl_slist_append( headers, header->data );
+   }
+
+   auto recvData = std::make_shared<string>();
+   auto curl = _prepare( req, headers, recvPostData, recvData.get() );
+   if( timeout.count() > 0 )
+   {
+      curl_easy_setopt( curl, CURLOPT_TIMEOUT_MS, static_cast<long>(timeout.count()) );
+   }
+
+   auto promise = std::make_shared<std::promise<Json::Value>>();
+   auto result = promise->get_future();
+   auto start = chrono::steady_clock::now();
+
+   auto transfer = EventLoop::get().add( curl, [=](CURLcode code)
+   {
+      curl_slist_free_all( headers );
+
+      Reply reply;
+      try
+      {
+         if( code == CURLE_ABORTED_BY_CALLBACK )
+            throw runtime_error( "Call cancelled" );
+         if( code != CURLE_OK )
+            throw runtime_error( curl_easy_strerror(code) );
+
+         auto response = _parse( *recvData );
+         _checkReply( response );
+         if( response["error"].isNull() && response["id"].asUInt() != id )
+            throw runtime_error( "Received response with wrong ID" );
+
+         reply.result = response["result"];
+         reply.error = response["error"];
+      }
+      catch( std::exception& e )
+      {
+         reply.error["code"] = -1;
+         reply.error["message"] = e.what();
+      }
+
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      Metrics::rpcCall( method, elapsed.count(), reply.failed() );
+
+      if( callback )
+      {
+         callback( reply );
+      }
+
+      if( reply.failed() )
+      {
+         promise->set_exception( std::make_exception_ptr(
+            runtime_error(string("JSON-RPC Error: ") + reply.error["message"].asString())) );
+      }
+      else
+      {
+         promise->set_value( reply.result );
+      }
+   } );
+
+   return AsyncCall( transfer, std::move(result) );
+}
+
+Json::Value JsonRpc::_makeRequest( const std::string& method, const Json::Value& params, unsigned id )
+{
+   Json::Value req;
+   req["jsonrpc"] = "1.0";
+   req["id"]      = id;
+   req["method"]  = method;
+   req["params"]  = params;
+   return req;
+}
+
+Json::Value JsonRpc::_post( const Json::Value& req )
+{
+   string recvData;
+   _perform( req, recvPostData, &recvData );
+   return _parse( recvData );
+}
 
+Json::Value JsonRpc::_parse( const std::string& data )
+{
    Json::Reader reader;
    Json::Value response;
-   bool success = reader.parse( recvData, response );
-
-   curl_easy_cleanup( curl );
+   bool success = reader.parse( data, response );
 
    // Check the response
-   if( recvData.size() == 0 )
+   if( data.size() == 0 )
       throw runtime_error( "No data received from server" );
 
    if( !success )
       throw runtime_error( reader.getFormattedErrorMessages() );
 
-   if( !response.isObject() || !response.isMember("result") || !response.isMember("error") || !response.isMember("id") )
-      throw runtime_error( "Invalid response received from JSON-RPC server" );
+   if( Settings::debug() )
+   {
+      cout << "REPLY: " << endl << response << endl;
+   }
 
-   if( !response["error"].isNull() )
-      throw runtime_error( string("JSON-RPC Error: ") + response["error"]["message"].asString() );
+   return response;
+}
 
-   if( response["id"].asUInt() != req["id"].asUInt() )
-      throw runtime_error( "Received response with wrong ID" );
+void JsonRpc::_post( const Json::Value& req, JsonStreamParser& parser )
+{
+   StreamState state( parser );
+   try
+   {
+      _perform( req, recvStreamData, &state );
+   }
+   catch( ... )
+   {
+      // A parse error is more informative than the aborted transfer
+      if( state.error )
+         std::rethrow_exception( state.error );
+      throw;
+   }
+
+   if( state.bytes == 0 )
+      throw runtime_error( "No data received from server" );
+
+   parser.finish();
 
    if( Settings::debug() )
    {
-      cout << "REPLY: " << endl << response << endl;
+      cout << "REPLY: " << state.bytes << " bytes, streamed" << endl;
    }
+}
 
-   return response["result"];
+void JsonRpc::_perform( const Json::Value& req,
+                        size_t (*writeFn)(char*,size_t,size_t,void*),
+                        void* writeData )
+{
+   auto curl = _prepare( req, _headers, writeFn, writeData );
+   auto code = curl_easy_perform( curl );
+   curl_easy_cleanup( curl );
+   if( code != CURLE_OK )
+      throw runtime_error( curl_easy_strerror(code) );
+}
+
+// A handle ready to post the request, which it has its own copy of
+void* JsonRpc::_prepare( const Json::Value& req,
+                         curl_slist* headers,
+                         size_t (*writeFn)(char*,size_t,size_t,void*),
+                         void* writeData )
+{
+   auto curl = curl_easy_init();
+   if( curl == NULL )
+      throw std::runtime_error( "Failed to initialize cURL" );
+
+   if( Settings::debug() )
+   {
+      cout << "REQUEST: " << endl << req << endl;
+   }
+
+   Json::FastWriter writer;
+   string data = writer.write( req );
+
+   curl_easy_setopt( curl, CURLOPT_URL, _url.c_str() );
+   curl_easy_setopt( curl, CURLOPT_HTTPHEADER, headers );
+   curl_easy_setopt( curl, CURLOPT_COPYPOSTFIELDS, data.c_str() );
+   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, writeFn );
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, writeData );
+   curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1L );
+   return curl;
+}
+
+void JsonRpc::_checkReply( const Json::Value& reply )
+{
+   if( !reply.isObject() || !reply.isMember("result") || !reply.isMember("error") || !reply.isMember("id") )
+      throw runtime_error( "Invalid response received from JSON-RPC server" );
 }
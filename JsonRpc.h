@@ -4,14 +4,77 @@
 #ifndef JSONRPC_H
 #define JSONRPC_H
 
+#include "JsonStream.h"
+
 #include <json/json.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <string>
+#include <vector>
 
 struct curl_slist;
 
 class JsonRpc
 {
+public:
+   struct Call
+   {
+      Call( const std::string& method, const Json::Value& params = Json::Value() );
+
+      std::string method;
+      Json::Value params;
+   };
+
+   struct Reply
+   {
+      bool failed() const;
+
+      Json::Value result;
+      Json::Value error;   // Null if the call succeeded
+   };
+
+   /*
+    * Handle on a call made with callAsync(). Move-only.
+    */
+   class AsyncCall
+   {
+   public:
+      AsyncCall();
+
+      bool valid() const;
+      bool ready() const;
+
+      /*
+       * Wait for the reply and return its result, throwing as call() would
+       * if the call failed, timed out or was cancelled.
+       */
+      Json::Value get();
+
+      /*
+       * Abandon the call if it's still in progress.
+       */
+      void cancel();
+
+   private:
+      friend class JsonRpc;
+
+      AsyncCall( uint64_t transfer, std::future<Json::Value>&& result );
+
+   private:
+      uint64_t                   _transfer;
+      std::future<Json::Value>   _result;
+   };
+
+   /*
+    * Called on the event loop thread when an asynchronous call completes,
+    * successfully or not. It mustn't block.
+    */
+   typedef std::function<void(const Reply&)> Callback;
+
 public:
    JsonRpc( const std::string& url,
             int port,
@@ -21,9 +84,50 @@ public:
 
    Json::Value call( const std::string& method, const Json::Value& params = Json::Value() );
 
+   /*
+    * Make a call whose result is parsed as it is received, with the events
+    * for the result value delivered to the handler. This avoids holding
+    * large replies in memory, and overlaps processing them with the
+    * transfer. Errors are thrown as for the other call().
+    */
+   void call( const std::string& method,
+              const Json::Value& params,
+              JsonStreamParser::Handler& resultHandler );
+
+   /*
+    * Send several calls in a single request. Replies are matched to calls by
+    * ID and returned in call order. Errors from individual calls are returned
+    * in their replies rather than thrown, so that one failed call doesn't hide
+    * the others. There must be at least one call.
+    */
+   std::vector<Reply> batch( const std::vector<Call>& calls );
+
+   /*
+    * Start a call without waiting for it. All asynchronous calls, from every
+    * JsonRpc, are driven by one event loop thread on cURL's multi interface,
+    * so any number can be in flight at once (e.g. a longpoll, a template
+    * fetch and a block submission). A zero timeout means none. Calls don't
+    * depend on this object, which may be destroyed while they run.
+    */
+   AsyncCall callAsync( const std::string& method,
+                        const Json::Value& params = Json::Value(),
+                        Callback callback = Callback(),
+                        std::chrono::milliseconds timeout = std::chrono::milliseconds(0) );
+
+private:
+   Json::Value _makeRequest( const std::string& method, const Json::Value& params, unsigned id );
+   Json::Value _post( const Json::Value& request );
+   void _post( const Json::Value& request, JsonStreamParser& parser );
+   void _perform( const Json::Value& request, size_t (*writeFn)(char*,size_t,size_t,void*), void* writeData );
+   void* _prepare( const Json::Value& request, curl_slist* headers,
+                   size_t (*writeFn)(char*,size_t,size_t,void*), void* writeData );
+   static Json::Value _parse( const std::string& data );
+   static void _checkReply( const Json::Value& reply );
+
 private:
-   std::string _url;
-   curl_slist* _headers;
+   std::string             _url;
+   curl_slist*             _headers;
+   std::atomic<unsigned>   _nextId;
 };
 
 #endif // !JSONRPC_H
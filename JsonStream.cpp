@@ -0,0 +1,454 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "JsonStream.h"
+
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+static bool isWhitespace( char ch )
+{
+   return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+static bool isLiteralChar( char ch )
+{
+   return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+          || ch == '-' || ch == '+' || ch == '.';
+}
+
+static void appendUtf8( std::string& str, unsigned codePoint )
+{
+   if( codePoint < 0x80 )
+   {
+      str += static_cast<char>( codePoint );
+   }
+   else if( codePoint < 0x800 )
+   {
+      str += static_cast<char>( 0xc0 | (codePoint >> 6) );
+      str += static_cast<char>( 0x80 | (codePoint & 0x3f) );
+   }
+   else if( codePoint < 0x10000 )
+   {
+      str += static_cast<char>( 0xe0 | (codePoint >> 12) );
+      str += static_cast<char>( 0x80 | ((codePoint >> 6) & 0x3f) );
+      str += static_cast<char>( 0x80 | (codePoint & 0x3f) );
+   }
+   else
+   {
+      str += static_cast<char>( 0xf0 | (codePoint >> 18) );
+      str += static_cast<char>( 0x80 | ((codePoint >> 12) & 0x3f) );
+      str += static_cast<char>( 0x80 | ((codePoint >> 6) & 0x3f) );
+      str += static_cast<char>( 0x80 | (codePoint & 0x3f) );
+   }
+}
+
+JsonStreamParser::Handler::~Handler()
+{
+}
+
+JsonStreamParser::JsonStreamParser( Handler& handler )
+ : _handler(handler),
+   _state(ExpectValue),
+   _stringIsKey(false),
+   _highSurrogate(0),
+   _offset(0)
+{
+}
+
+void JsonStreamParser::feed( const char* data, size_t size )
+{
+   const char* end = data + size;
+   const char* cur = data;
+
+   while( cur < end )
+   {
+      char ch = *cur;
+
+      switch( _state )
+      {
+      case InString:
+      {
+         // Copy plain runs in bulk; hex blobs can be megabytes long
+         const char* run = cur;
+         while( cur < end && *cur != '"' && *cur != '\\' )
+         {
+            ++cur;
+         }
+         _token.append( run, cur );
+         _offset += cur - run;
+         if( cur == end )
+         {
+            continue;
+         }
+
+         if( *cur == '"' )
+         {
+            _endString();
+         }
+         else
+         {
+            _state = InStringEscape;
+         }
+         break;
+      }
+
+      case InStringEscape:
+         switch( ch )
+         {
+         case '"':  _token += '"';  break;
+         case '\\': _token += '\\'; break;
+         case '/':  _token += '/';  break;
+         case 'b':  _token += '\b'; break;
+         case 'f':  _token += '\f'; break;
+         case 'n':  _token += '\n'; break;
+         case 'r':  _token += '\r'; break;
+         case 't':  _token += '\t'; break;
+         case 'u':
+            _unicode.clear();
+            _state = InStringUnicode;
+            break;
+         default:
+            _error( "invalid escape sequence" );
+         }
+         if( _state == InStringEscape )
+         {
+            _state = InString;
+         }
+         break;
+
+      case InStringUnicode:
+         if( !std::isxdigit(static_cast<unsigned char>(ch)) )
+         {
+            _error( "invalid unicode escape" );
+         }
+         _unicode += ch;
+         if( _unicode.size() == 4 )
+         {
+            _appendUnicode();
+            _state = InString;
+         }
+         break;
+
+      case InLiteral:
+         if( isLiteralChar(ch) )
+         {
+            _token += ch;
+            break;
+         }
+         _endLiteral();
+         // The delimiter still needs to be handled
+         continue;
+
+      default:
+         if( !isWhitespace(ch) )
+         {
+            _structural( ch );
+         }
+         break;
+      }
+
+      ++cur;
+      ++_offset;
+   }
+}
+
+void JsonStreamParser::finish()
+{
+   if( _state == InLiteral )
+   {
+      _endLiteral();
+   }
+
+   if( _state != Done )
+   {
+      _error( "unexpected end of input" );
+   }
+}
+
+void JsonStreamParser::_structural( char ch )
+{
+   switch( _state )
+   {
+   case ExpectValueOrEnd:
+      if( ch == ']' )
+      {
+         _containers.pop_back();
+         _handler.endArray();
+         _endValue();
+         return;
+      }
+      _startValue( ch );
+      return;
+
+   case ExpectValue:
+      _startValue( ch );
+      return;
+
+   case ExpectKeyOrEnd:
+      if( ch == '}' )
+      {
+         _containers.pop_back();
+         _handler.endObject();
+         _endValue();
+         return;
+      }
+      // Fall through
+
+   case ExpectKey:
+      if( ch != '"' )
+      {
+         _error( "expected object key" );
+      }
+      _token.clear();
+      _stringIsKey = true;
+      _state = InString;
+      return;
+
+   case ExpectColon:
+      if( ch != ':' )
+      {
+         _error( "expected ':'" );
+      }
+      _state = ExpectValue;
+      return;
+
+   case ExpectCommaOrEnd:
+      if( ch == ',' )
+      {
+         _state = (_containers.back() == '{') ? ExpectKey : ExpectValue;
+      }
+      else if( ch == '}' && _containers.back() == '{' )
+      {
+         _containers.pop_back();
+         _handler.endObject();
+         _endValue();
+      }
+      else if( ch == ']' && _containers.back() == '[' )
+      {
+         _containers.pop_back();
+         _handler.endArray();
+         _endValue();
+      }
+      else
+      {
+         _error( "expected ',' or end of container" );
+      }
+      return;
+
+   case Done:
+      _error( "unexpected data after end of document" );
+      return;
+
+   default:
+      _error( "internal parser error" );
+   }
+}
+
+void JsonStreamParser::_startValue( char ch )
+{
+   switch( ch )
+   {
+   case '{':
+      _containers.push_back( '{' );
+      _handler.startObject();
+      _state = ExpectKeyOrEnd;
+      break;
+
+   case '[':
+      _containers.push_back( '[' );
+      _handler.startArray();
+      _state = ExpectValueOrEnd;
+      break;
+
+   case '"':
+      _token.clear();
+      _stringIsKey = false;
+      _state = InString;
+      break;
+
+   default:
+      if( !isLiteralChar(ch) )
+      {
+         _error( "unexpected character" );
+      }
+      _token.assign( 1, ch );
+      _state = InLiteral;
+      break;
+   }
+}
+
+void JsonStreamParser::_endValue()
+{
+   _state = _containers.empty() ? Done : ExpectCommaOrEnd;
+}
+
+void JsonStreamParser::_endString()
+{
+   if( _highSurrogate != 0 )
+   {
+      _error( "unpaired surrogate in string" );
+   }
+
+   if( _stringIsKey )
+   {
+      _handler.key( _token );
+      _state = ExpectColon;
+   }
+   else
+   {
+      _handler.string( _token );
+      _endValue();
+   }
+   _token.clear();
+}
+
+void JsonStreamParser::_endLiteral()
+{
+   if( _token == "true" )
+   {
+      _handler.boolean( true );
+   }
+   else if( _token == "false" )
+   {
+      _handler.boolean( false );
+   }
+   else if( _token == "null" )
+   {
+      _handler.null();
+   }
+   else if( _token.find_first_not_of("0123456789+-.eE") == std::string::npos
+            && (std::isdigit(static_cast<unsigned char>(_token[0])) || _token[0] == '-') )
+   {
+      _handler.number( _token );
+   }
+   else
+   {
+      _error( "invalid literal" );
+   }
+
+   _token.clear();
+   _endValue();
+}
+
+void JsonStreamParser::_appendUnicode()
+{
+   unsigned codeUnit = std::stoul( _unicode, nullptr, 16 );
+
+   if( codeUnit >= 0xd800 && codeUnit < 0xdc00 )
+   {
+      if( _highSurrogate != 0 )
+      {
+         _error( "unpaired surrogate in string" );
+      }
+      _highSurrogate = codeUnit;
+      return;
+   }
+
+   if( codeUnit >= 0xdc00 && codeUnit < 0xe000 )
+   {
+      if( _highSurrogate == 0 )
+      {
+         _error( "unpaired surrogate in string" );
+      }
+      codeUnit = 0x10000 + ((_highSurrogate - 0xd800) << 10) + (codeUnit - 0xdc00);
+      _highSurrogate = 0;
+   }
+   else if( _highSurrogate != 0 )
+   {
+      _error( "unpaired surrogate in string" );
+   }
+
+   appendUtf8( _token, codeUnit );
+}
+
+void JsonStreamParser::_error( const char* message )
+{
+   throw std::runtime_error( std::string("JSON parse error at offset ") + std::to_string(_offset) + ": " + message );
+}
+
+JsonValueBuilder::JsonValueBuilder( Json::Value& root )
+ : _root(root),
+   _started(false)
+{
+}
+
+Json::Value& JsonValueBuilder::_add( const Json::Value& value )
+{
+   if( !_started )
+   {
+      _started = true;
+      _root = value;
+      return _root;
+   }
+
+   if( _stack.empty() )
+   {
+      throw std::runtime_error( "JSON value after end of document" );
+   }
+
+   auto& parent = *_stack.back();
+   if( parent.isArray() )
+   {
+      return parent.append( value );
+   }
+   return parent[_key] = value;
+}
+
+void JsonValueBuilder::startObject()
+{
+   _stack.push_back( &_add(Json::Value(Json::objectValue)) );
+}
+
+void JsonValueBuilder::endObject()
+{
+   _stack.pop_back();
+}
+
+void JsonValueBuilder::startArray()
+{
+   _stack.push_back( &_add(Json::Value(Json::arrayValue)) );
+}
+
+void JsonValueBuilder::endArray()
+{
+   _stack.pop_back();
+}
+
+void JsonValueBuilder::key( std::string& name )
+{
+   _key = name;
+}
+
+void JsonValueBuilder::string( std::string& value )
+{
+   _add( Json::Value(value) );
+}
+
+void JsonValueBuilder::number( const std::string& text )
+{
+   if( text.find_first_of(".eE") != std::string::npos )
+   {
+      _add( Json::Value(std::stod(text)) );
+   }
+   else if( text[0] == '-' )
+   {
+      _add( Json::Value(static_cast<Json::Int64>(std::stoll(text))) );
+   }
+   else
+   {
+      _add( Json::Value(static_cast<Json::UInt64>(std::stoull(text))) );
+   }
+}
+
+void JsonValueBuilder::boolean( bool value )
+{
+   _add( Json::Value(value) );
+}
+
+void JsonValueBuilder::null()
+{
+   _add( Json::Value() );
+}
@@ -0,0 +1,121 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <json/json.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * Incremental (SAX-style) JSON parser. Input can be fed in arbitrary pieces,
+ * e.g. straight from a network callback, and events are delivered to a
+ * handler as soon as each token completes. Nothing but the token in progress
+ * is kept in memory.
+ */
+class JsonStreamParser
+{
+public:
+   class Handler
+   {
+   public:
+      virtual ~Handler();
+
+      virtual void startObject() = 0;
+      virtual void endObject() = 0;
+      virtual void startArray() = 0;
+      virtual void endArray() = 0;
+
+      // The string arguments may be moved from
+      virtual void key( std::string& name ) = 0;
+      virtual void string( std::string& value ) = 0;
+
+      // Numbers are passed as their original text
+      virtual void number( const std::string& text ) = 0;
+      virtual void boolean( bool value ) = 0;
+      virtual void null() = 0;
+   };
+
+public:
+   explicit JsonStreamParser( Handler& handler );
+
+   /*
+    * Parse the next piece of input. Throws std::runtime_error if the input
+    * isn't valid JSON.
+    */
+   void feed( const char* data, size_t size );
+
+   /*
+    * Signal the end of input. Throws std::runtime_error if the document is
+    * incomplete.
+    */
+   void finish();
+
+private:
+   enum State
+   {
+      ExpectValue,
+      ExpectValueOrEnd,    // After '['
+      ExpectKeyOrEnd,      // After '{'
+      ExpectKey,           // After ',' in an object
+      ExpectColon,
+      ExpectCommaOrEnd,
+      InString,
+      InStringEscape,
+      InStringUnicode,
+      InLiteral,
+      Done
+   };
+
+private:
+   void _structural( char ch );
+   void _startValue( char ch );
+   void _endValue();
+   void _endString();
+   void _endLiteral();
+   void _appendUnicode();
+   void _error( const char* message );
+
+private:
+   Handler&          _handler;
+   State             _state;
+   std::vector<char> _containers;   // '{' or '[' for each open container
+   bool              _stringIsKey;
+   std::string       _token;
+   std::string       _unicode;
+   unsigned          _highSurrogate;
+   size_t            _offset;
+};
+
+/*
+ * Handler that builds a Json::Value, for the parts of a stream that are
+ * small enough to keep whole.
+ */
+class JsonValueBuilder : public JsonStreamParser::Handler
+{
+public:
+   explicit JsonValueBuilder( Json::Value& root );
+
+   virtual void startObject();
+   virtual void endObject();
+   virtual void startArray();
+   virtual void endArray();
+   virtual void key( std::string& name );
+   virtual void string( std::string& value );
+   virtual void number( const std::string& text );
+   virtual void boolean( bool value );
+   virtual void null();
+
+private:
+   Json::Value& _add( const Json::Value& value );
+
+private:
+   Json::Value&               _root;
+   std::vector<Json::Value*>  _stack;
+   std::string                _key;
+   bool                       _started;
+};
+
+#endif // !JSON_STREAM_H
@@ -0,0 +1,365 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "MergedMining.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+// Marks the commitment in the parent coinbase's scriptSig
+static const uint8_t MERGED_MINING_MAGIC[] = { 0xfa, 0xbe, 0x6d, 0x6d };
+
+// Largest aux tree that aux chains accept, as a number of levels
+const unsigned MAX_AUX_TREE_HEIGHT = 30;
+
+// Nonces to try for a tree size before doubling it
+const uint32_t AUX_NONCE_TRIES = 1000;
+
+// Longest to wait for an aux chain's daemon before leaving it out
+const std::chrono::milliseconds AUX_RPC_TIMEOUT( 5000 );
+
+// The slot an aux chain's block must have in a tree of the given height,
+// chosen by the tree's nonce (Namecoin's getExpectedIndex)
+static uint32_t expectedSlot( uint32_t nonce, int chainId, unsigned height )
+{
+   uint32_t rand = nonce;
+   rand = rand * 1103515245 + 12345;
+   rand += chainId;
+   rand = rand * 1103515245 + 12345;
+   return rand % (1u << height);
+}
+
+static void appendLittleEndian( ByteArray& data, uint32_t n )
+{
+   for( int i = 0; i < 4; ++i )
+   {
+      data.push_back( n & 0xff );
+      n >>= CHAR_BIT;
+   }
+}
+
+MergedMining::Chain::Chain()
+ : hasBlock(false),
+   submitted(false),
+   chainId(0),
+   height(0),
+   slot(0)
+{
+}
+
+MergedMining::MergedMining( const std::vector<std::string>& chains )
+{
+   for( auto& spec : chains )
+   {
+      auto invalid = std::runtime_error( "Invalid aux chain \"" + spec + "\", expected [user:password@]host:port[/address]" );
+
+      Chain chain;
+      std::string rest = spec;
+      std::string user;
+      std::string password;
+
+      auto at = rest.rfind( '@' );
+      if( at != std::string::npos )
+      {
+         auto credentials = rest.substr( 0, at );
+         auto colon = credentials.find( ':' );
+         user = credentials.substr( 0, colon );
+         password = colon == std::string::npos ? "" : credentials.substr( colon + 1 );
+         rest = rest.substr( at + 1 );
+      }
+
+      auto slash = rest.find( '/' );
+      if( slash != std::string::npos )
+      {
+         chain.address = rest.substr( slash + 1 );
+         rest = rest.substr( 0, slash );
+      }
+
+      auto colon = rest.rfind( ':' );
+      if( colon == std::string::npos || colon == 0 || colon + 1 == rest.size() ||
+          rest.find_first_not_of("0123456789", colon + 1) != std::string::npos )
+      {
+         throw invalid;
+      }
+
+      chain.name = rest;
+      chain.rpc.reset( new JsonRpc("http://" + rest.substr(0, colon), std::stoi(rest.substr(colon + 1)), user, password) );
+      _chains.push_back( std::move(chain) );
+   }
+}
+
+MergedMining::~MergedMining()
+{
+   _waitForSubmissions();
+}
+
+bool MergedMining::enabled() const
+{
+   return !_chains.empty();
+}
+
+ByteArray MergedMining::update()
+{
+   TRACE_SCOPE( "MergedMining::update" );
+
+   // A submission may still be in flight; its chain has moved on once it's done
+   _waitForSubmissions();
+
+   // All the chains at once, so the slowest daemon sets the delay
+   std::vector<JsonRpc::AsyncCall> calls;
+   for( auto& chain : _chains )
+   {
+      Json::Value params;
+      if( !chain.address.empty() )
+      {
+         params[0u] = chain.address;
+      }
+      calls.push_back( chain.rpc->callAsync(chain.address.empty() ? "getauxblock" : "createauxblock",
+                                            params, JsonRpc::Callback(), AUX_RPC_TIMEOUT) );
+   }
+
+   for( size_t i = 0; i < _chains.size(); ++i )
+   {
+      _fetch( _chains[i], calls[i] );
+   }
+
+   return _layout();
+}
+
+ByteArray MergedMining::easiestTarget( const ByteArray& parentTarget ) const
+{
+   auto easiest = parentTarget;
+   for( auto& chain : _chains )
+   {
+      if( chain.hasBlock && chain.target > easiest )
+      {
+         easiest = chain.target;
+      }
+   }
+   return easiest;
+}
+
+void MergedMining::submit( const Block& block, const Block::Header& header )
+{
+   for( auto& chain : _chains )
+   {
+      if( !chain.hasBlock || chain.submitted || !Block::hashMeetsTarget(header, chain.target) )
+      {
+         continue;
+      }
+
+      // Its block is taken either way: a rejected proof won't be accepted later
+      chain.submitted = true;
+
+      // Submitted without waiting, since this is called from a mining thread
+      Json::Value params;
+      params[0u] = chain.blockHash;
+      params[1u] = _auxPow( block, header, chain );
+      auto name = chain.name;
+      auto height = chain.height;
+      std::lock_guard<std::mutex> lock( _submissionsMutex );
+      _submissions.push_back( chain.rpc->callAsync(chain.address.empty() ? "getauxblock" : "submitauxblock",
+                                                   params, [name, height](const JsonRpc::Reply& reply)
+      {
+         if( reply.failed() )
+         {
+            std::cout << "Aux block submission to " << name << " failed: "
+                      << reply.error["message"].asString() << std::endl;
+            return;
+         }
+
+         std::cout << "Aux block " << (reply.result.asBool() ? "accepted" : "rejected") << " by " << name
+                   << " at height " << height << std::endl;
+      }, AUX_RPC_TIMEOUT) );
+   }
+}
+
+void MergedMining::_waitForSubmissions()
+{
+   std::lock_guard<std::mutex> lock( _submissionsMutex );
+   for( auto& submission : _submissions )
+   {
+      try
+      {
+         submission.get();
+      }
+      catch( std::exception& )
+      {
+         // Already logged by its callback
+      }
+   }
+   _submissions.clear();
+}
+
+// Returns false (and leaves the chain out of the tree) if it has no block
+bool MergedMining::_fetch( Chain& chain, JsonRpc::AsyncCall& call )
+{
+   chain.hasBlock = false;
+
+   Json::Value auxBlock;
+   try
+   {
+      auxBlock = call.get();
+   }
+   catch( std::exception& e )
+   {
+      std::cout << "Aux chain " << chain.name << ": " << e.what() << std::endl;
+      return false;
+   }
+
+   // Hashes and targets are shown byte-reversed
+   auto hash = hexStringToBinary( auxBlock["hash"].asString() );
+   ByteArray target;
+   if( auxBlock.isMember("_target") )
+   {
+      target = hexStringToBinary( auxBlock["_target"].asString() );
+      std::reverse( target.begin(), target.end() );
+   }
+   else if( auxBlock.isMember("bits") )
+   {
+      target = bitsToTarget( std::stoul(auxBlock["bits"].asString(), nullptr, 16) );
+   }
+
+   if( hash.size() != sizeof(Sha256::RawDigest) || target.size() != sizeof(Sha256::RawDigest) )
+   {
+      std::cout << "Aux chain " << chain.name << ": invalid aux block" << std::endl;
+      return false;
+   }
+
+   chain.blockHash = auxBlock["hash"].asString();
+   std::copy( hash.rbegin(), hash.rend(), chain.leaf.begin() );
+   chain.chainId = auxBlock["chainid"].asInt();
+   chain.height = auxBlock["height"].asInt();
+   chain.target = target;
+   chain.hasBlock = true;
+   chain.submitted = false;
+   return true;
+}
+
+// Find a tree size and nonce that give every chain its own slot, fill in
+// their branches, and return the commitment to the tree
+ByteArray MergedMining::_layout()
+{
+   std::vector<Chain*> active;
+   std::set<int> chainIds;
+   for( auto& chain : _chains )
+   {
+      if( !chain.hasBlock )
+      {
+         continue;
+      }
+
+      // Two chains with one ID would need the same slot
+      if( !chainIds.insert(chain.chainId).second )
+      {
+         std::cout << "Aux chain " << chain.name << ": chain ID " << chain.chainId << " is already being mined" << std::endl;
+         chain.hasBlock = false;
+         continue;
+      }
+      active.push_back( &chain );
+   }
+
+   if( active.empty() )
+   {
+      return ByteArray();
+   }
+
+   for( unsigned height = 0; height <= MAX_AUX_TREE_HEIGHT; ++height )
+   {
+      uint32_t size = 1u << height;
+      if( size < active.size() )
+      {
+         continue;
+      }
+
+      for( uint32_t nonce = 0; nonce < AUX_NONCE_TRIES; ++nonce )
+      {
+         std::set<uint32_t> slots;
+         for( auto chain : active )
+         {
+            chain->slot = expectedSlot( nonce, chain->chainId, height );
+            slots.insert( chain->slot );
+         }
+         if( slots.size() != active.size() )
+         {
+            continue;
+         }
+
+         // Unused slots are left zero
+         std::vector<std::vector<Sha256::RawDigest>> levels( 1, std::vector<Sha256::RawDigest>(size) );
+         for( auto chain : active )
+         {
+            levels[0][chain->slot] = chain->leaf;
+         }
+
+         while( levels.back().size() > 1 )
+         {
+            auto& level = levels.back();
+            std::vector<Sha256::RawDigest> next( level.size() / 2 );
+            Sha256::RawDigest pair[2];
+            for( size_t i = 0; i < next.size(); ++i )
+            {
+               pair[0] = level[2 * i];
+               pair[1] = level[2 * i + 1];
+               Sha256::doubleHash( pair, sizeof(pair), next[i] );
+            }
+            levels.push_back( std::move(next) );
+         }
+
+         for( auto chain : active )
+         {
+            chain->branch.clear();
+            auto index = chain->slot;
+            for( size_t level = 0; level + 1 < levels.size(); ++level )
+            {
+               chain->branch.push_back( levels[level][index ^ 1] );
+               index >>= 1;
+            }
+         }
+
+         // The root is committed byte-reversed
+         auto& root = levels.back()[0];
+         ByteArray commitment( MERGED_MINING_MAGIC, MERGED_MINING_MAGIC + sizeof(MERGED_MINING_MAGIC) );
+         commitment.insert( commitment.end(), root.rbegin(), root.rend() );
+         appendLittleEndian( commitment, size );
+         appendLittleEndian( commitment, nonce );
+         return commitment;
+      }
+   }
+
+   throw std::runtime_error( "No aux merkle tree fits the aux chains' IDs" );
+}
+
+// The proof of work for an aux block, hex encoded: the parent coinbase and
+// its branch, the aux block's branch in the aux tree, and the parent header
+std::string MergedMining::_auxPow( const Block& block, const Block::Header& header, const Chain& chain ) const
+{
+   std::ostringstream stream;
+   block.coinbase().serialize( stream, false );
+
+   // The parent block's hash, which aux chains don't check
+   Sha256::RawDigest parentHash;
+   Sha256::doubleHash( &header, sizeof(header), parentHash );
+   writeHex( stream, parentHash.data(), parentHash.size() );
+
+   auto writeBranch = [&stream](const std::vector<Sha256::RawDigest>& branch, int32_t index)
+   {
+      writeVarInt( stream, branch.size() );
+      for( auto& hash : branch )
+      {
+         writeHex( stream, hash.data(), hash.size() );
+      }
+      writeInt<int32_t>( stream, index );
+   };
+   writeBranch( block.merkleBranch(), 0 );
+   writeBranch( chain.branch, chain.slot );
+
+   writeHex( stream, reinterpret_cast<const uint8_t*>(&header), sizeof(header) );
+   return stream.str();
+}
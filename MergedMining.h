@@ -0,0 +1,97 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef MERGED_MINING_H
+#define MERGED_MINING_H
+
+#include "Block.h"
+#include "JsonRpc.h"
+#include "Sha256.h"
+#include "Util.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Merged mining (AuxPoW, as in Namecoin): the parent block's coinbase
+ * commits to a merkle tree of blocks from auxiliary chains, so any parent
+ * header whose hash meets an aux chain's (usually easier) target is also a
+ * valid proof of work for that chain's block.
+ *
+ * The commitment is the magic bytes fabe6d6d, the aux tree's root, the
+ * tree's size and a nonce that, with each chain's ID, picks the chain's slot
+ * in the tree. The proof submitted to an aux chain is the parent coinbase,
+ * its merkle branch, the aux block's branch in the aux tree, and the parent
+ * header.
+ */
+class MergedMining
+{
+public:
+   /*
+    * Each aux chain's daemon is given as [user:password@]host:port[/address].
+    * With an address, aux blocks come from createauxblock and pay to it;
+    * without one, getauxblock pays to the daemon's own wallet.
+    */
+   MergedMining( const std::vector<std::string>& chains );
+   ~MergedMining();
+
+   bool enabled() const;
+
+   /*
+    * Fetch every chain's current aux block, from all of them at once, and
+    * return the commitment to them for the parent coinbase's scriptSig:
+    * empty if no chain has one.
+    */
+   ByteArray update();
+
+   /*
+    * The easiest of the given target and the aux blocks' (all big-endian),
+    * for finding solutions for every chain in one search.
+    */
+   ByteArray easiestTarget( const ByteArray& parentTarget ) const;
+
+   /*
+    * Submit the header, with its proof, to every aux chain whose target its
+    * hash meets and that doesn't have a block from this update() yet. The
+    * block supplies the coinbase and its merkle branch. Doesn't wait for
+    * the replies, which are logged as they arrive.
+    */
+   void submit( const Block& block, const Block::Header& header );
+
+private:
+   struct Chain
+   {
+      Chain();
+
+      std::string                      name;       // host:port, for the log
+      std::unique_ptr<JsonRpc>         rpc;
+      std::string                      address;
+
+      // The current aux block
+      bool                             hasBlock;
+      bool                             submitted;
+      std::string                      blockHash;  // As the daemon shows it
+      Sha256::RawDigest                leaf;
+      int                              chainId;
+      int                              height;
+      ByteArray                        target;
+      uint32_t                         slot;
+      std::vector<Sha256::RawDigest>   branch;
+   };
+
+   bool _fetch( Chain& chain, JsonRpc::AsyncCall& call );
+   void _waitForSubmissions();
+   ByteArray _layout();
+   std::string _auxPow( const Block& block, const Block::Header& header, const Chain& chain ) const;
+
+private:
+   std::vector<Chain>                  _chains;
+
+   std::mutex                          _submissionsMutex;
+   std::vector<JsonRpc::AsyncCall>     _submissions;
+};
+
+#endif // !MERGED_MINING_H
@@ -3,10 +3,22 @@
 **/
 
 #include "MerkleTree.h"
+#include "TaskPool.h"
+#include "Trace.h"
 
+#include <algorithm>
 #include <cassert>
 
-bool MerkleTree::Node::append( NodePtr node, int depth )
+// Levels with fewer pairs than this are hashed on the calling thread
+const size_t PARALLEL_MIN_PAIRS = 1024;
+const size_t PAIRS_PER_TASK = 256;
+
+MerkleTree::Node::Node()
+ : hashValid(false)
+{
+}
+
+bool MerkleTree::Node::append( NodePtr node, int depth, Arena* arena )
 {
    assert( depth >= 1 );
 
@@ -29,12 +41,12 @@ bool MerkleTree::Node::append( NodePtr node, int depth )
    {
       if( leftChild != nullptr )
       {
-         appended = leftChild->append( node, depth - 1 );
+         appended = leftChild->append( node, depth - 1, arena );
       }
       else
       {
-         leftChild = std::make_shared<Node>();
-         appended = leftChild->append( node, depth - 1 );
+         leftChild = _makeNode( arena );
+         appended = leftChild->append( node, depth - 1, arena );
          assert( appended );
       }
 
@@ -42,12 +54,12 @@ bool MerkleTree::Node::append( NodePtr node, int depth )
       {
          if( rightChild != nullptr )
          {
-            appended = rightChild->append( node, depth - 1 );
+            appended = rightChild->append( node, depth - 1, arena );
          }
          else
          {
-            rightChild = std::make_shared<Node>();
-            appended = rightChild->append( node, depth - 1 );
+            rightChild = _makeNode( arena );
+            appended = rightChild->append( node, depth - 1, arena );
             assert( appended );
          }
       }
@@ -55,7 +67,7 @@ bool MerkleTree::Node::append( NodePtr node, int depth )
 
    if( appended )
    {
-      hash.clear();
+      hashValid = false;
    }
 
    return appended;
@@ -70,13 +82,13 @@ void MerkleTree::Node::update()
 {
    // Hashes get invalidated in append(), so if the hash exists (or we're on a
    // leaf), there's no need to update
-   if( !hash.empty() || isLeaf() )
+   if( hashValid || isLeaf() )
    {
       return;
    }
 
    // Recurse into the children if necessary
-   if( leftChild->hash.empty() )
+   if( !leftChild->hashValid )
    {
       leftChild->update();
    }
@@ -85,25 +97,35 @@ void MerkleTree::Node::update()
    if( rightChild != nullptr )
    {
       otherChild = rightChild;
-      if( rightChild->hash.empty() )
+      if( !rightChild->hashValid )
       {
          rightChild->update();
       }
    }
 
    // Concatenate the child data and hash
-   auto data = leftChild->hash;
-   data.insert( data.end(), otherChild->hash.begin(), otherChild->hash.end() );
+   uint8_t data[sizeof(hash) * 2];
+   std::copy( leftChild->hash.begin(), leftChild->hash.end(), data );
+   std::copy( otherChild->hash.begin(), otherChild->hash.end(), data + sizeof(hash) );
 
-   hash = Sha256::doubleHash( data );
+   Sha256::doubleHash( data, sizeof(data), hash );
+   hashValid = true;
 }
 
-MerkleTree::MerkleTree()
- : _depth(1),
-   _rootNode(std::make_shared<Node>())
+MerkleTree::MerkleTree( Arena* arena )
+ : _arena(arena),
+   _depth(1),
+   _rootNode(_makeNode(arena)),
+   _leafNodes(ArenaAllocator<NodePtr>(arena))
 {
 }
 
+MerkleTree::NodePtr MerkleTree::_makeNode( Arena* arena )
+{
+   // The control block is allocated along with the node
+   return std::allocate_shared<Node>( ArenaAllocator<Node>(arena) );
+}
+
 void MerkleTree::append( const ByteArray& hash )
 {
    int oldSize = _leafNodes.size();
@@ -112,17 +134,21 @@ void MerkleTree::append( const ByteArray& hash )
       _reshape();
    }
 
-   auto newNode = std::make_shared<Node>();
-   newNode->hash = hash;
+   assert( hash.size() == sizeof(Sha256::RawDigest) );
+   auto newNode = _makeNode( _arena );
+   std::copy( hash.begin(), hash.end(), newNode->hash.begin() );
+   newNode->hashValid = true;
 
    _leafNodes.push_back( newNode );
 
-   bool appended = _rootNode->append( newNode, _depth );
+   bool appended = _rootNode->append( newNode, _depth, _arena );
    assert( appended );
 }
 
 ByteArray MerkleTree::rootHash()
 {
+   TRACE_SCOPE( "MerkleTree::rootHash" );
+
    if( _rootNode->isLeaf() )
    {
       return ByteArray();
@@ -130,17 +156,95 @@ ByteArray MerkleTree::rootHash()
 
    if( _rootNode->leftChild != nullptr && _rootNode->rightChild == nullptr )
    {
-      return _rootNode->leftChild->hash;
+      auto& hash = _rootNode->leftChild->hash;
+      return ByteArray( hash.begin(), hash.end() );
    }
 
    _rootNode->update();
-   return _rootNode->hash;
+   return ByteArray( _rootNode->hash.begin(), _rootNode->hash.end() );
+}
+
+Sha256::RawDigest MerkleTree::computeRoot( std::vector<Sha256::RawDigest> leaves )
+{
+   TRACE_SCOPE( "MerkleTree::computeRoot" );
+
+   std::vector<Sha256::RawDigest> next;
+   while( leaves.size() > 1 )
+   {
+      _hashLevel( leaves, next, 0 );
+      leaves.swap( next );
+   }
+
+   return leaves.empty() ? Sha256::RawDigest() : leaves[0];
+}
+
+std::vector<Sha256::RawDigest> MerkleTree::computeBranch( std::vector<Sha256::RawDigest> leaves )
+{
+   TRACE_SCOPE( "MerkleTree::computeBranch" );
+
+   std::vector<Sha256::RawDigest> branch;
+   std::vector<Sha256::RawDigest> next;
+   while( leaves.size() > 1 )
+   {
+      branch.push_back( leaves[1] );
+
+      // The first pair's hash depends on the first leaf, so is never needed
+      _hashLevel( leaves, next, 1 );
+      leaves.swap( next );
+   }
+
+   return branch;
+}
+
+Sha256::RawDigest MerkleTree::rootFromBranch( const Sha256::RawDigest& firstLeaf,
+                                              const std::vector<Sha256::RawDigest>& branch )
+{
+   Sha256::RawDigest pair[2];
+   pair[0] = firstLeaf;
+   for( auto& sibling : branch )
+   {
+      pair[1] = sibling;
+      Sha256::doubleHash( pair, sizeof(pair), pair[0] );
+   }
+   return pair[0];
+}
+
+// Hash pairs of a level into the next, from the given pair on. Into a separate
+// buffer, so pieces of a level can be hashed at the same time.
+void MerkleTree::_hashLevel( const std::vector<Sha256::RawDigest>& level, std::vector<Sha256::RawDigest>& next,
+                             size_t firstPair )
+{
+   size_t count = level.size();
+   size_t pairs = (count + 1) / 2;
+   next.resize( pairs );
+
+   auto hashPairs = [&](size_t begin, size_t end)
+   {
+      Sha256::RawDigest pair[2];
+      for( size_t i = firstPair + begin; i < firstPair + end; ++i )
+      {
+         // An odd node out is paired with itself
+         pair[0] = level[2 * i];
+         pair[1] = level[std::min( 2 * i + 1, count - 1 )];
+         Sha256::doubleHash( pair, sizeof(pair), next[i] );
+      }
+   };
+
+   size_t todo = pairs - std::min( firstPair, pairs );
+   if( todo >= PARALLEL_MIN_PAIRS )
+   {
+      TaskPool::parallelFor( todo, PAIRS_PER_TASK, hashPairs );
+   }
+   else
+   {
+      hashPairs( 0, todo );
+   }
 }
 
 void MerkleTree::_reshape()
 {
    auto oldRoot = _rootNode;
-   _rootNode = std::make_shared<Node>();
+   _rootNode = _makeNode( _arena );
    _rootNode->leftChild = oldRoot;
    ++_depth;
 }
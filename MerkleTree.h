@@ -6,6 +6,7 @@
 
 #include "Util.h"
 #include "Sha256.h"
+#include "Arena.h"
 
 #include <memory>
 
@@ -16,30 +17,58 @@ private:
    typedef std::shared_ptr<Node> NodePtr;
    struct Node
    {
-      bool append( NodePtr node, int depth );
+      Node();
+
+      bool append( NodePtr node, int depth, Arena* arena );
       bool isLeaf() const;
       void update();
 
-      ByteArray   hash;
-      NodePtr     leftChild;
-      NodePtr     rightChild;
+      Sha256::RawDigest hash;
+      bool              hashValid;
+      NodePtr           leftChild;
+      NodePtr           rightChild;
    };
 
 
 public:
-   MerkleTree();
+   /*
+    * Nodes are allocated from the arena, if one is given.
+    */
+   MerkleTree( Arena* arena = nullptr );
 
    void append( const ByteArray& hash );
    void update( int index, const ByteArray& newHash );
    ByteArray rootHash();
 
+   /*
+    * Compute the root of a whole tree at once, level by level. Much cheaper
+    * than building a tree, when no incremental updates are needed. Wide
+    * levels are hashed on the task pool.
+    */
+   static Sha256::RawDigest computeRoot( std::vector<Sha256::RawDigest> leaves );
+
+   /*
+    * The sibling hashes on the path from the first leaf to the root, which
+    * don't depend on the first leaf (its value is ignored). With these, the
+    * root for any first leaf, i.e. any coinbase, takes a hash per level.
+    */
+   static std::vector<Sha256::RawDigest> computeBranch( std::vector<Sha256::RawDigest> leaves );
+   static Sha256::RawDigest rootFromBranch( const Sha256::RawDigest& firstLeaf,
+                                            const std::vector<Sha256::RawDigest>& branch );
+
 private:
    void _reshape();
 
+   static void _hashLevel( const std::vector<Sha256::RawDigest>& level, std::vector<Sha256::RawDigest>& next,
+                           size_t firstPair );
+
+   static NodePtr _makeNode( Arena* arena );
+
 private:
-   int                  _depth;
-   NodePtr              _rootNode;
-   std::vector<NodePtr> _leafNodes;
+   Arena*                                          _arena;
+   int                                             _depth;
+   NodePtr                                         _rootNode;
+   std::vector<NodePtr, ArenaAllocator<NodePtr>>   _leafNodes;
 };
 
 #endif // !MERKLE_TREE_H
@@ -0,0 +1,225 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "Metrics.h"
+#include "HttpServer.h"
+#include "Util.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <type_traits>
+#include <new>
+#include <vector>
+
+// Upper bounds of the RPC latency histogram buckets, in seconds
+static const double RPC_LATENCY_BUCKETS[] = {
+   0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30
+};
+
+struct RpcStats
+{
+   RpcStats()
+    : buckets(ARRAY_SIZE(RPC_LATENCY_BUCKETS), 0),
+      count(0),
+      failures(0),
+      sum(0)
+   {
+   }
+
+   std::vector<uint64_t>   buckets;
+   uint64_t                count;
+   uint64_t                failures;
+   double                  sum;
+};
+
+struct MetricsData
+{
+   Metrics::HashCounter                threadHashes[Metrics::MAX_THREADS];
+   std::atomic<int>                    threadCount;     // Counters in use, past and present
+   std::atomic<int>                    activeThreads;
+
+   std::atomic<uint64_t>               templates;
+   std::atomic<uint64_t>               accepted;
+   std::atomic<uint64_t>               rejected;
+   std::atomic<uint64_t>               shares;
+   std::atomic<uint64_t>               invalidShares;
+
+   std::mutex                          mutex;
+   std::string                         minerType;
+   std::map<std::string,RpcStats>      rpc;
+   double                              shareWork;
+   std::unique_ptr<HttpServer>         server;
+};
+
+static MetricsData& data()
+{
+   // Never destroyed, like the miner registry. Placement new keeps the hash
+   // counters cache-line aligned.
+   static std::aligned_storage<sizeof(MetricsData), alignof(MetricsData)>::type storage;
+   static MetricsData* metrics = new (&storage) MetricsData();
+   return *metrics;
+}
+
+Metrics::HashCounter* Metrics::threadHashCounter( int thread )
+{
+   if( thread < 0 || thread >= MAX_THREADS )
+   {
+      return nullptr;
+   }
+
+   auto& metrics = data();
+   int count = metrics.threadCount;
+   while( count <= thread && !metrics.threadCount.compare_exchange_weak(count, thread + 1) );
+
+   return &metrics.threadHashes[thread];
+}
+
+void Metrics::setMinerType( const std::string& minerType )
+{
+   std::lock_guard<std::mutex> lock( data().mutex );
+   data().minerType = minerType;
+}
+
+void Metrics::setThreadCount( int threads )
+{
+   data().activeThreads = threads;
+}
+
+void Metrics::templateCreated()
+{
+   ++data().templates;
+}
+
+void Metrics::solutionAccepted()
+{
+   ++data().accepted;
+}
+
+void Metrics::solutionRejected()
+{
+   ++data().rejected;
+}
+
+void Metrics::shareFound( double expectedHashes, bool valid )
+{
+   if( !valid )
+   {
+      ++data().invalidShares;
+      return;
+   }
+
+   ++data().shares;
+   std::lock_guard<std::mutex> lock( data().mutex );
+   data().shareWork += expectedHashes;
+}
+
+void Metrics::rpcCall( const std::string& method, double seconds, bool failed )
+{
+   std::lock_guard<std::mutex> lock( data().mutex );
+   auto& stats = data().rpc[method];
+
+   for( int i = 0; i < ARRAY_SIZE(RPC_LATENCY_BUCKETS); ++i )
+   {
+      if( seconds <= RPC_LATENCY_BUCKETS[i] )
+      {
+         ++stats.buckets[i];
+      }
+   }
+   ++stats.count;
+   stats.sum += seconds;
+   if( failed )
+   {
+      ++stats.failures;
+   }
+}
+
+std::string Metrics::exposition()
+{
+   auto& metrics = data();
+   std::ostringstream out;
+
+   out << "# HELP jrmrmine_hashes_total Nonces tried by each mining thread.\n"
+       << "# TYPE jrmrmine_hashes_total counter\n";
+   for( int i = 0; i < metrics.threadCount; ++i )
+   {
+      out << "jrmrmine_hashes_total{thread=\"" << i << "\"} "
+          << metrics.threadHashes[i].hashes.load( std::memory_order_relaxed ) << "\n";
+   }
+
+   out << "# HELP jrmrmine_threads Number of mining threads.\n"
+       << "# TYPE jrmrmine_threads gauge\n"
+       << "jrmrmine_threads " << metrics.activeThreads << "\n";
+
+   out << "# HELP jrmrmine_templates_total Block templates built.\n"
+       << "# TYPE jrmrmine_templates_total counter\n"
+       << "jrmrmine_templates_total " << metrics.templates << "\n";
+
+   out << "# HELP jrmrmine_solutions_total Solutions submitted, by outcome.\n"
+       << "# TYPE jrmrmine_solutions_total counter\n"
+       << "jrmrmine_solutions_total{result=\"accepted\"} " << metrics.accepted << "\n"
+       << "jrmrmine_solutions_total{result=\"rejected\"} " << metrics.rejected << "\n";
+
+   out << "# HELP jrmrmine_shares_total Pseudo-shares found, by whether their hash checked out.\n"
+       << "# TYPE jrmrmine_shares_total counter\n"
+       << "jrmrmine_shares_total{result=\"valid\"} " << metrics.shares << "\n"
+       << "jrmrmine_shares_total{result=\"invalid\"} " << metrics.invalidShares << "\n";
+
+   std::lock_guard<std::mutex> lock( metrics.mutex );
+
+   out << "# HELP jrmrmine_info Miner configuration.\n"
+       << "# TYPE jrmrmine_info gauge\n"
+       << "jrmrmine_info{kernel=\"" << metrics.minerType << "\"} 1\n";
+
+   out << "# HELP jrmrmine_share_work_hashes_total Expected hashes to find the pseudo-shares found; its rate is the effective hash rate.\n"
+       << "# TYPE jrmrmine_share_work_hashes_total counter\n"
+       << "jrmrmine_share_work_hashes_total " << metrics.shareWork << "\n";
+
+   out << "# HELP jrmrmine_rpc_duration_seconds JSON-RPC call latency.\n"
+       << "# TYPE jrmrmine_rpc_duration_seconds histogram\n";
+   for( auto& entry : metrics.rpc )
+   {
+      auto& method = entry.first;
+      auto& stats = entry.second;
+      for( int i = 0; i < ARRAY_SIZE(RPC_LATENCY_BUCKETS); ++i )
+      {
+         out << "jrmrmine_rpc_duration_seconds_bucket{method=\"" << method << "\",le=\""
+             << RPC_LATENCY_BUCKETS[i] << "\"} " << stats.buckets[i] << "\n";
+      }
+      out << "jrmrmine_rpc_duration_seconds_bucket{method=\"" << method << "\",le=\"+Inf\"} " << stats.count << "\n"
+          << "jrmrmine_rpc_duration_seconds_sum{method=\"" << method << "\"} " << stats.sum << "\n"
+          << "jrmrmine_rpc_duration_seconds_count{method=\"" << method << "\"} " << stats.count << "\n";
+   }
+
+   out << "# HELP jrmrmine_rpc_failures_total JSON-RPC calls that failed.\n"
+       << "# TYPE jrmrmine_rpc_failures_total counter\n";
+   for( auto& entry : metrics.rpc )
+   {
+      out << "jrmrmine_rpc_failures_total{method=\"" << entry.first << "\"} " << entry.second.failures << "\n";
+   }
+
+   return out.str();
+}
+
+void Metrics::serve( const std::string& address, int port )
+{
+   auto handler = []( const HttpServer::Request& request )
+   {
+      HttpServer::Response response;
+      if( request.path != "/metrics" )
+      {
+         response.status = 404;
+         response.body = "Not found\n";
+         return response;
+      }
+
+      response.contentType = "text/plain; version=0.0.4";
+      response.body = exposition();
+      return response;
+   };
+
+   std::lock_guard<std::mutex> lock( data().mutex );
+   data().server.reset( new HttpServer(address, port, handler) );
+}
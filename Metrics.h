@@ -0,0 +1,74 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Size of the blocks that caches deal in
+#define CACHE_LINE_SIZE 64
+
+/*
+ * Process-wide runtime counters, exposed over HTTP in the Prometheus text
+ * exposition format.
+ *
+ * Hash counters are written by the mining threads, so each thread gets its own
+ * cache line and only touches it once per nonce chunk. Everything else is
+ * updated off the hashing path.
+ */
+class Metrics
+{
+public:
+   struct alignas(CACHE_LINE_SIZE) HashCounter
+   {
+      std::atomic<uint64_t> hashes;
+   };
+
+   // Mining threads beyond this aren't counted individually
+   static const int MAX_THREADS = 1024;
+
+public:
+   /*
+    * The counter for the given mining thread, or nullptr if out of range.
+    */
+   static HashCounter* threadHashCounter( int thread );
+
+   static void setMinerType( const std::string& minerType );
+
+   /*
+    * The number of mining threads now running. Counters of threads that
+    * have since gone are still exposed.
+    */
+   static void setThreadCount( int threads );
+
+   static void templateCreated();
+   static void solutionAccepted();
+   static void solutionRejected();
+
+   /*
+    * Record a pseudo-share, standing for the given expected number of
+    * hashes, or one whose hash didn't meet the target it was found against.
+    */
+   static void shareFound( double expectedHashes, bool valid );
+
+   /*
+    * Record a completed (or failed) JSON-RPC call.
+    */
+   static void rpcCall( const std::string& method, double seconds, bool failed );
+
+   /*
+    * Render all metrics in the Prometheus text format.
+    */
+   static std::string exposition();
+
+   /*
+    * Start serving /metrics on the given address and port, for the lifetime
+    * of the process.
+    */
+   static void serve( const std::string& address, int port );
+};
+
+#endif // !METRICS_H
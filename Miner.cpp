@@ -4,8 +4,13 @@
 
 #include "Miner.h"
 
+#include <cassert>
 #include <cstddef>
 #include <algorithm>
+#include <limits>
+
+// Number of nonces handed to the kernel between checks of the abort flag
+const uint32_t NONCE_CHUNK_SIZE = 1 << 16;
 
 struct  MinerRegistry
 {
@@ -18,6 +23,12 @@ struct  MinerRegistry
    std::map<std::string, Miner::CreateInstanceFn> types;
 };
 
+Miner::Miner()
+ : _hashCount(0),
+   _liveCounter(nullptr)
+{
+}
+
 Miner::~Miner()
 {
 }
@@ -55,14 +66,77 @@ std::vector<std::string> Miner::types()
 
 Miner::Result Miner::mine( Block& block )
 {
+   std::atomic<bool> abort( false );
+   return mine( block.header, 0, std::numeric_limits<uint32_t>::max(), abort );
+}
+
+Miner::Result Miner::mine( Block::Header& header,
+                           uint32_t firstNonce,
+                           uint32_t lastNonce,
+                           const std::atomic<bool>& abort )
+{
+   return mine( header, bitsToTarget(header.bits), firstNonce, lastNonce, abort );
+}
+
+Miner::Result Miner::mine( Block::Header& header,
+                           const ByteArray& target,
+                           uint32_t firstNonce,
+                           uint32_t lastNonce,
+                           const std::atomic<bool>& abort )
+{
+   assert( firstNonce <= lastNonce );
+   assert( target.size() == sizeof(Sha256::Digest) );
+
    // Precompute as much hash as possible
    Sha256 hash;
-   hash.update( &block.header, offsetof(Block::Header, nonce) * CHAR_BIT );
+   hash.update( &header, offsetof(Block::Header, nonce) * CHAR_BIT );
 
-   auto target = bitsToTarget( block.header.bits );
-   std::reverse( target.begin(), target.end() );
+   ByteArray reverseTarget( target.rbegin(), target.rend() );
 
-   auto result = _mine( hash, target, block.header.nonce );
+   uint32_t chunkStart = firstNonce;
+   while( !abort.load(std::memory_order_relaxed) )
+   {
+      uint32_t chunkEnd = lastNonce;
+      if( lastNonce - chunkStart >= NONCE_CHUNK_SIZE )
+      {
+         chunkEnd = chunkStart + NONCE_CHUNK_SIZE - 1;
+      }
+
+      uint32_t nonce = chunkStart;
+      auto result = _mine( hash, reverseTarget, nonce, chunkEnd );
+      auto hashes = static_cast<uint64_t>(nonce - chunkStart) + 1;
+      _hashCount += hashes;
+      if( _liveCounter != nullptr )
+      {
+         _liveCounter->fetch_add( hashes, std::memory_order_relaxed );
+      }
+
+      if( result == SolutionFound )
+      {
+         header.nonce = nonce;
+         return SolutionFound;
+      }
+
+      if( chunkEnd == lastNonce )
+      {
+         break;
+      }
+      chunkStart = chunkEnd + 1;
+   }
 
-   return result;
+   return NoSolutionFound;
+}
+
+uint64_t Miner::hashCount() const
+{
+   return _hashCount;
+}
+
+void Miner::setLiveCounter( std::atomic<uint64_t>* counter )
+{
+   _liveCounter = counter;
+   if( _liveCounter != nullptr )
+   {
+      _liveCounter->fetch_add( _hashCount, std::memory_order_relaxed );
+   }
 }
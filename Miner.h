@@ -10,6 +10,7 @@
 #include <map>
 #include <memory>
 #include <vector>
+#include <atomic>
 #include <type_traits>
 
 class Miner;
@@ -27,12 +28,60 @@ public:
    };
 
 public:
+   Miner();
    virtual ~Miner() = 0;
 
+   /*
+    * Search the entire nonce space of the block header.
+    */
    Result mine( Block& block );
 
+   /*
+    * Search the nonces in [firstNonce, lastNonce] of the given header. The
+    * range is processed in chunks, and the abort flag is checked between
+    * chunks. If a solution is found, it is left in header.nonce.
+    */
+   Result mine( Block::Header& header,
+                uint32_t firstNonce,
+                uint32_t lastNonce,
+                const std::atomic<bool>& abort );
+
+   /*
+    * As above, but against an explicit 32-byte big-endian target instead of
+    * the one encoded in header.bits. A hash equal to the target counts as a
+    * solution.
+    */
+   Result mine( Block::Header& header,
+                const ByteArray& target,
+                uint32_t firstNonce,
+                uint32_t lastNonce,
+                const std::atomic<bool>& abort );
+
+   /*
+    * Number of nonces this instance has tried so far.
+    */
+   uint64_t hashCount() const;
+
+   /*
+    * Also add the nonces tried to an external counter, once per chunk, so
+    * that it carries on counting across instances (a thread's next kernel).
+    */
+   void setLiveCounter( std::atomic<uint64_t>* counter );
+
 protected:
-   virtual Result _mine( const Sha256& preHash, const ByteArray& reverseTarget, uint32_t& nonce ) = 0;
+   /*
+    * Kernel entry point. Starting at the given nonce, try every nonce up to
+    * and including lastNonce. On return, nonce holds the solution, or
+    * lastNonce if none was found.
+    */
+   virtual Result _mine( const Sha256& preHash,
+                         const ByteArray& reverseTarget,
+                         uint32_t& nonce,
+                         uint32_t lastNonce ) = 0;
+
+private:
+   uint64_t                _hashCount;
+   std::atomic<uint64_t>*  _liveCounter;
 
 public:
    static MinerPtr createInstance( const std::string& typeName = std::string() );
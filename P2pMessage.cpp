@@ -0,0 +1,312 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "P2pMessage.h"
+
+#include <sys/socket.h>
+
+#include <cstring>
+#include <stdexcept>
+
+// Size of the framing in front of each payload
+const size_t HEADER_SIZE = 24;
+const size_t COMMAND_SIZE = 12;
+
+// Largest payload accepted, as Bitcoin Core's MAX_SIZE
+const uint32_t MAX_PAYLOAD_SIZE = 0x02000000;
+
+static bool recvAll( int socket, uint8_t* data, size_t size )
+{
+   size_t received = 0;
+   while( received < size )
+   {
+      auto bytes = ::recv( socket, data + received, size - received, 0 );
+      if( bytes <= 0 )
+      {
+         return false;
+      }
+      received += bytes;
+   }
+   return true;
+}
+
+static bool sendAll( int socket, const uint8_t* data, size_t size )
+{
+   size_t sent = 0;
+   while( sent < size )
+   {
+      auto bytes = ::send( socket, data + sent, size - sent, MSG_NOSIGNAL );
+      if( bytes <= 0 )
+      {
+         return false;
+      }
+      sent += bytes;
+   }
+   return true;
+}
+
+static uint32_t checksum( const ByteArray& payload )
+{
+   Sha256::RawDigest hash;
+   Sha256::doubleHash( payload.data(), payload.size(), hash );
+   return hash[0] | hash[1] << 8 | hash[2] << 16 | static_cast<uint32_t>( hash[3] ) << 24;
+}
+
+static inline uint64_t rotateLeft( uint64_t x, int bits )
+{
+   return (x << bits) | (x >> (64 - bits));
+}
+
+static inline void sipRound( uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3 )
+{
+   v0 += v1; v1 = rotateLeft( v1, 13 ); v1 ^= v0; v0 = rotateLeft( v0, 32 );
+   v2 += v3; v3 = rotateLeft( v3, 16 ); v3 ^= v2;
+   v0 += v3; v3 = rotateLeft( v3, 21 ); v3 ^= v0;
+   v2 += v1; v1 = rotateLeft( v1, 17 ); v1 ^= v2; v2 = rotateLeft( v2, 32 );
+}
+
+P2pMessage::Reader::Reader( const ByteArray& payload )
+ : _payload(payload),
+   _pos(0),
+   _valid(true)
+{
+}
+
+const uint8_t* P2pMessage::Reader::bytes( size_t count )
+{
+   static const uint8_t zeros[sizeof(Sha256::RawDigest)] = {};
+   if( !_valid || count > _payload.size() - _pos )
+   {
+      _valid = false;
+      _pos = _payload.size();
+      return zeros;
+   }
+
+   auto data = _payload.data() + _pos;
+   _pos += count;
+   return data;
+}
+
+uint64_t P2pMessage::Reader::integer( size_t size )
+{
+   auto data = bytes( size );
+   uint64_t n = 0;
+   for( size_t i = 0; i < size; ++i )
+   {
+      n |= static_cast<uint64_t>( data[i] ) << (i * 8);
+   }
+   return n;
+}
+
+uint64_t P2pMessage::Reader::varInt()
+{
+   auto prefix = integer( 1 );
+   switch( prefix )
+   {
+   case 0xff: return integer( 8 );
+   case 0xfe: return integer( 4 );
+   case 0xfd: return integer( 2 );
+   default:   return prefix;
+   }
+}
+
+Sha256::RawDigest P2pMessage::Reader::digest()
+{
+   Sha256::RawDigest digest;
+   auto data = bytes( digest.size() );
+   std::copy( data, data + digest.size(), digest.begin() );
+   return digest;
+}
+
+const uint8_t* P2pMessage::Reader::transaction( size_t& size )
+{
+   Sha256::RawDigest txid;
+   Sha256::RawDigest wtxid;
+   ByteArray scratch;
+   size = _valid ? TransactionList::hashRaw( _payload.data() + _pos, _payload.size() - _pos, txid, wtxid, scratch ) : 0;
+   if( size == 0 )
+   {
+      _valid = false;
+      _pos = _payload.size();
+      return nullptr;
+   }
+   return bytes( size );
+}
+
+bool P2pMessage::Reader::valid() const
+{
+   return _valid;
+}
+
+bool P2pMessage::Reader::atEnd() const
+{
+   return _pos == _payload.size();
+}
+
+P2pMessage::P2pMessage()
+{
+}
+
+P2pMessage::P2pMessage( const std::string& command, ByteArray&& payload )
+ : command(command),
+   payload(std::move(payload))
+{
+}
+
+bool P2pMessage::read( int socket, uint32_t magic )
+{
+   uint8_t header[HEADER_SIZE];
+   if( !recvAll(socket, header, sizeof(header)) )
+   {
+      return false;
+   }
+
+   ByteArray headerData( header, header + sizeof(header) );
+   Reader reader( headerData );
+   if( reader.integer(4) != magic )
+   {
+      throw std::runtime_error( "Message from another network" );
+   }
+
+   auto name = reinterpret_cast<const char*>( reader.bytes(COMMAND_SIZE) );
+   command.assign( name, strnlen(name, COMMAND_SIZE) );
+   auto size = reader.integer( 4 );
+   auto expected = reader.integer( 4 );
+   if( size > MAX_PAYLOAD_SIZE )
+   {
+      throw std::runtime_error( "Oversized " + command + " message" );
+   }
+
+   payload.resize( size );
+   if( !recvAll(socket, payload.data(), payload.size()) )
+   {
+      return false;
+   }
+
+   if( checksum(payload) != expected )
+   {
+      throw std::runtime_error( "Bad checksum on " + command + " message" );
+   }
+
+   return true;
+}
+
+bool P2pMessage::write( int socket, uint32_t magic ) const
+{
+   return write( socket, magic, command, payload );
+}
+
+bool P2pMessage::write( int socket, uint32_t magic, const std::string& command, const ByteArray& payload )
+{
+   ByteArray header;
+   header.reserve( HEADER_SIZE );
+   appendInteger( header, magic, 4 );
+   char name[COMMAND_SIZE] = {};
+   command.copy( name, COMMAND_SIZE );
+   appendBytes( header, name, COMMAND_SIZE );
+   appendInteger( header, payload.size(), 4 );
+   appendInteger( header, checksum(payload), 4 );
+
+   return sendAll( socket, header.data(), header.size() ) &&
+          sendAll( socket, payload.data(), payload.size() );
+}
+
+void P2pMessage::appendInteger( ByteArray& payload, uint64_t n, size_t size )
+{
+   for( size_t i = 0; i < size; ++i )
+   {
+      payload.push_back( static_cast<uint8_t>(n >> (i * 8)) );
+   }
+}
+
+void P2pMessage::appendVarInt( ByteArray& payload, uint64_t n )
+{
+   if( n < 0xfd )
+   {
+      payload.push_back( static_cast<uint8_t>(n) );
+   }
+   else if( n <= 0xffff )
+   {
+      payload.push_back( 0xfd );
+      appendInteger( payload, n, 2 );
+   }
+   else if( n <= 0xffffffff )
+   {
+      payload.push_back( 0xfe );
+      appendInteger( payload, n, 4 );
+   }
+   else
+   {
+      payload.push_back( 0xff );
+      appendInteger( payload, n, 8 );
+   }
+}
+
+void P2pMessage::appendBytes( ByteArray& payload, const void* data, size_t size )
+{
+   auto bytes = static_cast<const uint8_t*>( data );
+   payload.insert( payload.end(), bytes, bytes + size );
+}
+
+uint32_t P2pMessage::networkMagic( const std::string& chain )
+{
+   if( chain == "main" )     return 0xd9b4bef9;
+   if( chain == "test" )     return 0x0709110b;
+   if( chain == "testnet4" ) return 0x283f161c;
+   if( chain == "signet" )   return 0x40cf030a;
+   if( chain == "regtest" )  return 0xdab5bffa;
+
+   throw std::runtime_error( "No P2P network magic known for chain \"" + chain + "\"" );
+}
+
+void P2pMessage::shortIdKeys( const Block::Header& header, uint64_t nonce, uint64_t& k0, uint64_t& k1 )
+{
+   ByteArray data;
+   appendBytes( data, &header, sizeof(header) );
+   appendInteger( data, nonce, 8 );
+
+   Sha256::RawDigest hash;
+   Sha256::hash( data.data(), data.size(), hash );
+
+   ByteArray hashData( hash.begin(), hash.end() );
+   Reader reader( hashData );
+   k0 = reader.integer( 8 );
+   k1 = reader.integer( 8 );
+}
+
+// SipHash-2-4 of the 32-byte wtxid, truncated to 48 bits
+uint64_t P2pMessage::shortId( uint64_t k0, uint64_t k1, const Sha256::RawDigest& wtxid )
+{
+   uint64_t v0 = k0 ^ 0x736f6d6570736575ull;
+   uint64_t v1 = k1 ^ 0x646f72616e646f6dull;
+   uint64_t v2 = k0 ^ 0x6c7967656e657261ull;
+   uint64_t v3 = k1 ^ 0x7465646279746573ull;
+
+   for( size_t offset = 0; offset <= wtxid.size(); offset += 8 )
+   {
+      // The final word holds just the message length
+      uint64_t m = static_cast<uint64_t>( wtxid.size() ) << 56;
+      if( offset < wtxid.size() )
+      {
+         m = 0;
+         for( int i = 0; i < 8; ++i )
+         {
+            m |= static_cast<uint64_t>( wtxid[offset + i] ) << (i * 8);
+         }
+      }
+
+      v3 ^= m;
+      sipRound( v0, v1, v2, v3 );
+      sipRound( v0, v1, v2, v3 );
+      v0 ^= m;
+   }
+
+   v2 ^= 0xff;
+   for( int i = 0; i < 4; ++i )
+   {
+      sipRound( v0, v1, v2, v3 );
+   }
+
+   return (v0 ^ v1 ^ v2 ^ v3) & 0xffffffffffffull;
+}
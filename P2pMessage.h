@@ -0,0 +1,98 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef P2P_MESSAGE_H
+#define P2P_MESSAGE_H
+
+#include "Block.h"
+#include "Sha256.h"
+#include "Util.h"
+
+#include <cstdint>
+#include <string>
+
+/*
+ * A Bitcoin P2P protocol message. On the wire it's framed by the network's
+ * magic bytes, the command (null-padded to 12 bytes), and the payload's size
+ * and checksum (the first 4 bytes of its double SHA-256).
+ *
+ * Payloads are built with the append functions and parsed with a Reader,
+ * all little-endian as the protocol is.
+ */
+class P2pMessage
+{
+public:
+   /*
+    * Bounds-checked cursor over a payload; any overrun makes it invalid, and
+    * everything read after that is zero.
+    */
+   class Reader
+   {
+   public:
+      Reader( const ByteArray& payload );
+
+      const uint8_t* bytes( size_t count );
+      uint64_t integer( size_t size );
+      uint64_t varInt();
+      Sha256::RawDigest digest();
+
+      /*
+       * A whole raw transaction, with any witness, setting size to its
+       * length.
+       */
+      const uint8_t* transaction( size_t& size );
+
+      bool valid() const;
+      bool atEnd() const;
+
+   private:
+      const ByteArray&  _payload;
+      size_t            _pos;
+      bool              _valid;
+   };
+
+public:
+   P2pMessage();
+   P2pMessage( const std::string& command, ByteArray&& payload );
+
+   /*
+    * Read one message from a blocking socket. Returns false if the
+    * connection closes or fails; throws std::runtime_error if the framing
+    * is bad (wrong magic, oversized, or a checksum mismatch).
+    */
+   bool read( int socket, uint32_t magic );
+
+   /*
+    * Returns false if the connection closes or fails.
+    */
+   bool write( int socket, uint32_t magic ) const;
+   static bool write( int socket, uint32_t magic, const std::string& command, const ByteArray& payload );
+
+   static void appendInteger( ByteArray& payload, uint64_t n, size_t size );
+   static void appendVarInt( ByteArray& payload, uint64_t n );
+   static void appendBytes( ByteArray& payload, const void* data, size_t size );
+
+   /*
+    * The magic bytes of the network getmininginfo calls "main", "test",
+    * "testnet4", "signet" (the default signet only) or "regtest". Throws
+    * std::runtime_error for any other.
+    */
+   static uint32_t networkMagic( const std::string& chain );
+
+   /*
+    * BIP 152's SipHash keys for a compact block's short IDs: the first two
+    * little-endian words of the single SHA-256 of the header and nonce.
+    */
+   static void shortIdKeys( const Block::Header& header, uint64_t nonce, uint64_t& k0, uint64_t& k1 );
+
+   /*
+    * The 6-byte short ID of a transaction's wtxid, in the low bits.
+    */
+   static uint64_t shortId( uint64_t k0, uint64_t k1, const Sha256::RawDigest& wtxid );
+
+public:
+   std::string command;
+   ByteArray   payload;
+};
+
+#endif // !P2P_MESSAGE_H
@@ -0,0 +1,370 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "P2pPeer.h"
+#include "Hex.h"
+#include "Settings.h"
+#include "Trace.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+// Version 70016 has wtxid relay; anything from 70014 has compact blocks
+const int32_t PROTOCOL_VERSION = 70016;
+
+// Services offered: only that blocks are sent with their witnesses
+const uint64_t NODE_WITNESS = 1 << 3;
+
+// Compact block version that uses wtxids, for segwit blocks
+const uint64_t COMPACT_BLOCK_VERSION = 2;
+
+// Inventory types of getdata requests
+const uint32_t MSG_BLOCK = 2;
+const uint32_t MSG_CMPCT_BLOCK = 4;
+const uint32_t MSG_WITNESS_FLAG = 1u << 30;
+
+const std::chrono::seconds RECONNECT_INTERVAL( 5 );
+
+P2pPeer::P2pPeer( const std::string& address, uint32_t magic )
+ : _name(address),
+   _magic(magic),
+   _stop(false),
+   _failing(false),
+   _socket(-1),
+   _ready(false),
+   _compact(false),
+   _rng(std::random_device()())
+{
+   auto colon = address.rfind( ':' );
+   if( colon == std::string::npos || colon == 0 || colon + 1 == address.size() )
+   {
+      throw std::runtime_error( "P2P node must be given as host:port, not " + address );
+   }
+   _host = address.substr( 0, colon );
+   _port = address.substr( colon + 1 );
+   _lastHash.fill( 0 );
+
+   _thread = std::thread( &P2pPeer::_run, this );
+}
+
+P2pPeer::~P2pPeer()
+{
+   {
+      std::lock_guard<std::mutex> lock( _stopMutex );
+      _stop = true;
+      _stopCondition.notify_all();
+   }
+
+   {
+      // Wakes the thread from its read
+      std::lock_guard<std::mutex> lock( _mutex );
+      if( _socket >= 0 )
+      {
+         ::shutdown( _socket, SHUT_RDWR );
+      }
+   }
+
+   _thread.join();
+}
+
+bool P2pPeer::sendBlock( const Block& block )
+{
+   TRACE_SCOPE( "P2pPeer::sendBlock" );
+
+   std::ostringstream stream;
+   block.coinbase().serialize( stream );
+   auto hex = stream.str();
+   ByteArray coinbase( hex.size() / 2 );
+   Hex::decode( hex.data(), hex.size(), coinbase.data() );
+
+   std::lock_guard<std::mutex> lock( _mutex );
+   if( _socket < 0 || !_ready )
+   {
+      return false;
+   }
+
+   auto& txns = block.transactions();
+   bool sent = true;
+   if( _compact )
+   {
+      // The coinbase is prefilled, since the node can't have it
+      ByteArray payload;
+      payload.reserve( sizeof(block.header) + 8 + 9 + txns.count() * 6 + 2 + coinbase.size() );
+      P2pMessage::appendBytes( payload, &block.header, sizeof(block.header) );
+
+      uint64_t nonce = _rng();
+      uint64_t k0, k1;
+      P2pMessage::shortIdKeys( block.header, nonce, k0, k1 );
+      P2pMessage::appendInteger( payload, nonce, 8 );
+      P2pMessage::appendVarInt( payload, txns.count() );
+      for( size_t i = 0; i < txns.count(); ++i )
+      {
+         P2pMessage::appendInteger( payload, P2pMessage::shortId(k0, k1, txns.wtxid(i)), 6 );
+      }
+
+      P2pMessage::appendVarInt( payload, 1 );
+      P2pMessage::appendVarInt( payload, 0 );
+      P2pMessage::appendBytes( payload, coinbase.data(), coinbase.size() );
+      sent = _send( "cmpctblock", payload );
+   }
+
+   // Kept for the node's requests, once the compact block is on its way
+   Sha256::doubleHash( &block.header, sizeof(block.header), _lastHash );
+   _lastBlock.clear();
+   _lastBlock.reserve( sizeof(block.header) + 9 + coinbase.size() + txns.bytes().size() );
+   P2pMessage::appendBytes( _lastBlock, &block.header, sizeof(block.header) );
+   P2pMessage::appendVarInt( _lastBlock, 1 + txns.count() );
+   _lastOffsets.clear();
+   _lastOffsets.push_back( _lastBlock.size() );
+   P2pMessage::appendBytes( _lastBlock, coinbase.data(), coinbase.size() );
+   auto base = _lastBlock.size();
+   P2pMessage::appendBytes( _lastBlock, txns.bytes().data(), txns.bytes().size() );
+   for( size_t i = 0; i < txns.count(); ++i )
+   {
+      _lastOffsets.push_back( base + (txns.rawData(i) - txns.bytes().data()) );
+   }
+   _lastOffsets.push_back( _lastBlock.size() );
+
+   if( !_compact )
+   {
+      sent = _send( "block", _lastBlock );
+   }
+
+   if( Settings::debug() )
+   {
+      std::cout << "Sent " << (_compact ? "compact" : "whole") << " block to " << _name << " over P2P" << std::endl;
+   }
+
+   return sent;
+}
+
+void P2pPeer::_run()
+{
+   while( !_stop )
+   {
+      std::string reason = "Connection closed by the node";
+      try
+      {
+         int socket = _connect();
+         {
+            // Checked under the lock, or the destructor could miss the socket
+            std::lock_guard<std::mutex> lock( _mutex );
+            _socket = socket;
+            _ready = false;
+            _compact = false;
+            if( _stop )
+            {
+               ::shutdown( socket, SHUT_RDWR );
+            }
+         }
+         _serve( socket );
+      }
+      catch( std::exception& e )
+      {
+         reason = e.what();
+      }
+
+      {
+         std::lock_guard<std::mutex> lock( _mutex );
+         if( _socket >= 0 )
+         {
+            ::close( _socket );
+            _socket = -1;
+         }
+         _ready = false;
+      }
+
+      if( !_stop && !_failing )
+      {
+         std::cout << "P2P connection to " << _name << ": " << reason << "; retrying every "
+                   << RECONNECT_INTERVAL.count() << " s" << std::endl;
+         _failing = true;
+      }
+
+      std::unique_lock<std::mutex> lock( _stopMutex );
+      _stopCondition.wait_for( lock, RECONNECT_INTERVAL, [this](){return _stop.load();} );
+   }
+}
+
+int P2pPeer::_connect()
+{
+   addrinfo hints;
+   std::memset( &hints, 0, sizeof(hints) );
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+
+   addrinfo* addresses = nullptr;
+   auto error = ::getaddrinfo( _host.c_str(), _port.c_str(), &hints, &addresses );
+   if( error != 0 )
+   {
+      throw std::runtime_error( ::gai_strerror(error) );
+   }
+
+   int socket = -1;
+   int connectError = 0;
+   for( auto address = addresses; address != nullptr && socket < 0; address = address->ai_next )
+   {
+      socket = ::socket( address->ai_family, address->ai_socktype, address->ai_protocol );
+      if( socket >= 0 && ::connect(socket, address->ai_addr, address->ai_addrlen) != 0 )
+      {
+         connectError = errno;
+         ::close( socket );
+         socket = -1;
+      }
+   }
+   ::freeaddrinfo( addresses );
+
+   if( socket < 0 )
+   {
+      throw std::runtime_error( std::strerror(connectError) );
+   }
+
+   // Blocks are written in one go, so there's nothing to gain from batching
+   int noDelay = 1;
+   ::setsockopt( socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay) );
+   return socket;
+}
+
+void P2pPeer::_serve( int socket )
+{
+   ByteArray version;
+   P2pMessage::appendInteger( version, PROTOCOL_VERSION, 4 );
+   P2pMessage::appendInteger( version, NODE_WITNESS, 8 );
+   P2pMessage::appendInteger( version, std::time(nullptr), 8 );
+   version.resize( version.size() + 2 * 26 ); // Addresses, which nodes ignore
+   {
+      std::lock_guard<std::mutex> lock( _mutex );
+      P2pMessage::appendInteger( version, _rng(), 8 );
+   }
+   std::string userAgent = "/jrmrmine/";
+   P2pMessage::appendVarInt( version, userAgent.size() );
+   P2pMessage::appendBytes( version, userAgent.data(), userAgent.size() );
+   P2pMessage::appendInteger( version, 0, 4 ); // Start height
+   version.push_back( 0 ); // No transaction relay
+
+   {
+      std::lock_guard<std::mutex> lock( _mutex );
+      if( !_send("version", version) )
+      {
+         return;
+      }
+   }
+
+   P2pMessage message;
+   while( !_stop && message.read(socket, _magic) )
+   {
+      _handle( message );
+   }
+}
+
+void P2pPeer::_handle( const P2pMessage& message )
+{
+   if( Settings::debug() )
+   {
+      std::cout << "P2P: " << message.command << " from " << _name << std::endl;
+   }
+
+   std::lock_guard<std::mutex> lock( _mutex );
+   if( message.command == "version" )
+   {
+      _send( "verack", ByteArray() );
+   }
+   else if( message.command == "verack" )
+   {
+      // Not asking for compact blocks to be pushed to us, just saying we
+      // understand them
+      ByteArray payload;
+      P2pMessage::appendInteger( payload, 0, 1 );
+      P2pMessage::appendInteger( payload, COMPACT_BLOCK_VERSION, 8 );
+      _send( "sendcmpct", payload );
+
+      _ready = true;
+      std::cout << "P2P connection to " << _name << " is up" << std::endl;
+      _failing = false;
+   }
+   else if( message.command == "sendcmpct" )
+   {
+      P2pMessage::Reader reader( message.payload );
+      reader.integer( 1 );
+      if( reader.integer(8) == COMPACT_BLOCK_VERSION && reader.valid() )
+      {
+         _compact = true;
+      }
+   }
+   else if( message.command == "ping" )
+   {
+      _send( "pong", message.payload );
+   }
+   else if( message.command == "getblocktxn" )
+   {
+      _sendTransactions( message.payload );
+   }
+   else if( message.command == "getdata" )
+   {
+      _sendRequestedBlock( message.payload );
+   }
+}
+
+// Caller holds _mutex
+bool P2pPeer::_send( const std::string& command, const ByteArray& payload )
+{
+   return _socket >= 0 && P2pMessage::write( _socket, _magic, command, payload );
+}
+
+// Answer a getblocktxn for the last block, whose indexes are each given as
+// the difference from the one before, less one. Caller holds _mutex.
+void P2pPeer::_sendTransactions( const ByteArray& request )
+{
+   P2pMessage::Reader reader( request );
+   auto hash = reader.digest();
+   auto count = reader.varInt();
+   if( !reader.valid() || hash != _lastHash )
+   {
+      return;
+   }
+
+   ByteArray payload( hash.begin(), hash.end() );
+   P2pMessage::appendVarInt( payload, count );
+   uint64_t index = 0;
+   for( uint64_t i = 0; i < count; ++i )
+   {
+      index += reader.varInt() + (i > 0 ? 1 : 0);
+      if( !reader.valid() || index + 1 >= _lastOffsets.size() )
+      {
+         return;
+      }
+
+      auto begin = _lastOffsets[index];
+      P2pMessage::appendBytes( payload, _lastBlock.data() + begin, _lastOffsets[index + 1] - begin );
+   }
+
+   _send( "blocktxn", payload );
+}
+
+// Answer a getdata for the last block, always with its witnesses: nodes that
+// would want it without predate segwit. Caller holds _mutex.
+void P2pPeer::_sendRequestedBlock( const ByteArray& request )
+{
+   P2pMessage::Reader reader( request );
+   auto count = reader.varInt();
+   for( uint64_t i = 0; i < count && reader.valid(); ++i )
+   {
+      auto type = reader.integer( 4 ) & ~MSG_WITNESS_FLAG;
+      auto hash = reader.digest();
+      if( reader.valid() && hash == _lastHash && (type == MSG_BLOCK || type == MSG_CMPCT_BLOCK) )
+      {
+         _send( "block", _lastBlock );
+      }
+   }
+}
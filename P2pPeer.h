@@ -0,0 +1,87 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef P2P_PEER_H
+#define P2P_PEER_H
+
+#include "Block.h"
+#include "P2pMessage.h"
+#include "Sha256.h"
+#include "Util.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * A Bitcoin P2P connection to the node, for handing it solved blocks
+ * directly. A compact block (BIP 152) is just the header, a short ID per
+ * transaction and the coinbase, which the node rebuilds from its mempool,
+ * so it's validated and relayed without first decoding a whole hex block
+ * from JSON-RPC.
+ *
+ * The connection is made, and remade whenever it drops, by a thread of its
+ * own, which also answers the node: pings, and requests for the last
+ * block's transactions (getblocktxn) or the whole block (getdata) when its
+ * mempool was missing some.
+ */
+class P2pPeer
+{
+public:
+   /*
+    * Connect in the background to host:port, on the network with the given
+    * magic bytes (see P2pMessage::networkMagic()).
+    */
+   P2pPeer( const std::string& address, uint32_t magic );
+   ~P2pPeer();
+
+   P2pPeer( const P2pPeer& ) = delete;
+   P2pPeer& operator =( const P2pPeer& ) = delete;
+
+   /*
+    * Send a solved block: compact if the node has said it takes version 2
+    * (segwit) compact blocks, otherwise whole. Returns false, without
+    * waiting, if the connection isn't up.
+    */
+   bool sendBlock( const Block& block );
+
+private:
+   void _run();
+   int _connect();
+   void _serve( int socket );
+   void _handle( const P2pMessage& message );
+   bool _send( const std::string& command, const ByteArray& payload );
+   void _sendTransactions( const ByteArray& request );
+   void _sendRequestedBlock( const ByteArray& request );
+
+private:
+   std::string                _name;      // host:port, for the log
+   std::string                _host;
+   std::string                _port;
+   uint32_t                   _magic;
+
+   std::atomic<bool>          _stop;
+   std::mutex                 _stopMutex;
+   std::condition_variable    _stopCondition;
+   std::thread                _thread;
+   bool                       _failing;   // A failure to connect was logged
+
+   // Sending, and the state below
+   std::mutex                 _mutex;
+   int                        _socket;
+   bool                       _ready;     // The handshake is done
+   bool                       _compact;   // The node takes version 2 compact blocks
+   std::mt19937_64            _rng;
+
+   // The last block sent, raw, and where each transaction starts in it
+   Sha256::RawDigest          _lastHash;
+   ByteArray                  _lastBlock;
+   std::vector<size_t>        _lastOffsets;
+};
+
+#endif // !P2P_PEER_H
@@ -4,6 +4,7 @@
 
 #include "Radix.h"
 #include "Sha256.h"
+#include "TaskPool.h"
 
 #include <cassert>
 #include <algorithm>
@@ -11,9 +12,13 @@
 #include <climits>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 
 const int ALPHABET_INVALID_LETTER = -1;
 
+// Strings per pool task in the batch calls
+const size_t BATCH_GRAIN = 16;
+
 // The "system radix" corresponds to the range of the smallest addressable unit,
 // aka char in C. Data converted to system radix will therefore look like its
 // raw big-endian representation.
@@ -46,7 +51,7 @@ Radix::Alphabet::Alphabet( const std::string& encodeTable )
 
    // The decode table will be larger than the encode table if there are gaps
    // in the alphabet.
-   int alphabetRange = _upperBound - _lowerBound;
+   int alphabetRange = _upperBound - _lowerBound + 1;
    _decodeTable.resize( alphabetRange, ALPHABET_INVALID_LETTER );
 
    for( unsigned int i = 0; i < _encodeTable.size(); ++i )
@@ -56,24 +61,283 @@ Radix::Alphabet::Alphabet( const std::string& encodeTable )
    }
 }
 
+// Base58check strings are converted in fixed-size buffers, which comfortably
+// hold addresses and private keys
+const size_t BASE58_MAX_BYTES = 128;
+const size_t BASE58_MAX_DIGITS = 176;
+const size_t CHECK_CODE_SIZE = 4;
+
+// Digits are converted in groups: 58^5 is the largest power of 58 that fits
+// in 32 bits
+const uint32_t BASE58 = 58;
+const int BASE58_GROUP_DIGITS = 5;
+const uint32_t BASE58_GROUP_RADIX = 58 * 58 * 58 * 58 * 58;
+
+// Convert big-endian bytes to base 58 digit values, with a zero digit for each
+// leading zero byte. Returns the number of digits.
+static size_t bytesToBase58( const uint8_t* data, size_t size, uint8_t* digits )
+{
+   size_t zeros = 0;
+   while( zeros < size && data[zeros] == 0 )
+   {
+      ++zeros;
+   }
+
+   // Accumulate the number as little-endian groups of 5 digits, taking the
+   // input 32 bits at a time (the first chunk may be shorter)
+   uint32_t groups[BASE58_MAX_DIGITS / BASE58_GROUP_DIGITS + 1];
+   size_t groupCount = 0;
+
+   size_t chunk = (size - zeros) % 4 ? (size - zeros) % 4 : 4;
+   for( size_t i = zeros; i < size; i += chunk, chunk = 4 )
+   {
+      uint64_t carry = 0;
+      for( size_t j = 0; j < chunk; ++j )
+      {
+         carry = carry << CHAR_BIT | data[i + j];
+      }
+
+      int shift = chunk * CHAR_BIT;
+      for( size_t k = 0; k < groupCount; ++k )
+      {
+         uint64_t value = (static_cast<uint64_t>(groups[k]) << shift) + carry;
+         groups[k] = value % BASE58_GROUP_RADIX;
+         carry = value / BASE58_GROUP_RADIX;
+      }
+
+      while( carry > 0 )
+      {
+         groups[groupCount++] = carry % BASE58_GROUP_RADIX;
+         carry /= BASE58_GROUP_RADIX;
+      }
+   }
+
+   std::fill( digits, digits + zeros, 0 );
+   size_t count = zeros;
+   if( groupCount == 0 )
+   {
+      return count;
+   }
+
+   // The top group without its leading zeros, then the rest in full
+   uint8_t top[BASE58_GROUP_DIGITS];
+   int topDigits = 0;
+   for( uint32_t group = groups[groupCount - 1]; group > 0; group /= BASE58 )
+   {
+      top[topDigits++] = group % BASE58;
+   }
+   while( topDigits > 0 )
+   {
+      digits[count++] = top[--topDigits];
+   }
+
+   for( size_t k = groupCount - 1; k-- > 0; )
+   {
+      uint32_t group = groups[k];
+      for( int d = BASE58_GROUP_DIGITS - 1; d >= 0; --d )
+      {
+         digits[count + d] = group % BASE58;
+         group /= BASE58;
+      }
+      count += BASE58_GROUP_DIGITS;
+   }
+
+   return count;
+}
+
+// Convert base 58 digit values to big-endian bytes, with a zero byte for each
+// leading zero digit. Returns false if the result doesn't fit in
+// BASE58_MAX_BYTES.
+static bool base58ToBytes( const uint8_t* digits, size_t count, uint8_t* data, size_t& size )
+{
+   size_t zeros = 0;
+   while( zeros < count && digits[zeros] == 0 )
+   {
+      ++zeros;
+   }
+   if( zeros > BASE58_MAX_BYTES )
+   {
+      return false;
+   }
+
+   // Accumulate the number as little-endian 32-bit words, taking the input 5
+   // digits at a time (the first group may be shorter)
+   const size_t MAX_WORDS = BASE58_MAX_BYTES / 4;
+   uint32_t words[MAX_WORDS];
+   size_t wordCount = 0;
+
+   size_t group = (count - zeros) % BASE58_GROUP_DIGITS ? (count - zeros) % BASE58_GROUP_DIGITS : BASE58_GROUP_DIGITS;
+   for( size_t i = zeros; i < count; i += group, group = BASE58_GROUP_DIGITS )
+   {
+      uint64_t carry = 0;
+      uint64_t multiplier = 1;
+      for( size_t j = 0; j < group; ++j )
+      {
+         carry = carry * BASE58 + digits[i + j];
+         multiplier *= BASE58;
+      }
+
+      for( size_t k = 0; k < wordCount; ++k )
+      {
+         uint64_t value = static_cast<uint64_t>(words[k]) * multiplier + carry;
+         words[k] = static_cast<uint32_t>(value);
+         carry = value >> 32;
+      }
+
+      while( carry > 0 )
+      {
+         if( wordCount == MAX_WORDS )
+         {
+            return false;
+         }
+         words[wordCount++] = static_cast<uint32_t>(carry);
+         carry >>= 32;
+      }
+   }
+
+   // Skip the leading zero bytes of the top word
+   int topBytes = 4;
+   while( wordCount > 0 && topBytes > 0 && (words[wordCount - 1] >> ((topBytes - 1) * CHAR_BIT)) == 0 )
+   {
+      --topBytes;
+   }
+
+   size = zeros + (wordCount > 0 ? (wordCount - 1) * 4 + topBytes : 0);
+   if( size > BASE58_MAX_BYTES )
+   {
+      return false;
+   }
+
+   std::fill( data, data + zeros, 0 );
+   uint8_t* output = data + zeros;
+   for( size_t k = wordCount; k-- > 0; )
+   {
+      for( int b = (k == wordCount - 1) ? topBytes - 1 : 3; b >= 0; --b )
+      {
+         *output++ = words[k] >> (b * CHAR_BIT);
+      }
+   }
+
+   return true;
+}
+
 ByteArray Radix::base58DecodeCheck( const std::string& base58Str )
 {
-   const Alphabet& srcAlphabet = BASE_58_ALPHABET;
+   ByteArray payload;
+   auto error = _base58DecodeCheck( base58Str, payload );
+   if( error != nullptr )
+      throw std::runtime_error( error );
+
+   return payload;
+}
+
+std::string Radix::base58EncodeCheck( const ByteArray& payload )
+{
+   std::string base58Str;
+   _base58EncodeCheck( payload, base58Str );
+   return base58Str;
+}
+
+std::vector<Radix::CheckResult> Radix::base58DecodeCheck( const std::vector<std::string>& base58Strs )
+{
+   std::vector<CheckResult> results( base58Strs.size() );
+   TaskPool::parallelFor( base58Strs.size(), BATCH_GRAIN, [&](size_t begin, size_t end)
+   {
+      for( size_t i = begin; i < end; ++i )
+      {
+         results[i].valid = (_base58DecodeCheck(base58Strs[i], results[i].payload) == nullptr);
+      }
+   } );
+
+   return results;
+}
+
+std::vector<std::string> Radix::base58EncodeCheck( const std::vector<ByteArray>& payloads )
+{
+   std::vector<std::string> base58Strs( payloads.size() );
+   TaskPool::parallelFor( payloads.size(), BATCH_GRAIN, [&](size_t begin, size_t end)
+   {
+      for( size_t i = begin; i < end; ++i )
+      {
+         _base58EncodeCheck( payloads[i], base58Strs[i] );
+      }
+   } );
+
+   return base58Strs;
+}
+
+const char* Radix::_base58DecodeCheck( const std::string& base58Str, ByteArray& payload )
+{
+   const Alphabet& alphabet = BASE_58_ALPHABET;
 
-   ByteArray input = decodeAlphabet( base58Str, srcAlphabet );
-   ByteArray output = convert( input, srcAlphabet._encodeTable.size(), SYSTEM_RADIX );
+   if( base58Str.size() > BASE58_MAX_DIGITS )
+      return "base58check string too long";
 
-   // If we have enough data to constitute a payload, do a
-   // SHA256(SHA256(payload)) check
-   if( output.size() > 4 )
+   uint8_t digits[BASE58_MAX_DIGITS];
+   for( size_t i = 0; i < base58Str.size(); ++i )
    {
-      ByteArray checkCode( output.end() - 4, output.end() );
-      output.erase( output.end() - 4, output.end() );
+      char ch = base58Str[i];
+      int value = ALPHABET_INVALID_LETTER;
+      if( ch >= alphabet._lowerBound && ch <= alphabet._upperBound )
+      {
+         value = alphabet._decodeTable[ch - alphabet._lowerBound];
+      }
+      if( value == ALPHABET_INVALID_LETTER )
+         return "invalid base58 character";
 
-      auto rawDigest = Sha256::doubleHash( output );
+      digits[i] = value;
+   }
+
+   uint8_t data[BASE58_MAX_BYTES];
+   size_t size;
+   if( !base58ToBytes(digits, base58Str.size(), data, size) )
+      return "base58check string too long";
+
+   if( size < CHECK_CODE_SIZE )
+      return "base58check string too short";
+
+   size -= CHECK_CODE_SIZE;
+   Sha256::RawDigest digest;
+   Sha256::doubleHash( data, size, digest );
+   if( !std::equal(data + size, data + size + CHECK_CODE_SIZE, digest.begin()) )
+      return "address check code failed";
 
-      if( !std::equal(checkCode.begin(), checkCode.end(), rawDigest.begin()) )
-         throw std::runtime_error( "address check code failed" );
+   payload.assign( data, data + size );
+   return nullptr;
+}
+
+void Radix::_base58EncodeCheck( const ByteArray& payload, std::string& base58Str )
+{
+   const Alphabet& alphabet = BASE_58_ALPHABET;
+
+   if( payload.size() > BASE58_MAX_BYTES - CHECK_CODE_SIZE )
+      throw std::runtime_error( "payload too large for base58check" );
+
+   uint8_t data[BASE58_MAX_BYTES];
+   std::copy( payload.begin(), payload.end(), data );
+   Sha256::RawDigest digest;
+   Sha256::doubleHash( payload.data(), payload.size(), digest );
+   std::copy( digest.begin(), digest.begin() + CHECK_CODE_SIZE, data + payload.size() );
+
+   uint8_t digits[BASE58_MAX_DIGITS];
+   size_t count = bytesToBase58( data, payload.size() + CHECK_CODE_SIZE, digits );
+
+   base58Str.resize( count );
+   for( size_t i = 0; i < count; ++i )
+   {
+      base58Str[i] = alphabet._encodeTable[digits[i]];
+   }
+}
+
+std::string Radix::encodeAlphabet( const ByteArray& input, const Alphabet& alphabet )
+{
+   std::string output;
+   output.reserve( input.size() );
+
+   for( auto value : input )
+   {
+      assert( value < alphabet._encodeTable.size() );
+      output.push_back( alphabet._encodeTable[value] );
    }
 
    return output;
@@ -128,13 +392,9 @@ ByteArray Radix::convert( const ByteArray& input, int srcRadix, int destRadix )
    // The output size calculation has to be conservative, so there may be
    // leading bytes in the output which have to be removed. Shouldn't be more
    // than one, though.
-   int removedCount = 0;
-   while( output[0] == 0 )
-   {
-      output.erase( output.begin() );
-      ++removedCount;
-   }
-   assert( removedCount <= 1 );
+   auto firstNonZero = std::find_if( output.begin(), output.end(), [](uint8_t a){return a != 0;} );
+   assert( firstNonZero - output.begin() <= 1 || inputSize == 0 );
+   output.erase( output.begin(), firstNonZero );
 
    return output;
 }
@@ -47,16 +47,52 @@ public:
     */
    static ByteArray base58DecodeCheck( const std::string& base58Str );
 
+   /*
+    * Append a checksum to raw data and encode it in the bitcoin base 58
+    * alphabet.
+    */
+   static std::string base58EncodeCheck( const ByteArray& payload );
+
+   /*
+    * Outcome of decoding one string in a batch.
+    */
+   struct CheckResult
+   {
+      bool        valid;
+      ByteArray   payload;
+   };
+
+   /*
+    * Decode and verify many base58check strings (e.g. payout or worker
+    * addresses) at once. Bad strings are flagged instead of throwing.
+    */
+   static std::vector<CheckResult> base58DecodeCheck( const std::vector<std::string>& base58Strs );
+
+   /*
+    * Encode many payloads with base58check.
+    */
+   static std::vector<std::string> base58EncodeCheck( const std::vector<ByteArray>& payloads );
+
    /*
     * Decode a string from an arbitrary alphabet to data in the same radix (no
     * radix conversion is performed).
     */
    static ByteArray decodeAlphabet( const std::string& inputStr, const Alphabet& alphabet );
 
+   /*
+    * Encode data to an arbitrary alphabet, in the same radix.
+    */
+   static std::string encodeAlphabet( const ByteArray& input, const Alphabet& alphabet );
+
    /*
     * Convert data from one radix to another.
     */
    static ByteArray convert( const ByteArray& input, int srcRadix, int destRadix );
+
+private:
+   // Returns nullptr on success, otherwise what was wrong with the string
+   static const char* _base58DecodeCheck( const std::string& base58Str, ByteArray& payload );
+   static void _base58EncodeCheck( const ByteArray& payload, std::string& base58Str );
 };
 
 /*
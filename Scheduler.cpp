@@ -0,0 +1,580 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "Scheduler.h"
+#include "Metrics.h"
+#include "Topology.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <stdexcept>
+#include <cassert>
+
+// Each step is sized to take about this long at the thread's measured rate:
+// long enough that handing it out costs nothing, short enough that a thief
+// never waits long for the step in progress
+const double STEP_SECONDS = 0.01;
+const uint64_t MIN_STEP = 1 << 12;
+const uint64_t MAX_STEP = 1 << 24;
+const uint64_t INITIAL_STEP = 1 << 16;
+
+// Size of a chunk claimed from the shared counter, in steps
+const uint64_t STEPS_PER_CHUNK = 16;
+
+// Weight of the latest step in a thread's measured rate
+const double RATE_SMOOTHING = 0.25;
+
+static std::atomic<bool> _pinning( true );
+
+Scheduler::Slot::Slot()
+ : next(0),
+   end(0)
+{
+}
+
+Scheduler::Scheduler( const std::string& minerType, int threadCount )
+ : _minerType(minerType),
+   _miners(threadCount),
+   _liveCounters(threadCount, nullptr),
+   _rates(threadCount, 0.0),
+   _pinned(_pinning),
+   _metrics(false),
+   _abort(false),
+   _hashes(0),
+   _mining(false),
+   _pendingThreads(0),
+   _reconfigure(false),
+   _paused(false)
+{
+   assert( threadCount > 0 );
+
+   if( Miner::createInstance(minerType) == nullptr )
+   {
+      throw std::runtime_error( "Miner implementation doesn't exist" );
+   }
+
+   if( _pinned )
+   {
+      _cpus = Topology::host().placement( threadCount );
+   }
+}
+
+Miner::Result Scheduler::mine( Block& block )
+{
+   return mine( block, 0, std::numeric_limits<uint32_t>::max() );
+}
+
+Miner::Result Scheduler::mine( Block& block, uint32_t firstNonce, uint32_t lastNonce )
+{
+   return _mine( block, bitsToTarget(block.header.bits), firstNonce, lastNonce, nullptr );
+}
+
+Miner::Result Scheduler::mine( Block& block, const ByteArray& target, const CandidateFn& isSolution )
+{
+   return _mine( block, target, 0, std::numeric_limits<uint32_t>::max(), &isSolution );
+}
+
+Scheduler::Search::Search( const Block::Header& header, const ByteArray& target, uint32_t firstNonce, uint32_t lastNonce,
+                           const CandidateFn* isSolution )
+ : header(header),
+   target(target),
+   firstNonce(firstNonce),
+   rangeSize(static_cast<uint64_t>(lastNonce) - firstNonce + 1),
+   isSolution(isSolution),
+   claimed(0),
+   slotCount(0)
+{
+}
+
+// Only called while no thread is mining
+void Scheduler::Search::resize( int threads )
+{
+   if( threads <= slotCount )
+   {
+      return;
+   }
+
+   std::unique_ptr<Slot[]> resized( new Slot[threads] );
+   for( int i = 0; i < slotCount; ++i )
+   {
+      resized[i].next = slots[i].next;
+      resized[i].end = slots[i].end;
+   }
+   slots = std::move( resized );
+   slotCount = threads;
+}
+
+Miner::Result Scheduler::_mine( Block& block, const ByteArray& target, uint32_t firstNonce, uint32_t lastNonce,
+                                const CandidateFn* isSolution )
+{
+   assert( firstNonce <= lastNonce );
+   TRACE_SCOPE( "Scheduler::mine" );
+
+   Search search( block.header, target, firstNonce, lastNonce, isSolution );
+   auto result = Miner::NoSolutionFound;
+
+   // Run until the range is done, starting the threads again after each
+   // change to them
+   do
+   {
+      const int threads = _beginRun();
+      search.resize( threads );
+
+      std::vector<Miner::Result> results( threads, Miner::NoSolutionFound );
+      std::vector<uint32_t> nonces( threads );
+      std::vector<std::thread> workers;
+
+      for( int i = 0; i < threads; ++i )
+      {
+         workers.emplace_back( [&,i]()
+         {
+            TRACE_SCOPE( "Miner::mine", _minerType );
+            _work( i, search, results[i], nonces[i] );
+         } );
+      }
+
+      for( auto& worker : workers )
+      {
+         worker.join();
+      }
+
+      for( int i = 0; i < threads; ++i )
+      {
+         if( results[i] == Miner::SolutionFound )
+         {
+            block.header.nonce = nonces[i];
+            result = Miner::SolutionFound;
+         }
+      }
+   }
+   while( result == Miner::NoSolutionFound && _reconfigure && !_abort );
+
+   _endRun();
+   return result;
+}
+
+void Scheduler::_work( int thread, Search& search, Miner::Result& result, uint32_t& nonce )
+{
+   // Pinned first, so that everything below is allocated on this CPU's node
+   if( !_cpus.empty() )
+   {
+      Topology::pinCurrentThread( _cpus[thread] );
+   }
+
+   if( _miners[thread] == nullptr )
+   {
+      _miners[thread] = Miner::createInstance( _minerType );
+      _miners[thread]->setLiveCounter( _liveCounters[thread] );
+   }
+
+   auto& slot = search.slots[thread];
+   auto& miner = *_miners[thread];
+   Block::Header header = search.header;
+
+   while( !_abort.load(std::memory_order_relaxed) && !_reconfigure.load(std::memory_order_relaxed) )
+   {
+      if( _paused.load(std::memory_order_relaxed) )
+      {
+         _waitWhilePaused();
+         continue;
+      }
+
+      uint64_t step = _stepSize( thread );
+      uint64_t stepStart;
+      uint64_t stepEnd;
+      {
+         std::lock_guard<std::mutex> lock( slot.mutex );
+         stepStart = slot.next;
+         stepEnd = std::min( slot.next + step, slot.end );
+         slot.next = stepEnd;
+      }
+
+      if( stepStart == stepEnd )
+      {
+         // Claim a new chunk, or failing that help whoever has most left
+         uint64_t chunk = step * STEPS_PER_CHUNK;
+         uint64_t start = search.claimed.fetch_add( chunk );
+         if( start < search.rangeSize )
+         {
+            std::lock_guard<std::mutex> lock( slot.mutex );
+            slot.next = start;
+            slot.end = std::min( start + chunk, search.rangeSize );
+            continue;
+         }
+
+         if( !_steal(thread, search) )
+         {
+            break;
+         }
+         continue;
+      }
+
+      auto started = std::chrono::steady_clock::now();
+      auto hashes = miner.hashCount();
+      uint32_t first = search.firstNonce + stepStart;
+      uint32_t last = search.firstNonce + stepEnd - 1;
+      bool solved = false;
+      while( miner.mine(header, search.target, first, last, _abort) == Miner::SolutionFound )
+      {
+         if( _isSolution(search, header) )
+         {
+            solved = true;
+            break;
+         }
+
+         // Only a candidate, so carry on past it
+         if( header.nonce == last )
+         {
+            break;
+         }
+         first = header.nonce + 1;
+      }
+      _hashes.fetch_add( miner.hashCount() - hashes, std::memory_order_relaxed );
+
+      if( solved )
+      {
+         result = Miner::SolutionFound;
+         nonce = header.nonce;
+         abort();
+         return;
+      }
+
+      double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - started ).count();
+      if( seconds > 0 )
+      {
+         double rate = (miner.hashCount() - hashes) / seconds;
+         auto& average = _rates[thread];
+         average = average > 0 ? average + RATE_SMOOTHING * (rate - average) : rate;
+      }
+   }
+}
+
+bool Scheduler::_isSolution( Search& search, const Block::Header& header )
+{
+   if( search.isSolution == nullptr )
+   {
+      return true;
+   }
+
+   std::lock_guard<std::mutex> lock( search.candidateMutex );
+   return (*search.isSolution)( header );
+}
+
+// Take the back half of the unstarted part of another thread's chunk, or
+// all that's left of one whose thread has gone. Returns false if there's
+// nothing worth taking.
+bool Scheduler::_steal( int thread, Search& search )
+{
+   const int threads = _miners.size();
+   auto slots = search.slots.get();
+   for( ;; )
+   {
+      int victim = -1;
+      uint64_t most = 0;
+      for( int i = 0; i < search.slotCount; ++i )
+      {
+         if( i == thread )
+         {
+            continue;
+         }
+
+         std::lock_guard<std::mutex> lock( slots[i].mutex );
+         auto left = slots[i].end - slots[i].next;
+         bool orphaned = i >= threads && left > 0;
+         if( (orphaned || left >= 2 * MIN_STEP) && left > most )
+         {
+            victim = i;
+            most = left;
+         }
+      }
+
+      if( victim < 0 )
+      {
+         return false;
+      }
+
+      uint64_t start;
+      uint64_t end;
+      {
+         std::lock_guard<std::mutex> lock( slots[victim].mutex );
+         auto& target = slots[victim];
+         end = target.end;
+         if( victim >= threads )
+         {
+            start = target.next;
+         }
+         else if( target.end - target.next >= 2 * MIN_STEP )
+         {
+            start = target.next + (end - target.next) / 2;
+         }
+         else
+         {
+            // Its owner got there first; look again
+            continue;
+         }
+         target.end = start;
+      }
+
+      std::lock_guard<std::mutex> lock( slots[thread].mutex );
+      slots[thread].next = start;
+      slots[thread].end = end;
+      return true;
+   }
+}
+
+uint64_t Scheduler::_stepSize( int thread ) const
+{
+   if( _rates[thread] <= 0 )
+   {
+      return INITIAL_STEP;
+   }
+
+   auto step = static_cast<uint64_t>( _rates[thread] * STEP_SECONDS );
+   return std::max( MIN_STEP, std::min(step, MAX_STEP) );
+}
+
+void Scheduler::abort()
+{
+   {
+      // Under the lock, so a paused thread can't miss it
+      std::lock_guard<std::mutex> lock( _controlMutex );
+      _abort = true;
+   }
+   _controlCondition.notify_all();
+}
+
+void Scheduler::enableMetrics()
+{
+   std::lock_guard<std::mutex> lock( _controlMutex );
+   _metrics = true;
+   Metrics::setMinerType( _minerType );
+   Metrics::setThreadCount( _miners.size() );
+   for( unsigned i = 0; i < _miners.size(); ++i )
+   {
+      auto counter = Metrics::threadHashCounter( i );
+      _liveCounters[i] = counter ? &counter->hashes : nullptr;
+      if( _miners[i] != nullptr )
+      {
+         _miners[i]->setLiveCounter( _liveCounters[i] );
+      }
+   }
+}
+
+void Scheduler::setThreadCount( int threadCount )
+{
+   if( threadCount <= 0 )
+   {
+      throw std::runtime_error( "There must be at least one mining thread" );
+   }
+
+   std::lock_guard<std::mutex> lock( _controlMutex );
+   _pendingThreads = threadCount;
+   _changed();
+}
+
+void Scheduler::setMinerType( const std::string& minerType )
+{
+   if( Miner::createInstance(minerType) == nullptr )
+   {
+      throw std::runtime_error( "Miner implementation doesn't exist" );
+   }
+
+   std::lock_guard<std::mutex> lock( _controlMutex );
+   _pendingType = minerType;
+   _changed();
+}
+
+void Scheduler::pause()
+{
+   _paused = true;
+}
+
+void Scheduler::resume()
+{
+   {
+      std::lock_guard<std::mutex> lock( _controlMutex );
+      _paused = false;
+   }
+   _controlCondition.notify_all();
+}
+
+bool Scheduler::paused() const
+{
+   return _paused;
+}
+
+void Scheduler::_waitWhilePaused()
+{
+   std::unique_lock<std::mutex> lock( _controlMutex );
+   _controlCondition.wait( lock, [this]()
+   {
+      return !_paused || _abort || _reconfigure;
+   } );
+}
+
+// Start (or restart) the threads of a mine() call, with any changes made
+// since. Returns how many to start.
+int Scheduler::_beginRun()
+{
+   std::lock_guard<std::mutex> lock( _controlMutex );
+   _mining = true;
+   _reconfigure = false;
+   _applyChanges();
+   return _miners.size();
+}
+
+void Scheduler::_endRun()
+{
+   std::lock_guard<std::mutex> lock( _controlMutex );
+   _mining = false;
+   _abort = false;
+   _reconfigure = false;
+   _applyChanges();
+}
+
+// A change was asked for. Caller holds _controlMutex.
+void Scheduler::_changed()
+{
+   if( _mining )
+   {
+      _reconfigure = true;
+      _controlCondition.notify_all();
+   }
+   else
+   {
+      _applyChanges();
+   }
+}
+
+// Caller holds _controlMutex, and no thread is mining
+void Scheduler::_applyChanges()
+{
+   if( !_pendingType.empty() )
+   {
+      // Each thread creates an instance of the new kernel when it starts
+      _minerType = _pendingType;
+      _pendingType.clear();
+      for( auto& miner : _miners )
+      {
+         miner.reset();
+      }
+
+      if( _metrics )
+      {
+         Metrics::setMinerType( _minerType );
+      }
+   }
+
+   if( _pendingThreads > 0 )
+   {
+      _resize( _pendingThreads );
+      _pendingThreads = 0;
+   }
+}
+
+void Scheduler::_resize( int threadCount )
+{
+   const int previous = _miners.size();
+
+   std::vector<int> cpus;
+   if( _pinned )
+   {
+      cpus = Topology::host().placement( threadCount );
+
+      // A thread that moves creates a new kernel instance on its new CPU's node
+      for( int i = 0; i < std::min(previous, threadCount); ++i )
+      {
+         if( cpus[i] != _cpus[i] )
+         {
+            _miners[i].reset();
+         }
+      }
+   }
+
+   _cpus = cpus;
+   _miners.resize( threadCount );
+   _rates.resize( threadCount, 0.0 );
+   _liveCounters.resize( threadCount, nullptr );
+
+   if( _metrics )
+   {
+      Metrics::setThreadCount( threadCount );
+      for( int i = previous; i < threadCount; ++i )
+      {
+         auto counter = Metrics::threadHashCounter( i );
+         _liveCounters[i] = counter ? &counter->hashes : nullptr;
+      }
+   }
+}
+
+std::string Scheduler::minerType() const
+{
+   std::lock_guard<std::mutex> lock( _controlMutex );
+   return _minerType;
+}
+
+int Scheduler::threadCount() const
+{
+   std::lock_guard<std::mutex> lock( _controlMutex );
+   return _miners.size();
+}
+
+uint64_t Scheduler::hashCount( int thread ) const
+{
+   return _miners[thread] != nullptr ? _miners[thread]->hashCount() : 0;
+}
+
+uint64_t Scheduler::hashCount() const
+{
+   return _hashes;
+}
+
+const std::vector<int>& Scheduler::placement() const
+{
+   return _cpus;
+}
+
+std::string Scheduler::placementSummary() const
+{
+   std::ostringstream summary;
+   summary << _miners.size() << (_miners.size() == 1 ? " mining thread" : " mining threads");
+   if( _cpus.empty() )
+   {
+      summary << ", not pinned";
+      return summary.str();
+   }
+
+   auto& topology = Topology::host();
+   std::set<std::pair<int,int>> cores;
+   std::set<int> nodes;
+   std::set<int> cpus( _cpus.begin(), _cpus.end() );
+   for( auto& cpu : topology.cpus() )
+   {
+      if( cpus.count(cpu.id) != 0 )
+      {
+         cores.insert( std::make_pair(cpu.package, cpu.core) );
+         nodes.insert( cpu.node );
+      }
+   }
+
+   summary << " pinned to CPUs";
+   for( size_t i = 0; i < _cpus.size(); ++i )
+   {
+      summary << (i == 0 ? " " : ",") << _cpus[i];
+   }
+   summary << " (" << cores.size() << " of " << topology.physicalCoreCount() << " cores, "
+           << nodes.size() << " of " << topology.nodeCount() << " NUMA nodes)";
+   return summary.str();
+}
+
+void Scheduler::setPinning( bool enabled )
+{
+   _pinning = enabled;
+}
@@ -0,0 +1,182 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "Miner.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Runs a set of mining threads, each with its own instance of a Miner kernel,
+ * over a shared block header. The first thread to find a solution stops the
+ * others.
+ *
+ * The nonce range is handed out in chunks from a shared atomic counter, each
+ * sized from its thread's measured hash rate, so fast cores take more of it
+ * than slow or throttled ones. A thread works through its chunk a step at a
+ * time, and one that finds the counter exhausted steals the back half of
+ * whichever chunk has the most left. A sweep of the range then takes about
+ * as long as the combined hash rate needs, rather than the slowest core.
+ *
+ * Unless pinning is disabled, each thread is pinned to its own logical CPU
+ * (see Topology::placement) before it creates its kernel instance, so that
+ * the instance and the thread's copy of the header are allocated on its
+ * own NUMA node.
+ *
+ * The thread count and kernel can be changed, and mining paused, from another
+ * thread while mine() runs. Threads see it at their next step boundary; the
+ * search then carries on over what's left of the same range, with the new
+ * threads taking over the chunks of those that went.
+ */
+class Scheduler
+{
+public:
+   /*
+    * Called from a mining thread with each header whose hash meets the
+    * target given to mine(). Returns true if it solves the block, which ends
+    * the search; otherwise the search carries on past it. Calls are
+    * serialized.
+    */
+   typedef std::function<bool(const Block::Header&)> CandidateFn;
+
+public:
+   Scheduler( const std::string& minerType, int threadCount );
+
+   Miner::Result mine( Block& block );
+   Miner::Result mine( Block& block, uint32_t firstNonce, uint32_t lastNonce );
+
+   /*
+    * Search the whole nonce range against an easier target than the block's
+    * own, passing every header that meets it to isSolution.
+    */
+   Miner::Result mine( Block& block, const ByteArray& target, const CandidateFn& isSolution );
+
+   /*
+    * Stop a mine() call in progress (from another thread). The workers return
+    * at their next chunk boundary.
+    */
+   void abort();
+
+   /*
+    * Publish each thread's hash count through Metrics.
+    */
+   void enableMetrics();
+
+   /*
+    * Change the number of threads, or the kernel they run (which must
+    * exist), from any thread: at once if not mining, otherwise at the next
+    * step boundary.
+    */
+   void setThreadCount( int threadCount );
+   void setMinerType( const std::string& minerType );
+
+   /*
+    * Stop hashing at the next step boundary, keeping the search, until
+    * resumed. A paused mine() still returns when aborted.
+    */
+   void pause();
+   void resume();
+   bool paused() const;
+
+   std::string minerType() const;
+   int threadCount() const;
+   uint64_t hashCount( int thread ) const;
+
+   /*
+    * Nonces tried by every thread so far, including those since removed,
+    * and whichever kernel they ran.
+    */
+   uint64_t hashCount() const;
+
+   /*
+    * The logical CPU each thread is pinned to, or empty if they aren't.
+    */
+   const std::vector<int>& placement() const;
+
+   /*
+    * One line describing the placement, for the log.
+    */
+   std::string placementSummary() const;
+
+   /*
+    * Whether schedulers created from now on pin their threads (the default).
+    */
+   static void setPinning( bool enabled );
+
+private:
+   // What's left of the chunk a thread is working through, as offsets into
+   // the range being mined. Shrunk from the back by thieves.
+   struct Slot
+   {
+      Slot();
+
+      std::mutex  mutex;
+      uint64_t    next;
+      uint64_t    end;
+   };
+
+   // Everything the threads of one mine() call share
+   struct Search
+   {
+      Search( const Block::Header& header, const ByteArray& target, uint32_t firstNonce, uint32_t lastNonce,
+              const CandidateFn* isSolution );
+
+      // Make room for this many threads, keeping every chunk. Slots beyond
+      // the thread count belong to threads that have gone.
+      void resize( int threads );
+
+      const Block::Header&       header;
+      const ByteArray&           target;
+      uint32_t                   firstNonce;
+      uint64_t                   rangeSize;
+      const CandidateFn*         isSolution;    // Null if every candidate is a solution
+      std::atomic<uint64_t>      claimed;
+      std::unique_ptr<Slot[]>    slots;
+      int                        slotCount;
+      std::mutex                 candidateMutex;
+   };
+
+   Miner::Result _mine( Block& block, const ByteArray& target, uint32_t firstNonce, uint32_t lastNonce,
+                        const CandidateFn* isSolution );
+   void _work( int thread, Search& search, Miner::Result& result, uint32_t& nonce );
+   bool _isSolution( Search& search, const Block::Header& header );
+   bool _steal( int thread, Search& search );
+   uint64_t _stepSize( int thread ) const;
+   void _waitWhilePaused();
+   int _beginRun();
+   void _endRun();
+   void _changed();
+   void _applyChanges();
+   void _resize( int threadCount );
+
+private:
+   std::string                          _minerType;
+   std::vector<MinerPtr>                _miners;    // Created by their own threads
+   std::vector<std::atomic<uint64_t>*>  _liveCounters;
+   std::vector<double>                  _rates;     // Hashes per second, kept across calls
+   std::vector<int>                     _cpus;
+   bool                                 _pinned;
+   bool                                 _metrics;
+   std::atomic<bool>                    _abort;
+   std::atomic<uint64_t>                _hashes;
+
+   // Runtime control. The configuration above only changes under the mutex,
+   // and never while threads are mining.
+   mutable std::mutex                   _controlMutex;
+   std::condition_variable              _controlCondition;
+   bool                                 _mining;
+   int                                  _pendingThreads;  // 0 if unchanged
+   std::string                          _pendingType;     // Empty if unchanged
+   std::atomic<bool>                    _reconfigure;     // Threads must stop for a change
+   std::atomic<bool>                    _paused;
+};
+
+#endif // !SCHEDULER_H
@@ -4,7 +4,137 @@
 
 #include "Script.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+static_assert( sizeof(Script) == 128, "Script should fill two cache lines" );
+
+Script::Script( Arena* arena )
+ : _size(0),
+   _capacity(INLINE_CAPACITY),
+   _arena(arena)
+{
+}
+
+Script::Script( const Script& other )
+ : _size(0),
+   _capacity(INLINE_CAPACITY),
+   _arena(nullptr)
+{
+   assign( other.begin(), other.end() );
+}
+
+Script::Script( Script&& other ) noexcept
+ : _size(0),
+   _capacity(INLINE_CAPACITY),
+   _arena(nullptr)
+{
+   _steal( other );
+}
+
+Script::~Script()
+{
+   _release();
+}
+
+// Keeps this script's arena, as a vector's copy assignment keeps its allocator
+Script& Script::operator =( const Script& other )
+{
+   if( this != &other )
+   {
+      assign( other.begin(), other.end() );
+   }
+   return *this;
+}
+
+Script& Script::operator =( Script&& other ) noexcept
+{
+   if( this != &other )
+   {
+      _release();
+      _steal( other );
+   }
+   return *this;
+}
+
+void Script::reserve( size_t capacity )
+{
+   if( capacity <= _capacity )
+   {
+      return;
+   }
+
+   auto spill = static_cast<uint8_t*>( _arena != nullptr ? _arena->allocate( capacity, 1 ) : ::operator new( capacity ) );
+   std::memcpy( spill, data(), _size );
+   auto size = _size;
+   _release();
+   _heap = spill;
+   _size = size;
+   _capacity = capacity;
+}
+
+void Script::resize( size_t size, uint8_t value )
+{
+   reserve( size );
+   if( size > _size )
+   {
+      std::memset( data() + _size, value, size - _size );
+   }
+   _size = size;
+}
+
+void Script::clear()
+{
+   _size = 0;
+}
+
+void Script::push_back( uint8_t byte )
+{
+   if( _size == _capacity )
+   {
+      reserve( 2 * _capacity );
+   }
+   data()[_size++] = byte;
+}
+
+Arena* Script::arena() const
+{
+   return _arena;
+}
+
+// Free the spilled storage, if any (arena memory is the arena's to free),
+// leaving the script empty and inline
+void Script::_release()
+{
+   if( !_isInline() && _arena == nullptr )
+   {
+      ::operator delete( _heap );
+   }
+   _size = 0;
+   _capacity = INLINE_CAPACITY;
+}
+
+// Take the other script's storage and arena, leaving it empty. This one must
+// be empty and inline.
+void Script::_steal( Script& other )
+{
+   _arena = other._arena;
+   _size = other._size;
+   _capacity = other._capacity;
+   if( other._isInline() )
+   {
+      std::memcpy( _inline, other._inline, other._size );
+   }
+   else
+   {
+      _heap = other._heap;
+   }
+
+   other._size = 0;
+   other._capacity = INLINE_CAPACITY;
+}
 
 Script::Data::Data( int64_t value )
 {
@@ -49,9 +179,36 @@ Script& Script::operator <<( uint8_t byte )
    return *this;
 }
 
-Script Script::deserialize( const std::string& serialized )
+Script Script::deserialize( const std::string& serialized, Arena* arena )
+{
+   Script script( arena );
+   script.resize( serialized.size() / 2 );
+   if( !Hex::decode(serialized.data(), serialized.size(), script.data()) )
+      throw std::runtime_error( "Invalid script" );
+
+   return script;
+}
+
+Script Script::deserialize( std::istream& serialStream, size_t size, Arena* arena )
 {
-   Script script;
-   static_cast<ByteArray&>(script) = hexStringToBinary( serialized );
+   Script script( arena );
+   script.resize( size );
+
+   // Decode through a small buffer rather than copying the hex into a string
+   const size_t BLOCK_SIZE = 512;
+   char hex[BLOCK_SIZE * 2];
+   for( size_t offset = 0; offset < size; offset += BLOCK_SIZE )
+   {
+      auto count = std::min( BLOCK_SIZE, size - offset );
+      if( !serialStream.read(hex, count * 2) || !Hex::decode(hex, count * 2, script.data() + offset) )
+         throw std::runtime_error( "Invalid script" );
+   }
+
    return script;
 }
+
+std::ostream& operator <<( std::ostream& outputStream, const Script& script )
+{
+   writeHex( outputStream, script.data(), script.size() );
+   return outputStream;
+}
@@ -4,19 +4,81 @@
 #ifndef SCRIPT_H
 #define SCRIPT_H
 
+#include "Arena.h"
 #include "Util.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <iterator>
+#include <ostream>
+
 enum OpCode
 {
+   OP_RETURN         = 106,
    OP_DUP            = 118,
    OP_EQUALVERIFY    = 136,
    OP_HASH160        = 169,
    OP_CHECKSIG       = 172
 };
 
-class Script : public ByteArray
+/*
+ * Script bytes, stored inline up to INLINE_CAPACITY bytes, which covers
+ * every standard output script, P2PKH input scripts and witness items, so
+ * most scripts need no allocation at all. Larger ones spill to the owning
+ * template's arena when there is one, or the heap.
+ *
+ * Like a vector with an ArenaAllocator, a copy is always made on the heap,
+ * since it may outlive the arena, while moves keep the arena.
+ */
+class Script
 {
 public:
+   typedef uint8_t         value_type;
+   typedef uint8_t*        iterator;
+   typedef const uint8_t*  const_iterator;
+
+   // Keeps the whole object to two cache lines
+   static const size_t INLINE_CAPACITY = 112;
+
+public:
+   Script( Arena* arena = nullptr );
+   Script( const Script& other );
+   Script( Script&& other ) noexcept;
+   ~Script();
+
+   Script& operator =( const Script& other );
+   Script& operator =( Script&& other ) noexcept;
+
+   size_t size() const              { return _size; }
+   bool empty() const               { return _size == 0; }
+   size_t capacity() const          { return _capacity; }
+
+   uint8_t* data()                  { return _isInline() ? _inline : _heap; }
+   const uint8_t* data() const      { return _isInline() ? _inline : _heap; }
+   iterator begin()                 { return data(); }
+   iterator end()                   { return data() + _size; }
+   const_iterator begin() const     { return data(); }
+   const_iterator end() const       { return data() + _size; }
+
+   uint8_t& operator []( size_t index )               { return data()[index]; }
+   const uint8_t& operator []( size_t index ) const   { return data()[index]; }
+
+   void reserve( size_t capacity );
+   void resize( size_t size, uint8_t value = 0 );
+   void clear();
+   void push_back( uint8_t byte );
+
+   template<typename InputIt>
+   void assign( InputIt first, InputIt last )
+   {
+      resize( std::distance(first, last) );
+      std::copy( first, last, begin() );
+   }
+
+   Arena* arena() const;
+
    class Data
    {
       friend class Script;
@@ -35,7 +97,29 @@ public:
    Script& operator <<( const Data& data );
    Script& operator <<( uint8_t byte );
 
-   static Script deserialize( const std::string& serialized );
+   static Script deserialize( const std::string& serialized, Arena* arena = nullptr );
+
+   /*
+    * Read a script of the given size (in bytes) from a stream of hex.
+    */
+   static Script deserialize( std::istream& serialStream, size_t size, Arena* arena = nullptr );
+
+private:
+   bool _isInline() const           { return _capacity == INLINE_CAPACITY; }
+   void _release();
+   void _steal( Script& other );
+
+private:
+   union
+   {
+      uint8_t*    _heap;
+      uint8_t     _inline[INLINE_CAPACITY];
+   };
+   uint32_t       _size;
+   uint32_t       _capacity;
+   Arena*         _arena;
 };
 
+std::ostream& operator <<( std::ostream& outputStream, const Script& script );
+
 #endif // !SCRIPT_H
@@ -0,0 +1,519 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "SelfTest.h"
+#include "Miner.h"
+#include "Hex.h"
+#include "Radix.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <atomic>
+#include <sstream>
+#include <random>
+#include <limits>
+
+// Number of nonces on either side of the known answer to search
+const uint32_t KNOWN_ANSWER_WINDOW = 2048;
+
+// Number of random headers, and nonces per header, to compare against the
+// reference
+const int DIFFERENTIAL_HEADERS = 8;
+const uint32_t DIFFERENTIAL_RANGE = 2048;
+
+struct Sha256Vector
+{
+   const char* message;
+   int         repeat;
+   const char* digest;
+};
+
+// From FIPS 180-2 appendix B and the NIST example values
+static const Sha256Vector SHA256_VECTORS[] = {
+   { "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+   { "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+   { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+   { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+     "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+   { "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" }
+};
+
+struct Base58Vector
+{
+   const char* payload;
+   const char* encoded;
+};
+
+// Base58check encodings, including the genesis block's coinbase address and
+// payloads with leading zeros, which are encoded as leading 1s
+static const Base58Vector BASE58_VECTORS[] = {
+   { "0062e907b15cbf27d5425399ebf6f0fb50ebb88f18", "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa" },
+   { "05ffffffffffffffffffffffffffffffffffffffff", "3R2cuenjG5nFubqX9Wzuukdin2YfBbQ6Kw" },
+   { "", "3QJmnh" },
+   { "00", "1Wh4bh" },
+   { "0000000001", "11119Mw9P8" },
+   { "000000000000000000000000000000000000000000", "1111111111111111111114oLvT2" }
+};
+
+// Strings that must fail to decode
+static const char* const BAD_BASE58[] = {
+   "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNb",  // Check code
+   "0A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa",  // Not in the alphabet
+   "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNI",
+   "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfN ",
+   "",                                    // No room for a check code
+   "1Wh4b"
+};
+
+struct KnownHeader
+{
+   uint32_t    version;
+   const char* prevBlock;
+   const char* merkleRoot;
+   uint32_t    time;
+   uint32_t    bits;
+   uint32_t    nonce;
+   const char* hash;
+};
+
+// The first blocks of the main chain. Hashes are in the usual display order.
+static const KnownHeader KNOWN_HEADERS[] = {
+   {
+      1,
+      "0000000000000000000000000000000000000000000000000000000000000000",
+      "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b",
+      1231006505, 0x1d00ffff, 2083236893,
+      "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f"
+   },
+   {
+      1,
+      "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f",
+      "0e3e2357e806b6cdb1f70b54c3a3a17b6714ee1f0e68bebb44a74b1efd512098",
+      1231469665, 0x1d00ffff, 2573394689,
+      "00000000839a8e6886ab5951d76f411475428afc90947ee320161bbf18eb6048"
+   },
+   {
+      1,
+      "00000000839a8e6886ab5951d76f411475428afc90947ee320161bbf18eb6048",
+      "9b0fc92260312ce44e74ef369f5c66bbb85848f2eddd5a7a1cde251e54ccfdd5",
+      1231469744, 0x1d00ffff, 1639830024,
+      "000000006a625f06636b8bb6ac7b960a8d03705d1ace08b1a19da3fdcc99ddbd"
+   }
+};
+
+// Convert a hash in display order to its raw (internal) byte order
+static ByteArray rawHash( const char* displayHash )
+{
+   auto hash = hexStringToBinary( displayHash );
+   std::reverse( hash.begin(), hash.end() );
+   return hash;
+}
+
+static std::string toHex( const ByteArray& data )
+{
+   std::ostringstream stream;
+   stream << data;
+   return stream.str();
+}
+
+// The scalar reference: is the header's hash at most the (big-endian) target?
+static bool referenceMeetsTarget( const Block::Header& header, const ByteArray& target )
+{
+   auto hash = Sha256::doubleHash( &header, sizeof(header) );
+   ByteArray bigEndianHash( hash.rbegin(), hash.rend() );
+   return !std::lexicographical_compare( target.begin(), target.end(),
+                                         bigEndianHash.begin(), bigEndianHash.end() );
+}
+
+static std::vector<uint32_t> referenceWinners( Block::Header header,
+                                               const ByteArray& target,
+                                               uint32_t firstNonce,
+                                               uint32_t lastNonce )
+{
+   std::vector<uint32_t> winners;
+   for( uint64_t nonce = firstNonce; nonce <= lastNonce; ++nonce )
+   {
+      header.nonce = nonce;
+      if( referenceMeetsTarget(header, target) )
+      {
+         winners.push_back( nonce );
+      }
+   }
+   return winners;
+}
+
+// Collect every solution in the range by restarting the kernel after each one
+static std::vector<uint32_t> kernelWinners( Miner& miner,
+                                            const Block::Header& header,
+                                            const ByteArray& target,
+                                            uint32_t firstNonce,
+                                            uint32_t lastNonce )
+{
+   std::atomic<bool> abort( false );
+   std::vector<uint32_t> winners;
+
+   uint32_t nonce = firstNonce;
+   for( ;; )
+   {
+      auto candidate = header;
+      if( miner.mine(candidate, target, nonce, lastNonce, abort) != Miner::SolutionFound )
+      {
+         break;
+      }
+
+      winners.push_back( candidate.nonce );
+      if( candidate.nonce == lastNonce )
+      {
+         break;
+      }
+      nonce = candidate.nonce + 1;
+   }
+
+   return winners;
+}
+
+// Subtract one from a big-endian number
+static void decrement( ByteArray& number )
+{
+   for( auto it = number.rbegin(); it != number.rend(); ++it )
+   {
+      if( (*it)-- != 0 )
+      {
+         break;
+      }
+   }
+}
+
+static Block::Header makeHeader( const KnownHeader& known )
+{
+   Block::Header header;
+   header.version = known.version;
+   auto prevBlock = rawHash( known.prevBlock );
+   std::copy( prevBlock.begin(), prevBlock.end(), header.prevBlock.begin() );
+   auto merkleRoot = rawHash( known.merkleRoot );
+   std::copy( merkleRoot.begin(), merkleRoot.end(), header.merkleRoot.begin() );
+   header.time = known.time;
+   header.bits = known.bits;
+   header.nonce = known.nonce;
+   return header;
+}
+
+void SelfTest::verifySha256()
+{
+   for( auto& vector : SHA256_VECTORS )
+   {
+      std::string message;
+      for( int i = 0; i < vector.repeat; ++i )
+      {
+         message += vector.message;
+      }
+
+      auto digest = toHex( Sha256::hash(message.data(), message.size()) );
+      if( digest != vector.digest )
+      {
+         throw std::runtime_error( std::string("SHA-256 mismatch for \"") + vector.message + "\" x"
+                                   + std::to_string(vector.repeat) + ": got " + digest );
+      }
+   }
+
+   // Lengths around the padding and block boundaries, fed in uneven pieces
+   std::string message;
+   for( int length = 0; length <= 3 * 64; ++length )
+   {
+      auto expected = Sha256::hash( message.data(), message.size() );
+
+      Sha256 hash;
+      Sha256::Digest digest;
+      for( int start = 0, piece = 1; start < length; start += piece, piece = piece * 2 + 1 )
+      {
+         piece = std::min( piece, length - start );
+         hash.update( message.data() + start, piece * CHAR_BIT );
+      }
+      hash.digest( digest );
+
+      if( digest.toByteArray() != expected )
+      {
+         throw std::runtime_error( "SHA-256 incremental update mismatch at length " + std::to_string(length) );
+      }
+
+      message.push_back( 'a' + length % 26 );
+   }
+}
+
+void SelfTest::verifyHex()
+{
+   std::mt19937 random( 1 );
+   const Hex::Implementation implementations[] = { Hex::Sse41, Hex::Avx2 };
+
+   for( size_t size = 0; size <= 3 * 32 + 1; ++size )
+   {
+      ByteArray data( size );
+      for( auto& byte : data )
+      {
+         byte = random();
+      }
+
+      std::string expected( size * 2, '\0' );
+      Hex::encode( data.data(), size, &expected[0], Hex::Scalar );
+
+      for( auto impl : implementations )
+      {
+         auto failure = std::string( "Hex " ) + Hex::name( impl ) + " mismatch at length " + std::to_string( size );
+
+         std::string hex( size * 2, '\0' );
+         Hex::encode( data.data(), size, &hex[0], impl );
+         if( hex != expected )
+         {
+            throw std::runtime_error( failure + " (encode)" );
+         }
+
+         // Mixed case decodes the same
+         for( size_t i = 0; i < hex.size(); i += 3 )
+         {
+            hex[i] = toupper( hex[i] );
+         }
+         ByteArray decoded( size );
+         if( !Hex::decode(hex.data(), hex.size(), decoded.data(), impl) || decoded != data )
+         {
+            throw std::runtime_error( failure + " (decode)" );
+         }
+
+         for( size_t i = 0; i < hex.size(); ++i )
+         {
+            for( char bad : { '/', ':', '@', 'G', '`', 'g', ' ', '\x80' } )
+            {
+               auto corrupt = hex;
+               corrupt[i] = bad;
+               if( Hex::decode(corrupt.data(), corrupt.size(), decoded.data(), impl) )
+               {
+                  throw std::runtime_error( failure + " (accepted '" + bad + "' at " + std::to_string(i) + ")" );
+               }
+            }
+         }
+      }
+   }
+}
+
+void SelfTest::verifyBase58()
+{
+   for( auto& vector : BASE58_VECTORS )
+   {
+      auto payload = hexStringToBinary( vector.payload );
+      if( Radix::base58EncodeCheck(payload) != vector.encoded )
+      {
+         throw std::runtime_error( std::string("Base58 encode mismatch for ") + vector.encoded );
+      }
+      if( Radix::base58DecodeCheck(vector.encoded) != payload )
+      {
+         throw std::runtime_error( std::string("Base58 decode mismatch for ") + vector.encoded );
+      }
+   }
+
+   std::vector<std::string> bad( std::begin(BAD_BASE58), std::end(BAD_BASE58) );
+   bad.push_back( std::string(177, '2') );    // More digits than are taken
+   bad.push_back( std::string(176, 'z') );    // More bytes than are taken
+   auto results = Radix::base58DecodeCheck( bad );
+   for( size_t i = 0; i < bad.size(); ++i )
+   {
+      bool threw = false;
+      try
+      {
+         Radix::base58DecodeCheck( bad[i] );
+      }
+      catch( std::runtime_error& )
+      {
+         threw = true;
+      }
+
+      if( !threw || results[i].valid )
+      {
+         throw std::runtime_error( "Base58 accepted \"" + bad[i].substr(0, 40) + "\"" );
+      }
+   }
+
+   // Round trips, one at a time and batched, with up to 3 leading zeros
+   std::mt19937 random( 1 );
+   std::vector<ByteArray> payloads;
+   for( size_t size = 0; size <= 64; ++size )
+   {
+      ByteArray payload( size );
+      for( size_t i = 0; i < size; ++i )
+      {
+         payload[i] = i < size % 4 ? 0 : random();
+      }
+      payloads.push_back( payload );
+   }
+
+   auto encoded = Radix::base58EncodeCheck( payloads );
+   auto decoded = Radix::base58DecodeCheck( encoded );
+   for( size_t i = 0; i < payloads.size(); ++i )
+   {
+      auto failure = "Base58 round trip failed at length " + std::to_string( payloads[i].size() );
+      if( encoded[i] != Radix::base58EncodeCheck(payloads[i]) )
+      {
+         throw std::runtime_error( failure + " (batch encode)" );
+      }
+      if( !decoded[i].valid || decoded[i].payload != payloads[i] )
+      {
+         throw std::runtime_error( failure + " (batch decode)" );
+      }
+      if( Radix::base58DecodeCheck(encoded[i]) != payloads[i] )
+      {
+         throw std::runtime_error( failure );
+      }
+   }
+}
+
+void SelfTest::verifyMiner( const std::string& minerType )
+{
+   auto miner = Miner::createInstance( minerType );
+   if( miner == nullptr )
+   {
+      throw std::runtime_error( "Miner implementation doesn't exist" );
+   }
+
+   std::atomic<bool> abort( false );
+
+   for( auto& known : KNOWN_HEADERS )
+   {
+      auto header = makeHeader( known );
+
+      // Make sure the test vector itself is sane
+      if( Sha256::doubleHash(&header, sizeof(header)) != rawHash(known.hash) )
+      {
+         throw std::runtime_error( std::string("reference hash mismatch for block ") + known.hash );
+      }
+
+      auto result = miner->mine( header,
+                                 known.nonce - KNOWN_ANSWER_WINDOW,
+                                 known.nonce + KNOWN_ANSWER_WINDOW,
+                                 abort );
+      if( result != Miner::SolutionFound || header.nonce != known.nonce )
+      {
+         std::ostringstream error;
+         error << "kernel \"" << minerType << "\" missed the solution for block " << known.hash;
+         throw std::runtime_error( error.str() );
+      }
+
+      // Nothing else in the window should be a solution
+      result = miner->mine( header, known.nonce + 1, known.nonce + KNOWN_ANSWER_WINDOW, abort );
+      if( result == Miner::SolutionFound )
+      {
+         std::ostringstream error;
+         error << "kernel \"" << minerType << "\" found a false solution for block " << known.hash;
+         throw std::runtime_error( error.str() );
+      }
+   }
+
+   // Compare winning nonces with the reference on random headers. The seed is
+   // reported so failures can be reproduced.
+   auto seed = std::random_device()();
+   std::mt19937 rng( seed );
+
+   for( int i = 0; i < DIFFERENTIAL_HEADERS; ++i )
+   {
+      Block::Header header;
+      auto headerBytes = reinterpret_cast<uint8_t*>( &header );
+      for( unsigned j = 0; j < sizeof(header); ++j )
+      {
+         headerBytes[j] = rng();
+      }
+
+      // The last header's range ends at the top of the nonce space
+      uint32_t firstNonce = rng() % (std::numeric_limits<uint32_t>::max() - DIFFERENTIAL_RANGE);
+      if( i == DIFFERENTIAL_HEADERS - 1 )
+      {
+         firstNonce = std::numeric_limits<uint32_t>::max() - DIFFERENTIAL_RANGE + 1;
+      }
+      uint32_t lastNonce = firstNonce + DIFFERENTIAL_RANGE - 1;
+
+      std::vector<ByteArray> targets;
+
+      // Easy target, hit about once every 64 nonces
+      ByteArray easyTarget( sizeof(Sha256::Digest) );
+      for( auto& byte : easyTarget )
+      {
+         byte = rng();
+      }
+      easyTarget[0] = 0x03;
+      targets.push_back( easyTarget );
+
+      // Exactly the hash of a nonce in the range, and one less than it
+      auto planted = header;
+      planted.nonce = firstNonce + rng() % DIFFERENTIAL_RANGE;
+      auto plantedHash = Sha256::doubleHash( &planted, sizeof(planted) );
+      ByteArray exactTarget( plantedHash.rbegin(), plantedHash.rend() );
+      targets.push_back( exactTarget );
+      decrement( exactTarget );
+      targets.push_back( exactTarget );
+
+      for( auto& target : targets )
+      {
+         if( kernelWinners(*miner, header, target, firstNonce, lastNonce)
+             != referenceWinners(header, target, firstNonce, lastNonce) )
+         {
+            std::ostringstream error;
+            error << "kernel \"" << minerType << "\" disagrees with the reference for target "
+                  << target << " (seed " << std::dec << seed << ")";
+            throw std::runtime_error( error.str() );
+         }
+      }
+   }
+}
+
+bool SelfTest::runAll( std::ostream& log )
+{
+   bool passed = true;
+
+   try
+   {
+      verifySha256();
+      log << "SHA-256: passed" << std::endl;
+   }
+   catch( std::exception& e )
+   {
+      log << "SHA-256: FAILED: " << e.what() << std::endl;
+      passed = false;
+   }
+
+   try
+   {
+      verifyHex();
+      log << "Hex codec (" << Hex::name(Hex::Best) << "): passed" << std::endl;
+   }
+   catch( std::exception& e )
+   {
+      log << "Hex codec: FAILED: " << e.what() << std::endl;
+      passed = false;
+   }
+
+   try
+   {
+      verifyBase58();
+      log << "Base58 codec: passed" << std::endl;
+   }
+   catch( std::exception& e )
+   {
+      log << "Base58 codec: FAILED: " << e.what() << std::endl;
+      passed = false;
+   }
+
+   for( auto& type : Miner::types() )
+   {
+      try
+      {
+         verifyMiner( type );
+         log << "Kernel \"" << type << "\": passed" << std::endl;
+      }
+      catch( std::exception& e )
+      {
+         log << "Kernel \"" << type << "\": FAILED: " << e.what() << std::endl;
+         passed = false;
+      }
+   }
+
+   return passed;
+}
@@ -0,0 +1,57 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef SELF_TEST_H
+#define SELF_TEST_H
+
+#include <ostream>
+#include <string>
+
+/*
+ * Runtime conformance checks for the hashing and serialization code. Code
+ * that fails any of these must not be used for mining or submission.
+ */
+class SelfTest
+{
+public:
+   /*
+    * Check Sha256 against the NIST known-answer vectors, and check that
+    * hashing a message in pieces matches hashing it in one go.
+    */
+   static void verifySha256();
+
+   /*
+    * Check every hex codec implementation the CPU supports against the scalar
+    * one, over random data of lengths either side of the vector widths, and
+    * check that each rejects a bad character at every position.
+    */
+   static void verifyHex();
+
+   /*
+    * Check base58check encoding and decoding against known vectors
+    * (including leading zeros), check that bad characters, check codes and
+    * lengths are rejected, and check that random payloads round trip, one
+    * at a time and batched.
+    */
+   static void verifyBase58();
+
+   /*
+    * Check a kernel:
+    *  - against real block headers with known hashes: each must be found at
+    *    exactly its known nonce, and nowhere else nearby;
+    *  - against the scalar reference (Sha256::doubleHash), over random
+    *    headers with planted targets (easy ones, and ones exactly equal to or
+    *    just below a hash in the range): the kernel must report exactly the
+    *    same winning nonces.
+    * Throws std::runtime_error describing the first failure.
+    */
+   static void verifyMiner( const std::string& minerType );
+
+   /*
+    * Run every check on every registered kernel, logging the outcome of each.
+    * Returns false if anything failed.
+    */
+   static bool runAll( std::ostream& log );
+};
+
+#endif // !SELF_TEST_H
@@ -4,6 +4,7 @@
 
 #include "Settings.h"
 #include "Miner.h"
+#include "Autotune.h"
 
 #include <boost/program_options.hpp>
 
@@ -11,6 +12,8 @@
 #include <fstream>
 #include <cassert>
 #include <iostream>
+#include <thread>
+#include <algorithm>
 
 using namespace std;
 namespace BoostProgOpt = boost::program_options;
@@ -22,6 +25,25 @@ static BoostProgOpt::variables_map _varMap;
 #define OPT_CONFIG   "config"
 #define OPT_TYPE     "type"
 #define OPT_BLOCKS   "blocks"
+#define OPT_THREADS  "threads"
+#define OPT_TUNECACHE "tunecache"
+#define OPT_SELFTEST  "selftest"
+#define OPT_TXCACHE   "txcache"
+#define OPT_ASSEMBLE  "assemble"
+#define OPT_NOPIN     "nopin"
+#define OPT_AUXCHAIN  "auxchain"
+#define OPT_P2PNODE   "p2pnode"
+
+#define OPT_TRACE          "trace"
+#define OPT_METRICSPORT    "metricsport"
+#define OPT_METRICSADDRESS "metricsaddress"
+#define OPT_SHAREDIFFICULTY "sharedifficulty"
+#define OPT_SHARELOG       "sharelog"
+#define OPT_CONTROLSOCKET  "controlsocket"
+
+#define OPT_BENCHMARK   "benchmark"
+#define OPT_DURATION    "duration"
+#define OPT_HASHES      "hashes"
 
 #define OPT_RPCHOST     "rpchost"
 #define OPT_RPCPORT     "rpcport"
@@ -36,7 +58,41 @@ void Settings::init( int argc, char** argv )
       (OPT_DEBUG",d",   "Show debug output.")
       (OPT_CONFIG",c",  BoostProgOpt::value<string>()->default_value(defaultConfigFile()), "Bitcoin Core configuration file to load.")
       (OPT_TYPE",t",    BoostProgOpt::value<string>()->default_value("cpu"), typeHelpText().c_str())
+      (OPT_SELFTEST,    "Check SHA-256 and every kernel against known answers and the reference implementation, then exit.")
       (OPT_BLOCKS",n",  BoostProgOpt::value<int>()->default_value(0), "Number of blocks to mine (0 = unlimited).")
+      (OPT_THREADS",j", BoostProgOpt::value<int>()->default_value(0), "Number of mining threads (0 = one per CPU).")
+      (OPT_NOPIN,       "Don't pin mining threads to CPUs. By default each thread gets its own physical core, spread over the NUMA nodes, "
+                        "before any core gets a second thread.")
+      (OPT_TUNECACHE,   BoostProgOpt::value<string>()->default_value(""), "File in which to cache the --" OPT_TYPE " " AUTOTUNE_MINER_TYPE " result for each CPU model.")
+      (OPT_ASSEMBLE,    "Build templates locally from the node's mempool, checking each with a getblocktemplate proposal. "
+                        "getblocktemplate is still used when the chain tip moves to a block found elsewhere, or a proposal is rejected.")
+      (OPT_TXCACHE,     BoostProgOpt::value<int>()->default_value(50000), "Number of template transactions to remember between templates, so they aren't hashed again (0 = disabled).")
+      (OPT_AUXCHAIN,    BoostProgOpt::value<vector<string>>()->composing(),
+                        "Merge mine an auxiliary (AuxPoW) chain, given as [user:password@]host:port[/address]. May be repeated. "
+                        "With an address, aux blocks pay to it (createauxblock), otherwise to the aux node's wallet (getauxblock).")
+      (OPT_P2PNODE,     BoostProgOpt::value<string>()->default_value(""),
+                        "Also send solved blocks to the node's P2P port, given as host:port, racing submitblock. "
+                        "They're sent as compact blocks (BIP 152) when the node supports them.")
+      ;
+
+   BoostProgOpt::options_description monitoringOptions( "Monitoring Options" );
+   monitoringOptions.add_options()
+      (OPT_TRACE,          BoostProgOpt::value<string>()->default_value(""), "Write a timeline of mining phases to this file, in Trace Event Format (for chrome://tracing or Perfetto).")
+      (OPT_METRICSPORT,    BoostProgOpt::value<int>()->default_value(0), "Serve Prometheus metrics at /metrics on this port (0 = disabled).")
+      (OPT_METRICSADDRESS, BoostProgOpt::value<string>()->default_value("127.0.0.1"), "Address to serve metrics on.")
+      (OPT_SHAREDIFFICULTY, BoostProgOpt::value<double>()->default_value(0), "Count pseudo-shares at this difficulty (as a pool's, e.g. 0.001 for one every 4 million hashes or so), "
+                           "and report the hash rate they show after each block (0 = disabled).")
+      (OPT_SHARELOG,       BoostProgOpt::value<string>()->default_value(""), "Append each pseudo-share to this file, as 120-byte records: header, hash and time found (microseconds).")
+      (OPT_CONTROLSOCKET,  BoostProgOpt::value<string>()->default_value(""), "Take commands on a Unix socket at this path while mining: threads <n>, kernel <type>, pause, resume and stats, "
+                           "one per line. Changes take effect within a step of each thread, without losing the block being mined.")
+      ;
+
+   BoostProgOpt::options_description benchmarkOptions( "Benchmark Options" );
+   benchmarkOptions.add_options()
+      (OPT_BENCHMARK",b",  "Measure hash rate on a synthetic block, without connecting to Bitcoin Core. "
+                           "Every kernel type is measured unless one is selected with --" OPT_TYPE ".")
+      (OPT_DURATION,       BoostProgOpt::value<int>()->default_value(10), "Seconds to run each benchmark.")
+      (OPT_HASHES,         BoostProgOpt::value<int64_t>()->default_value(0), "Number of hashes to run in each benchmark, instead of a fixed duration (0 = use duration).")
       ;
 
    BoostProgOpt::options_description coreOptions( "Bitcoin Core Options" );
@@ -48,7 +104,7 @@ void Settings::init( int argc, char** argv )
       ;
 
    BoostProgOpt::options_description allOptions;
-   allOptions.add(generalOptions).add(coreOptions);
+   allOptions.add(generalOptions).add(monitoringOptions).add(benchmarkOptions).add(coreOptions);
 
    // Read all recognized options from command line
    BoostProgOpt::store( BoostProgOpt::parse_command_line(argc,argv,allOptions), _varMap );
@@ -60,6 +116,12 @@ void Settings::init( int argc, char** argv )
       exit( 0 );
    }
 
+   // Benchmarks and self tests don't talk to Bitcoin Core, so don't require its configuration
+   if( benchmark() || selfTest() )
+   {
+      return;
+   }
+
    // Read settings from configuration file, ignoring unknown settings
    const auto& configFile = _varMap[OPT_CONFIG].as<string>();
    BoostProgOpt::store( BoostProgOpt::parse_config_file<char>(configFile.c_str(),coreOptions,true), _varMap );
@@ -107,8 +169,7 @@ std::string Settings::typeHelpText()
    {
       helpText.append( " \"" ).append( typeName ).append( "\"," );
    }
-   helpText.pop_back();
-   helpText.append( "." );
+   helpText.append( " or \"" AUTOTUNE_MINER_TYPE "\" to select the fastest one at startup." );
 
    return helpText;
 }
@@ -118,6 +179,11 @@ const std::string& Settings::minerType()
    return _varMap[OPT_TYPE].as<std::string>();
 }
 
+bool Settings::minerTypeSelected()
+{
+   return !_varMap[OPT_TYPE].defaulted();
+}
+
 bool Settings::debug()
 {
    return _varMap.count( OPT_DEBUG );
@@ -127,3 +193,102 @@ int Settings::numBlocks()
 {
    return _varMap[OPT_BLOCKS].as<int>();
 }
+
+int Settings::threads()
+{
+   int threads = _varMap[OPT_THREADS].as<int>();
+   if( threads <= 0 )
+   {
+      threads = std::max( 1u, std::thread::hardware_concurrency() );
+   }
+   return threads;
+}
+
+bool Settings::threadsSelected()
+{
+   return _varMap[OPT_THREADS].as<int>() > 0;
+}
+
+bool Settings::pinThreads()
+{
+   return _varMap.count( OPT_NOPIN ) == 0;
+}
+
+std::string Settings::tuneCacheFile()
+{
+   return _varMap[OPT_TUNECACHE].as<string>();
+}
+
+bool Settings::assemble()
+{
+   return _varMap.count( OPT_ASSEMBLE );
+}
+
+std::vector<std::string> Settings::auxChains()
+{
+   if( _varMap.count(OPT_AUXCHAIN) == 0 )
+   {
+      return std::vector<std::string>();
+   }
+   return _varMap[OPT_AUXCHAIN].as<vector<string>>();
+}
+
+std::string Settings::p2pNode()
+{
+   return _varMap[OPT_P2PNODE].as<string>();
+}
+
+int Settings::txCacheSize()
+{
+   return std::max( 0, _varMap[OPT_TXCACHE].as<int>() );
+}
+
+std::string Settings::traceFile()
+{
+   return _varMap[OPT_TRACE].as<string>();
+}
+
+int Settings::metricsPort()
+{
+   return _varMap[OPT_METRICSPORT].as<int>();
+}
+
+std::string Settings::metricsAddress()
+{
+   return _varMap[OPT_METRICSADDRESS].as<string>();
+}
+
+double Settings::shareDifficulty()
+{
+   return _varMap[OPT_SHAREDIFFICULTY].as<double>();
+}
+
+std::string Settings::shareLogFile()
+{
+   return _varMap[OPT_SHARELOG].as<string>();
+}
+
+std::string Settings::controlSocket()
+{
+   return _varMap[OPT_CONTROLSOCKET].as<string>();
+}
+
+bool Settings::selfTest()
+{
+   return _varMap.count( OPT_SELFTEST );
+}
+
+bool Settings::benchmark()
+{
+   return _varMap.count( OPT_BENCHMARK );
+}
+
+int Settings::benchmarkDuration()
+{
+   return _varMap[OPT_DURATION].as<int>();
+}
+
+int64_t Settings::benchmarkHashes()
+{
+   return _varMap[OPT_HASHES].as<int64_t>();
+}
@@ -5,6 +5,8 @@
 #define SETTINGS_H
 
 #include <string>
+#include <cstdint>
+#include <vector>
 
 class Settings
 {
@@ -19,7 +21,30 @@ public:
    static std::string RpcPassword();
 
    static const std::string& minerType();
+   static bool minerTypeSelected();
    static int numBlocks();
+   static int threads();
+   static bool threadsSelected();
+   static bool pinThreads();
+   static std::string tuneCacheFile();
+   static int txCacheSize();
+   static bool assemble();
+   static std::vector<std::string> auxChains();
+   static std::string p2pNode();
+
+   static std::string traceFile();
+
+   static int metricsPort();
+   static std::string metricsAddress();
+   static double shareDifficulty();
+   static std::string shareLogFile();
+   static std::string controlSocket();
+
+   static bool selfTest();
+
+   static bool benchmark();
+   static int benchmarkDuration();
+   static int64_t benchmarkHashes();
 
    static std::string defaultConfigFile();
    static std::string minerTypes();
@@ -28,6 +28,12 @@ static const uint32_t K[] = {
    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
+// Initial hash values: the first 32 bits of the fractional parts of the square
+// roots of the first 8 primes
+static const uint32_t H0[] = {
+   0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
 #define ROTATE_RIGHT(x,n) ((x >> n) | (x << (sizeof(x)*CHAR_BIT-n)))
 
 Sha256::Digest::Digest()
@@ -92,15 +98,7 @@ void Sha256::reset()
    _msgBits = 0;
 
    // Set initial hash values
-   // Fractional parts of the square roots of the first 8 primes
-   _digest[0] = 0x6a09e667;
-   _digest[1] = 0xbb67ae85;
-   _digest[2] = 0x3c6ef372;
-   _digest[3] = 0xa54ff53a;
-   _digest[4] = 0x510e527f;
-   _digest[5] = 0x9b05688c;
-   _digest[6] = 0x1f83d9ab;
-   _digest[7] = 0x5be0cd19;
+   std::copy( H0, H0 + 8, _digest.begin() );
 }
 
 void Sha256::update( const void* data, int64_t bits )
@@ -154,14 +152,19 @@ void Sha256::update( const void* data, int64_t bits )
 
 void Sha256::_hash( const uint8_t* msg )
 {
-   uint32_t a = _digest[0];
-   uint32_t b = _digest[1];
-   uint32_t c = _digest[2];
-   uint32_t d = _digest[3];
-   uint32_t e = _digest[4];
-   uint32_t f = _digest[5];
-   uint32_t g = _digest[6];
-   uint32_t h = _digest[7];
+   _compress( _digest.data(), msg );
+}
+
+void Sha256::_compress( uint32_t* state, const uint8_t* msg )
+{
+   uint32_t a = state[0];
+   uint32_t b = state[1];
+   uint32_t c = state[2];
+   uint32_t d = state[3];
+   uint32_t e = state[4];
+   uint32_t f = state[5];
+   uint32_t g = state[6];
+   uint32_t h = state[7];
 
    // Compute message schedule
    uint32_t w[64];
@@ -225,20 +228,26 @@ do { \
 #undef SHA_ROUNDS_8
 
    // Compute intermediate hash
-   _digest[0] += a;
-   _digest[1] += b;
-   _digest[2] += c;
-   _digest[3] += d;
-   _digest[4] += e;
-   _digest[5] += f;
-   _digest[6] += g;
-   _digest[7] += h;
+   state[0] += a;
+   state[1] += b;
+   state[2] += c;
+   state[3] += d;
+   state[4] += e;
+   state[5] += f;
+   state[6] += g;
+   state[7] += h;
 }
 
 void Sha256::digest( Digest& output )
 {
    assert( (_msgBits%8) == 0 && "Non byte aligned usage unsupported" );
 
+   // An empty message still needs a block for the padding
+   if( _msgBlocks.empty() )
+   {
+      _msgBlocks.push_back( new uint8_t[MSG_BLOCK_BYTES]() );
+   }
+
    // Check for space to insert padding and length
    int bitsInLastBlock = _msgBits % MSG_BLOCK_BITS;
    int availBits = MSG_BLOCK_BITS - bitsInLastBlock;
@@ -292,13 +301,9 @@ ByteArray Sha256::hash( const ByteArray& data )
 
 ByteArray Sha256::hash( const void* data, int64_t bytes )
 {
-   Sha256 hash;
-   Digest digest;
-
-   hash.update( data, bytes * CHAR_BIT );
-   hash.digest( digest );
-
-   return digest.toByteArray();
+   RawDigest digest;
+   hash( data, bytes, digest );
+   return ByteArray( digest.begin(), digest.end() );
 }
 
 ByteArray Sha256::doubleHash( const ByteArray& data )
@@ -308,5 +313,57 @@ ByteArray Sha256::doubleHash( const ByteArray& data )
 
 ByteArray Sha256::doubleHash( const void* data, int64_t bytes )
 {
-   return hash( hash( data, bytes ) );
+   RawDigest digest;
+   doubleHash( data, bytes, digest );
+   return ByteArray( digest.begin(), digest.end() );
+}
+
+void Sha256::hash( const void* data, size_t bytes, RawDigest& output )
+{
+   uint32_t state[8];
+   std::copy( H0, H0 + 8, state );
+
+   // Whole blocks are hashed straight from the input
+   auto input = reinterpret_cast<const uint8_t*>(data);
+   size_t remaining = bytes;
+   for( ; remaining >= MSG_BLOCK_BYTES; remaining -= MSG_BLOCK_BYTES, input += MSG_BLOCK_BYTES )
+   {
+      _compress( state, input );
+   }
+
+   // The rest, plus padding and length, takes one or two more
+   uint8_t tail[MSG_BLOCK_BYTES * 2] = {};
+   if( remaining > 0 )
+   {
+      memcpy( tail, input, remaining );
+   }
+   tail[remaining] = 0x80;
+   size_t tailSize = (remaining * CHAR_BIT + MIN_PADDING_BITS <= MSG_BLOCK_BITS) ? MSG_BLOCK_BYTES : MSG_BLOCK_BYTES * 2;
+
+   uint64_t bits = static_cast<uint64_t>(bytes) * CHAR_BIT;
+   for( int i = 1; i <= 8; ++i )
+   {
+      tail[tailSize - i] = bits & 0xff;
+      bits >>= CHAR_BIT;
+   }
+
+   for( size_t offset = 0; offset < tailSize; offset += MSG_BLOCK_BYTES )
+   {
+      _compress( state, tail + offset );
+   }
+
+   for( int i = 0; i < 8; ++i )
+   {
+      output[i * 4 + 0] = state[i] >> 24;
+      output[i * 4 + 1] = state[i] >> 16;
+      output[i * 4 + 2] = state[i] >> 8;
+      output[i * 4 + 3] = state[i];
+   }
+}
+
+void Sha256::doubleHash( const void* data, size_t bytes, RawDigest& output )
+{
+   RawDigest first;
+   hash( data, bytes, first );
+   hash( first.data(), first.size(), output );
 }
@@ -38,9 +38,18 @@ public:
    static ByteArray doubleHash( const ByteArray& data );
    static ByteArray doubleHash( const void* data, int64_t bytes );
 
+   /*
+    * One-shot hashing without any allocation, for small messages such as
+    * headers, txids and address checksums.
+    */
+   static void hash( const void* data, size_t bytes, RawDigest& output );
+   static void doubleHash( const void* data, size_t bytes, RawDigest& output );
+
 private:
    void _hash( const uint8_t* msg );
 
+   static void _compress( uint32_t* state, const uint8_t* msg );
+
 private:
    std::vector<uint8_t*> _msgBlocks;
 
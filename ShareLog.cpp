@@ -0,0 +1,161 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "ShareLog.h"
+#include "Benchmark.h"
+#include "Metrics.h"
+#include "Sha256.h"
+
+#include <cmath>
+#include <iomanip>
+#include <stdexcept>
+
+// The target at difficulty 1 is 0xffff * 2^208, so a share takes this many
+// hashes per unit of difficulty on average
+static const double HASHES_PER_DIFFICULTY = std::ldexp( 1.0, 48 ) / 0xffff;
+
+// The target for a difficulty, big-endian
+static ByteArray difficultyTarget( double difficulty )
+{
+   ByteArray target( 32, 0 );
+
+   // 0xffff * 2^208 / difficulty, as a 64-bit mantissa and a shift
+   int exponent;
+   auto mantissa = static_cast<uint64_t>( std::ldexp(std::frexp(0xffff / difficulty, &exponent), 64) );
+   exponent += 208 - 64;
+   if( exponent + 64 > 256 )
+   {
+      return ByteArray( 32, 0xff );
+   }
+
+   for( int i = 0; i < 64; ++i )
+   {
+      int bit = exponent + i;
+      if( bit >= 0 && (mantissa >> i & 1) )
+      {
+         target[31 - bit / 8] |= 1 << (bit % 8);
+      }
+   }
+   return target;
+}
+
+ShareLog::ShareLog( double difficulty, const std::string& fileName )
+ : _difficulty(difficulty),
+   _hashesPerShare(difficulty * HASHES_PER_DIFFICULTY),
+   _start(std::chrono::steady_clock::now()),
+   _shares(0),
+   _invalid(0)
+{
+   if( difficulty < 0 )
+   {
+      throw std::runtime_error( "Share difficulty can't be negative" );
+   }
+
+   if( !enabled() )
+   {
+      return;
+   }
+
+   _target = difficultyTarget( difficulty );
+
+   if( !fileName.empty() )
+   {
+      _file.open( fileName, std::ios::binary | std::ios::app );
+      if( !_file )
+      {
+         throw std::runtime_error( "Unable to open share log " + fileName );
+      }
+   }
+}
+
+bool ShareLog::enabled() const
+{
+   return _difficulty > 0;
+}
+
+const ByteArray& ShareLog::target() const
+{
+   return _target;
+}
+
+bool ShareLog::record( const Block::Header& header, const ByteArray& searchTarget )
+{
+   auto found = std::chrono::system_clock::now();
+
+   Sha256::RawDigest hash;
+   Sha256::doubleHash( &header, sizeof(header), hash );
+   bool valid = !std::lexicographical_compare( searchTarget.begin(), searchTarget.end(), hash.rbegin(), hash.rend() );
+   bool share = valid && !std::lexicographical_compare( _target.begin(), _target.end(), hash.rbegin(), hash.rend() );
+
+   std::lock_guard<std::mutex> lock( _mutex );
+   if( !valid )
+   {
+      ++_invalid;
+      Metrics::shareFound( 0, false );
+      return false;
+   }
+
+   if( !share )
+   {
+      return true;
+   }
+
+   ++_shares;
+   Metrics::shareFound( _hashesPerShare, true );
+
+   if( _file.is_open() )
+   {
+      uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>( found.time_since_epoch() ).count();
+      uint8_t time[8];
+      for( int i = 0; i < 8; ++i )
+      {
+         time[i] = static_cast<uint8_t>( micros >> (i * 8) );
+      }
+
+      _file.write( reinterpret_cast<const char*>(&header), sizeof(header) );
+      _file.write( reinterpret_cast<const char*>(hash.data()), hash.size() );
+      _file.write( reinterpret_cast<const char*>(time), sizeof(time) );
+      _file.flush();
+   }
+
+   return true;
+}
+
+uint64_t ShareLog::shares() const
+{
+   std::lock_guard<std::mutex> lock( _mutex );
+   return _shares;
+}
+
+uint64_t ShareLog::invalidShares() const
+{
+   std::lock_guard<std::mutex> lock( _mutex );
+   return _invalid;
+}
+
+double ShareLog::effectiveHashRate() const
+{
+   double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - _start ).count();
+   return seconds > 0 ? shares() * _hashesPerShare / seconds : 0;
+}
+
+void ShareLog::report( std::ostream& outStream, uint64_t countedHashes ) const
+{
+   double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - _start ).count();
+   auto counted = seconds > 0 ? countedHashes / seconds : 0;
+   auto effective = effectiveHashRate();
+
+   outStream << "Shares: " << shares() << " at difficulty " << _difficulty;
+   if( invalidShares() > 0 )
+   {
+      outStream << ", " << invalidShares() << " INVALID";
+   }
+   outStream << "; effective " << formatHashRate( effective ) << ", counted " << formatHashRate( counted );
+   if( counted > 0 )
+   {
+      outStream << " (" << std::fixed << std::setprecision(1) << 100 * effective / counted << "%)";
+      outStream.unsetf( std::ios::floatfield );
+   }
+   outStream << std::endl;
+}
@@ -0,0 +1,82 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef SHARE_LOG_H
+#define SHARE_LOG_H
+
+#include "Block.h"
+#include "Util.h"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+/*
+ * Pseudo-shares: headers whose hash meets a share target far easier than
+ * the block's, as a pool would ask for. Each share stands for the expected
+ * number of hashes needed to find one, so their rate measures the hash rate
+ * actually achieved, from proof of work rather than the kernels' own
+ * counters. A kernel that misses solutions finds too few shares; one that
+ * reports false ones finds shares whose hash (checked with the reference
+ * SHA-256) doesn't meet the target.
+ *
+ * Shares can also be appended to a file, each as a fixed 120-byte record:
+ * the 80-byte header (with its nonce), its 32-byte hash (as hashed, i.e.
+ * little-endian) and the time found, in microseconds since the Unix epoch,
+ * as a little-endian 64-bit integer.
+ */
+class ShareLog
+{
+public:
+   /*
+    * Difficulty is relative to the lowest (bits 1d00ffff), as pools give
+    * it; 0 disables shares. With an empty file name, shares are only counted.
+    */
+   ShareLog( double difficulty, const std::string& fileName );
+
+   bool enabled() const;
+
+   /*
+    * The share target, big-endian.
+    */
+   const ByteArray& target() const;
+
+   /*
+    * Called with each header a kernel found against the search target,
+    * which must be at least as easy as the share target. Counts (and logs)
+    * it if it meets the share target. Returns false, counting it as
+    * invalid, if it doesn't even meet the search target: the kernel is
+    * broken.
+    */
+   bool record( const Block::Header& header, const ByteArray& searchTarget );
+
+   uint64_t shares() const;
+   uint64_t invalidShares() const;
+
+   /*
+    * The hash rate the shares found since construction stand for.
+    */
+   double effectiveHashRate() const;
+
+   /*
+    * One line comparing the effective hash rate with the one counted by
+    * the kernels over the same time.
+    */
+   void report( std::ostream& outStream, uint64_t countedHashes ) const;
+
+private:
+   double                                 _difficulty;
+   double                                 _hashesPerShare;
+   ByteArray                              _target;
+   std::chrono::steady_clock::time_point  _start;
+
+   mutable std::mutex                     _mutex;
+   uint64_t                               _shares;
+   uint64_t                               _invalid;
+   std::ofstream                          _file;
+};
+
+#endif // !SHARE_LOG_H
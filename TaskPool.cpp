@@ -0,0 +1,288 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Pieces per thread in parallelFor, so that threads finishing early can
+// steal the remainder
+const size_t PIECES_PER_THREAD = 4;
+
+// Index of the current thread's queue, or -1 if it isn't a worker
+static thread_local int _workerIndex = -1;
+
+static std::atomic<int> _requestedWorkers( -1 );
+
+struct TaskPool::State
+{
+   struct Item
+   {
+      Task     task;
+      Group*   group;
+   };
+
+   struct Queue
+   {
+      std::mutex        mutex;
+      std::deque<Item>  items;
+   };
+
+   explicit State( unsigned workers )
+    : queued(0),
+      stop(false),
+      nextVictim(0)
+   {
+      // One per worker, then the shared one for everyone else
+      for( unsigned i = 0; i <= workers; ++i )
+      {
+         queues.emplace_back( new Queue );
+      }
+
+      for( unsigned i = 0; i < workers; ++i )
+      {
+         threads.emplace_back( TaskPool::_workerMain, std::ref(*this), i );
+      }
+   }
+
+   ~State()
+   {
+      {
+         std::lock_guard<std::mutex> lock( sleepMutex );
+         stop = true;
+      }
+      wake.notify_all();
+
+      for( auto& thread : threads )
+      {
+         thread.join();
+      }
+   }
+
+   std::vector<std::unique_ptr<Queue>>  queues;
+   std::vector<std::thread>             threads;
+
+   std::mutex                           sleepMutex;
+   std::condition_variable              wake;
+   std::atomic<size_t>                  queued;
+   bool                                 stop;
+
+   std::atomic<unsigned>                nextVictim;
+};
+
+TaskPool::Group::Group()
+ : _pending(0)
+{
+}
+
+TaskPool::Group::~Group()
+{
+   // Tasks may refer to the caller's stack
+   _join();
+}
+
+void TaskPool::Group::run( Task task )
+{
+   ++_pending;
+   TaskPool::_submit( std::move(task), this );
+}
+
+void TaskPool::Group::wait()
+{
+   _join();
+
+   std::lock_guard<std::mutex> lock( _errorMutex );
+   if( _error )
+   {
+      auto error = _error;
+      _error = nullptr;
+      std::rethrow_exception( error );
+   }
+}
+
+void TaskPool::Group::_join()
+{
+   auto& state = TaskPool::_state();
+   while( _pending > 0 )
+   {
+      // Help rather than block; what's run may not be this group's
+      if( !TaskPool::_runOne(state) )
+      {
+         std::this_thread::yield();
+      }
+   }
+}
+
+void TaskPool::Group::_finished( std::exception_ptr error )
+{
+   if( error )
+   {
+      std::lock_guard<std::mutex> lock( _errorMutex );
+      if( !_error )
+      {
+         _error = error;
+      }
+   }
+
+   --_pending;
+}
+
+void TaskPool::parallelFor( size_t count, size_t grain, const std::function<void(size_t,size_t)>& body )
+{
+   grain = std::max<size_t>( grain, 1 );
+   size_t pieces = std::min( (count + grain - 1) / grain, concurrency() * PIECES_PER_THREAD );
+   if( pieces <= 1 )
+   {
+      if( count > 0 )
+      {
+         body( 0, count );
+      }
+      return;
+   }
+
+   Group group;
+   for( size_t piece = 1; piece < pieces; ++piece )
+   {
+      size_t begin = count * piece / pieces;
+      size_t end = count * (piece + 1) / pieces;
+      group.run( [&body,begin,end]()
+      {
+         body( begin, end );
+      } );
+   }
+
+   body( 0, count / pieces );
+   group.wait();
+}
+
+unsigned TaskPool::concurrency()
+{
+   return _state().threads.size() + 1;
+}
+
+void TaskPool::setWorkerCount( unsigned workers )
+{
+   _requestedWorkers = workers;
+}
+
+TaskPool::State& TaskPool::_state()
+{
+   static State state( _requestedWorkers >= 0 ? _requestedWorkers.load()
+                                              : std::max( 1u, std::thread::hardware_concurrency() ) - 1 );
+   return state;
+}
+
+void TaskPool::_submit( Task task, Group* group )
+{
+   auto& state = _state();
+
+   auto index = _workerIndex >= 0 ? _workerIndex : state.queues.size() - 1;
+   {
+      auto& queue = *state.queues[index];
+      std::lock_guard<std::mutex> lock( queue.mutex );
+      queue.items.push_back( State::Item{ std::move(task), group } );
+   }
+
+   // Under the lock, so a worker can't miss it between checking and sleeping
+   {
+      std::lock_guard<std::mutex> lock( state.sleepMutex );
+      ++state.queued;
+   }
+   state.wake.notify_one();
+}
+
+bool TaskPool::_runOne( State& state )
+{
+   if( state.queued == 0 )
+   {
+      return false;
+   }
+
+   State::Item item;
+   bool found = false;
+
+   // Newest first from our own queue, while it's hot in cache
+   if( _workerIndex >= 0 )
+   {
+      auto& queue = *state.queues[_workerIndex];
+      std::lock_guard<std::mutex> lock( queue.mutex );
+      if( !queue.items.empty() )
+      {
+         item = std::move( queue.items.back() );
+         queue.items.pop_back();
+         found = true;
+      }
+   }
+
+   // Otherwise steal the oldest from someone else, which tends to be the
+   // biggest piece of work
+   size_t count = state.queues.size();
+   size_t start = state.nextVictim++;
+   for( size_t i = 0; i < count && !found; ++i )
+   {
+      size_t victim = (start + i) % count;
+      if( static_cast<int>(victim) == _workerIndex )
+      {
+         continue;
+      }
+
+      auto& queue = *state.queues[victim];
+      std::lock_guard<std::mutex> lock( queue.mutex );
+      if( !queue.items.empty() )
+      {
+         item = std::move( queue.items.front() );
+         queue.items.pop_front();
+         found = true;
+      }
+   }
+
+   if( !found )
+   {
+      return false;
+   }
+
+   --state.queued;
+
+   std::exception_ptr error;
+   try
+   {
+      item.task();
+   }
+   catch( ... )
+   {
+      error = std::current_exception();
+   }
+   item.group->_finished( error );
+
+   return true;
+}
+
+void TaskPool::_workerMain( State& state, int index )
+{
+   _workerIndex = index;
+
+   for( ;; )
+   {
+      if( _runOne(state) )
+      {
+         continue;
+      }
+
+      std::unique_lock<std::mutex> lock( state.sleepMutex );
+      state.wake.wait( lock, [&state]()
+      {
+         return state.queued > 0 || state.stop;
+      } );
+
+      if( state.stop )
+      {
+         return;
+      }
+   }
+}
@@ -0,0 +1,86 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+/*
+ * Process-wide work-stealing thread pool for everything outside the hash
+ * loop: template decoding, merkle trees, batch codecs.
+ *
+ * Each worker has its own deque, running its newest task first and stealing
+ * the oldest from the others when it runs dry. Threads that aren't workers
+ * submit through a shared queue. A thread waiting on a group runs queued
+ * tasks itself rather than blocking, so tasks can fork and join freely, and
+ * a caller always contributes its own core.
+ *
+ * Workers sleep while there's nothing queued, so they take no cycles from
+ * the mining threads.
+ */
+class TaskPool
+{
+public:
+   typedef std::function<void()> Task;
+
+   /*
+    * A set of tasks to fork and then join. The first exception thrown by a
+    * task is rethrown from wait().
+    */
+   class Group
+   {
+   public:
+      Group();
+      ~Group();
+
+      Group( const Group& ) = delete;
+      Group& operator =( const Group& ) = delete;
+
+      void run( Task task );
+      void wait();
+
+   private:
+      friend class TaskPool;
+
+      void _join();
+      void _finished( std::exception_ptr error );
+
+   private:
+      std::atomic<size_t>  _pending;
+      std::mutex           _errorMutex;
+      std::exception_ptr   _error;
+   };
+
+public:
+   /*
+    * Call body(begin, end) over [0, count) in pieces of at least grain items,
+    * spread over the pool, and wait for them all.
+    */
+   static void parallelFor( size_t count, size_t grain, const std::function<void(size_t,size_t)>& body );
+
+   /*
+    * Number of threads that run tasks, including a waiting caller.
+    */
+   static unsigned concurrency();
+
+   /*
+    * Set the number of worker threads. Only has an effect before the pool
+    * is first used; by default there is one per CPU, less the caller's.
+    */
+   static void setWorkerCount( unsigned workers );
+
+private:
+   struct State;
+
+   static State& _state();
+   static void _submit( Task task, Group* group );
+   static bool _runOne( State& state );
+   static void _workerMain( State& state, int index );
+};
+
+#endif // !TASK_POOL_H
@@ -0,0 +1,239 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "TemplateParser.h"
+#include "Hex.h"
+
+#include <stdexcept>
+
+// Depths of the interesting parts of the template:
+//    1: the template object's members
+//    2: inside the "transactions" array
+//    3: inside a transaction object
+const int TEMPLATE_DEPTH = 1;
+const int TXN_DEPTH = 3;
+
+TemplateParser::TemplateParser( TransactionCache* cache )
+ : _cache(cache),
+   _fields(Json::objectValue),
+   _depth(0),
+   _inTxns(false),
+   _txnFee(0)
+{
+}
+
+const Json::Value& TemplateParser::fields() const
+{
+   return _fields;
+}
+
+TransactionList& TemplateParser::transactions()
+{
+   return _txns;
+}
+
+// Called at the start of every value inside the template. Returns the handler
+// for it, or nullptr if it's part of the transactions.
+JsonStreamParser::Handler* TemplateParser::_valueHandler()
+{
+   if( _depth == 0 )
+   {
+      throw std::runtime_error( "getblocktemplate result is not an object" );
+   }
+
+   if( _depth == TEMPLATE_DEPTH )
+   {
+      _inTxns = (_member == "transactions");
+      if( !_inTxns )
+      {
+         _builder.reset( new JsonValueBuilder(_fields[_member]) );
+      }
+   }
+
+   return _inTxns ? nullptr : _builder.get();
+}
+
+void TemplateParser::startObject()
+{
+   // The template itself
+   if( _depth == 0 )
+   {
+      ++_depth;
+      return;
+   }
+
+   auto handler = _valueHandler();
+   ++_depth;
+   if( handler != nullptr )
+   {
+      handler->startObject();
+   }
+   else if( _depth == TXN_DEPTH )
+   {
+      _txnData.clear();
+      _txnId.clear();
+      _txnFee = 0;
+   }
+}
+
+void TemplateParser::endObject()
+{
+   if( --_depth == 0 )
+   {
+      _hashTransactions();
+      return;
+   }
+
+   if( !_inTxns )
+   {
+      _builder->endObject();
+   }
+   else if( _depth == TXN_DEPTH - 1 )
+   {
+      // The txid and fee come after the data, so it's only added now
+      _appendTransaction();
+   }
+}
+
+void TemplateParser::_appendTransaction()
+{
+   // Skipping it would only make an invalid block, if anything spends it
+   _scratch.resize( _txnData.size() / 2 );
+   if( _txnData.empty() || !Hex::decode(_txnData.data(), _txnData.size(), _scratch.data()) )
+   {
+      throw std::runtime_error( "Invalid transaction data in template" );
+   }
+
+   // The template's txid is only a key: a hit must also match byte for byte,
+   // witness included
+   const TransactionCache::Entry* cached = nullptr;
+   if( _cache != nullptr && !_txnId.empty() )
+   {
+      cached = _cache->find( _txnId );
+   }
+
+   if( cached != nullptr && cached->raw == _scratch )
+   {
+      _txns.append( _scratch.data(), _scratch.size(), cached->txid, cached->wtxid, _txnFee );
+      return;
+   }
+
+   _txns.appendUnhashed( _scratch.data(), _scratch.size(), _txnFee );
+   if( _cache != nullptr && !_txnId.empty() )
+   {
+      _uncached.emplace_back( _txns.count() - 1, std::move(_txnId) );
+   }
+}
+
+// Whatever wasn't cached is hashed all at once, then cached
+void TemplateParser::_hashTransactions()
+{
+   if( !_txns.hashPending() )
+   {
+      throw std::runtime_error( "Invalid transaction in template" );
+   }
+
+   for( auto& uncached : _uncached )
+   {
+      auto index = uncached.first;
+      _cache->insert( uncached.second, _txns.rawData(index), _txns.rawSize(index), _txns.txid(index), _txns.wtxid(index) );
+   }
+   _uncached.clear();
+}
+
+void TemplateParser::startArray()
+{
+   auto handler = _valueHandler();
+   ++_depth;
+   if( handler != nullptr )
+   {
+      handler->startArray();
+   }
+}
+
+void TemplateParser::endArray()
+{
+   --_depth;
+   if( !_inTxns )
+   {
+      _builder->endArray();
+   }
+   else if( _depth == TEMPLATE_DEPTH )
+   {
+      _inTxns = false;
+   }
+}
+
+void TemplateParser::key( std::string& name )
+{
+   if( _depth == TEMPLATE_DEPTH )
+   {
+      _member = name;
+   }
+   else if( !_inTxns )
+   {
+      _builder->key( name );
+   }
+   else if( _depth == TXN_DEPTH )
+   {
+      _txnKey = name;
+   }
+}
+
+void TemplateParser::string( std::string& value )
+{
+   auto handler = _valueHandler();
+   if( handler != nullptr )
+   {
+      handler->string( value );
+   }
+   else if( _depth == TXN_DEPTH && _txnKey == "data" )
+   {
+      // Take the parser's buffer rather than copying it
+      _txnData.swap( value );
+   }
+   else if( _depth == TXN_DEPTH && (_txnKey == "txid" || (_txnKey == "hash" && _txnId.empty())) )
+   {
+      // Older nodes only give "hash", which was the txid before segwit (it's
+      // now the wtxid)
+      _txnId.swap( value );
+   }
+}
+
+void TemplateParser::number( const std::string& text )
+{
+   auto handler = _valueHandler();
+   if( handler != nullptr )
+   {
+      handler->number( text );
+   }
+   else if( _depth == TXN_DEPTH && _txnKey == "fee" )
+   {
+      _txnFee = std::stoll( text );
+   }
+}
+
+void TemplateParser::boolean( bool value )
+{
+   auto handler = _valueHandler();
+   if( handler != nullptr )
+   {
+      handler->boolean( value );
+   }
+}
+
+void TemplateParser::null()
+{
+   // A null result means the call failed, which the caller reports
+   if( _depth == 0 )
+   {
+      return;
+   }
+
+   auto handler = _valueHandler();
+   if( handler != nullptr )
+   {
+      handler->null();
+   }
+}
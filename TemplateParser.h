@@ -0,0 +1,77 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef TEMPLATE_PARSER_H
+#define TEMPLATE_PARSER_H
+
+#include "JsonStream.h"
+#include "TransactionList.h"
+#include "TransactionCache.h"
+
+#include <json/json.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Streaming handler for a getblocktemplate result. Each transaction's hex is
+ * decoded into a TransactionList as soon as its object has arrived; those
+ * that aren't cached are hashed together on the task pool at the end of the
+ * template. The other (small) members of the template are collected as a
+ * Json::Value.
+ */
+class TemplateParser : public JsonStreamParser::Handler
+{
+public:
+   /*
+    * With a cache, transactions already seen in an earlier template reuse
+    * their txid rather than being hashed again.
+    */
+   TemplateParser( TransactionCache* cache = nullptr );
+
+   /*
+    * Everything in the template except the transactions.
+    */
+   const Json::Value& fields() const;
+
+   /*
+    * The decoded transactions (with their fees), in template order.
+    */
+   TransactionList& transactions();
+
+public:
+   virtual void startObject();
+   virtual void endObject();
+   virtual void startArray();
+   virtual void endArray();
+   virtual void key( std::string& name );
+   virtual void string( std::string& value );
+   virtual void number( const std::string& text );
+   virtual void boolean( bool value );
+   virtual void null();
+
+private:
+   JsonStreamParser::Handler* _valueHandler();
+   void _appendTransaction();
+   void _hashTransactions();
+
+private:
+   TransactionCache*                   _cache;
+   Json::Value                         _fields;
+   std::unique_ptr<JsonValueBuilder>   _builder;
+   TransactionList                     _txns;
+
+   int                                 _depth;
+   std::string                         _member;
+   bool                                _inTxns;
+   std::string                         _txnKey;
+   std::string                         _txnData;
+   std::string                         _txnId;
+   int64_t                             _txnFee;
+   std::vector<std::pair<size_t, std::string>>  _uncached;
+   ByteArray                           _scratch;
+};
+
+#endif // !TEMPLATE_PARSER_H
@@ -0,0 +1,246 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "Topology.h"
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <thread>
+#include <utility>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+static const std::string SYSFS_CPU_PATH = "/sys/devices/system/cpu/";
+static const std::string SYSFS_NODE_PATH = "/sys/devices/system/node/";
+
+// Read the first line of a sysfs file, or an empty string
+static std::string readSysfsLine( const std::string& path )
+{
+   std::ifstream file( path );
+   std::string line;
+   std::getline( file, line );
+   return line;
+}
+
+// Read a single integer from a sysfs file, or return the default
+static int readSysfsInt( const std::string& path, int defaultValue )
+{
+   std::ifstream file( path );
+   int value = defaultValue;
+   if( !(file >> value) )
+   {
+      return defaultValue;
+   }
+   return value;
+}
+
+const Topology& Topology::host()
+{
+   static Topology topology;
+   return topology;
+}
+
+Topology::Topology()
+{
+   // Kernels without NUMA support have no node directory
+   std::map<int,int> cpuNodes;
+   for( int node : parseCpuList(readSysfsLine(SYSFS_NODE_PATH + "online")) )
+   {
+      auto cpuList = readSysfsLine( SYSFS_NODE_PATH + "node" + std::to_string(node) + "/cpulist" );
+      for( int id : parseCpuList(cpuList) )
+      {
+         cpuNodes[id] = node;
+      }
+   }
+
+   for( int id : parseCpuList(readSysfsLine(SYSFS_CPU_PATH + "online")) )
+   {
+      auto topologyPath = SYSFS_CPU_PATH + "cpu" + std::to_string(id) + "/topology/";
+
+      Cpu cpu;
+      cpu.id = id;
+      cpu.core = readSysfsInt( topologyPath + "core_id", id );
+      cpu.package = readSysfsInt( topologyPath + "physical_package_id", 0 );
+      cpu.node = cpuNodes.count( id ) != 0 ? cpuNodes[id] : 0;
+      _cpus.push_back( cpu );
+   }
+
+   // No sysfs, so make something up
+   if( _cpus.empty() )
+   {
+      int count = std::max( 1u, std::thread::hardware_concurrency() );
+      for( int id = 0; id < count; ++id )
+      {
+         _cpus.push_back( Cpu{id, id, 0, 0} );
+      }
+   }
+}
+
+const std::vector<Topology::Cpu>& Topology::cpus() const
+{
+   return _cpus;
+}
+
+int Topology::logicalCpuCount() const
+{
+   return _cpus.size();
+}
+
+int Topology::physicalCoreCount() const
+{
+   std::set<std::pair<int,int>> cores;
+   for( auto& cpu : _cpus )
+   {
+      cores.insert( std::make_pair(cpu.package, cpu.core) );
+   }
+   return cores.size();
+}
+
+int Topology::nodeCount() const
+{
+   std::set<int> nodes;
+   for( auto& cpu : _cpus )
+   {
+      nodes.insert( cpu.node );
+   }
+   return nodes.size();
+}
+
+std::vector<int> Topology::placement( int threads ) const
+{
+   std::set<int> allowed;
+#ifdef __linux__
+   cpu_set_t mask;
+   if( sched_getaffinity(0, sizeof(mask), &mask) == 0 )
+   {
+      for( auto& cpu : _cpus )
+      {
+         if( cpu.id < CPU_SETSIZE && CPU_ISSET(cpu.id, &mask) )
+         {
+            allowed.insert( cpu.id );
+         }
+      }
+   }
+#endif
+
+   // Each node's cores, each core's hardware threads, all in ID order
+   std::map<int, std::map<std::pair<int,int>, std::vector<int>>> nodes;
+   for( auto& cpu : _cpus )
+   {
+      if( allowed.empty() || allowed.count(cpu.id) != 0 )
+      {
+         nodes[cpu.node][std::make_pair(cpu.package, cpu.core)].push_back( cpu.id );
+      }
+   }
+
+   // Rounds of one hardware thread per core; within a round, one core from
+   // each node in turn
+   std::vector<std::vector<std::vector<int>>> rounds;
+   for( auto& node : nodes )
+   {
+      size_t index = 0;
+      for( auto& core : node.second )
+      {
+         for( size_t sibling = 0; sibling < core.second.size(); ++sibling )
+         {
+            if( rounds.size() <= sibling )
+            {
+               rounds.resize( sibling + 1 );
+            }
+
+            auto& round = rounds[sibling];
+            if( round.size() <= index )
+            {
+               round.resize( index + 1 );
+            }
+            round[index].push_back( core.second[sibling] );
+         }
+         ++index;
+      }
+   }
+
+   std::vector<int> order;
+   for( auto& round : rounds )
+   {
+      for( auto& turn : round )
+      {
+         order.insert( order.end(), turn.begin(), turn.end() );
+      }
+   }
+
+   std::vector<int> result;
+   for( int i = 0; i < threads && !order.empty(); ++i )
+   {
+      result.push_back( order[i % order.size()] );
+   }
+   return result;
+}
+
+bool Topology::pinCurrentThread( int cpu )
+{
+#ifdef __linux__
+   if( cpu < 0 || cpu >= CPU_SETSIZE )
+   {
+      return false;
+   }
+
+   cpu_set_t mask;
+   CPU_ZERO( &mask );
+   CPU_SET( cpu, &mask );
+   return sched_setaffinity( 0, sizeof(mask), &mask ) == 0;
+#else
+   (void)cpu;
+   return false;
+#endif
+}
+
+std::string Topology::cpuModel()
+{
+   std::ifstream cpuInfo( "/proc/cpuinfo" );
+   std::string line;
+   while( std::getline(cpuInfo, line) )
+   {
+      if( line.compare(0, 10, "model name") == 0 )
+      {
+         auto start = line.find_first_not_of( " \t:", 10 );
+         if( start != std::string::npos )
+         {
+            return line.substr( start );
+         }
+      }
+   }
+
+   return "unknown";
+}
+
+std::vector<int> Topology::parseCpuList( const std::string& list )
+{
+   std::vector<int> result;
+   std::istringstream stream( list );
+   std::string range;
+
+   while( std::getline(stream, range, ',') )
+   {
+      if( range.empty() )
+      {
+         continue;
+      }
+
+      auto dash = range.find( '-' );
+      int first = std::stoi( range.substr(0, dash) );
+      int last = (dash == std::string::npos) ? first : std::stoi( range.substr(dash + 1) );
+
+      for( int id = first; id <= last; ++id )
+      {
+         result.push_back( id );
+      }
+   }
+
+   return result;
+}
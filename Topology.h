@@ -0,0 +1,66 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Description of the host's logical CPUs, read from Linux sysfs
+ * (/sys/devices/system/cpu and /sys/devices/system/node). If sysfs isn't
+ * available, every logical CPU is assumed to be its own core, on one node.
+ */
+class Topology
+{
+public:
+   struct Cpu
+   {
+      int   id;
+      int   core;
+      int   package;
+      int   node;       // NUMA node
+   };
+
+public:
+   static const Topology& host();
+
+   const std::vector<Cpu>& cpus() const;
+   int logicalCpuCount() const;
+   int physicalCoreCount() const;
+   int nodeCount() const;
+
+   /*
+    * Logical CPUs for the given number of busy threads, one per thread: the
+    * first hardware thread of every physical core, alternating between NUMA
+    * nodes, and only then the cores' other hardware threads. CPUs outside
+    * the process's affinity mask are left out. With more threads than CPUs,
+    * the list repeats.
+    */
+   std::vector<int> placement( int threads ) const;
+
+   /*
+    * Restrict the calling thread to one logical CPU. Returns false if that
+    * isn't possible (or supported).
+    */
+   static bool pinCurrentThread( int cpu );
+
+   /*
+    * The processor model name from /proc/cpuinfo.
+    */
+   static std::string cpuModel();
+
+   /*
+    * Parse a sysfs CPU list, e.g. "0-3,8,10-11".
+    */
+   static std::vector<int> parseCpuList( const std::string& list );
+
+private:
+   Topology();
+
+private:
+   std::vector<Cpu> _cpus;
+};
+
+#endif // !TOPOLOGY_H
@@ -0,0 +1,204 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "Trace.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// Flush a thread's spans once it has buffered this many
+const size_t MAX_BUFFERED_EVENTS = 4096;
+
+namespace
+{
+   struct Event
+   {
+      const char* name;
+      std::string detail;
+      int64_t     start;
+      int64_t     duration;
+   };
+
+   struct ThreadBuffer
+   {
+      ThreadBuffer();
+      ~ThreadBuffer();
+
+      void flush();
+
+      int                  tid;
+      int                  depth;
+      std::vector<Event>   events;
+   };
+}
+
+static std::atomic<bool> _enabled( false );
+static std::atomic<int> _nextTid( 0 );
+static std::mutex _fileMutex;
+static FILE* _file = nullptr;
+static std::chrono::steady_clock::time_point _epoch;
+
+static ThreadBuffer& threadBuffer()
+{
+   static thread_local ThreadBuffer buffer;
+   return buffer;
+}
+
+// Escape a string for inclusion in JSON
+static std::string jsonEscape( const std::string& str )
+{
+   std::string result;
+   result.reserve( str.size() );
+   for( char ch : str )
+   {
+      if( ch == '"' || ch == '\\' )
+      {
+         result += '\\';
+         result += ch;
+      }
+      else if( static_cast<unsigned char>(ch) < 0x20 )
+      {
+         result += ' ';
+      }
+      else
+      {
+         result += ch;
+      }
+   }
+   return result;
+}
+
+// The exiting thread's buffer was already flushed by its destructor, which
+// runs before atexit handlers (and it mustn't be touched after that). Threads
+// still running find the file closed and drop their spans.
+static void closeTrace()
+{
+   std::lock_guard<std::mutex> lock( _fileMutex );
+   if( _file != nullptr )
+   {
+      std::fputs( "\n]\n", _file );
+      std::fclose( _file );
+      _file = nullptr;
+   }
+}
+
+ThreadBuffer::ThreadBuffer()
+ : tid(_nextTid++),
+   depth(0)
+{
+}
+
+ThreadBuffer::~ThreadBuffer()
+{
+   flush();
+}
+
+void ThreadBuffer::flush()
+{
+   if( events.empty() )
+   {
+      return;
+   }
+
+   std::ostringstream stream;
+   int pid = ::getpid();
+   for( auto& event : events )
+   {
+      stream << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":" << pid
+             << ",\"tid\":" << tid << ",\"ts\":" << event.start << ",\"dur\":" << event.duration;
+      if( !event.detail.empty() )
+      {
+         stream << ",\"args\":{\"detail\":\"" << jsonEscape( event.detail ) << "\"}";
+      }
+      stream << "}";
+   }
+   events.clear();
+
+   std::lock_guard<std::mutex> lock( _fileMutex );
+   if( _file != nullptr )
+   {
+      auto str = stream.str();
+      std::fwrite( str.data(), 1, str.size(), _file );
+      std::fflush( _file );
+   }
+}
+
+Trace::Span::Span( const char* name )
+ : _name(name),
+   _active(_enabled.load(std::memory_order_relaxed))
+{
+   if( _active )
+   {
+      ++threadBuffer().depth;
+      _start = std::chrono::steady_clock::now();
+   }
+}
+
+Trace::Span::Span( const char* name, const std::string& detail )
+ : Span( name )
+{
+   if( _active )
+   {
+      _detail = detail;
+   }
+}
+
+Trace::Span::~Span()
+{
+   if( !_active )
+   {
+      return;
+   }
+
+   auto end = std::chrono::steady_clock::now();
+   auto& buffer = threadBuffer();
+
+   Event event;
+   event.name = _name;
+   event.detail = std::move( _detail );
+   event.start = std::chrono::duration_cast<std::chrono::microseconds>( _start - _epoch ).count();
+   event.duration = std::chrono::duration_cast<std::chrono::microseconds>( end - _start ).count();
+   buffer.events.push_back( std::move(event) );
+
+   if( --buffer.depth == 0 || buffer.events.size() >= MAX_BUFFERED_EVENTS )
+   {
+      buffer.flush();
+   }
+}
+
+void Trace::enable( const std::string& fileName )
+{
+   std::lock_guard<std::mutex> lock( _fileMutex );
+   if( _file != nullptr )
+   {
+      return;
+   }
+
+   _file = std::fopen( fileName.c_str(), "w" );
+   if( _file == nullptr )
+   {
+      throw std::runtime_error( "Unable to create trace file " + fileName );
+   }
+
+   // Every event is written with a leading comma, so start with metadata
+   std::fprintf( _file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"jrmrmine\"}}",
+                 static_cast<int>(::getpid()) );
+   std::fflush( _file );
+
+   _epoch = std::chrono::steady_clock::now();
+   _enabled = true;
+   std::atexit( closeTrace );
+}
+
+bool Trace::enabled()
+{
+   return _enabled.load( std::memory_order_relaxed );
+}
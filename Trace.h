@@ -0,0 +1,59 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <string>
+
+#define TRACE_CONCAT_(a,b) a##b
+#define TRACE_CONCAT(a,b) TRACE_CONCAT_(a,b)
+
+/*
+ * Time the rest of the enclosing scope as a named span. The optional second
+ * argument is a string shown as the span's detail.
+ */
+#define TRACE_SCOPE(...) Trace::Span TRACE_CONCAT(_traceSpan, __LINE__)( __VA_ARGS__ )
+
+/*
+ * Timeline of scoped spans, written as Trace Event Format JSON for
+ * chrome://tracing or Perfetto.
+ *
+ * Spans are buffered per thread and appended to the file whenever a thread's
+ * outermost span ends (or its buffer fills), so the file stays loadable even
+ * if the process is killed. When tracing isn't enabled a span costs a single
+ * flag check.
+ */
+class Trace
+{
+public:
+   class Span
+   {
+   public:
+      explicit Span( const char* name );
+      Span( const char* name, const std::string& detail );
+      ~Span();
+
+   private:
+      Span( const Span& );
+      Span& operator =( const Span& );
+
+   private:
+      const char*                            _name;
+      std::string                            _detail;
+      std::chrono::steady_clock::time_point  _start;
+      bool                                   _active;
+   };
+
+public:
+   /*
+    * Start writing spans to the given file. Throws std::runtime_error if the
+    * file can't be created.
+    */
+   static void enable( const std::string& fileName );
+
+   static bool enabled();
+};
+
+#endif // !TRACE_H
@@ -3,22 +3,25 @@
 **/
 
 #include "Transaction.h"
+#include "Trace.h"
 
 #include <sstream>
 #include <cassert>
 #include <iomanip>
 #include <iostream>
+#include <stdexcept>
+#include <algorithm>
 
 using std::string;
 using std::stringstream;
 
-void TxnInput::deserialize( std::istream& serialStream )
+void TxnInput::deserialize( std::istream& serialStream, Arena* arena )
 {
    // Load the outpoint TXID
-   string hashStr( sizeof(Sha256::Digest) * 2, 0 );
-   serialStream.read( &hashStr[0], hashStr.size() );
-   ByteArray binaryTxid = hexStringToBinary( hashStr );
-   assert( binaryTxid.size() == sizeof(Sha256::Digest) );
+   char hashHex[sizeof(Sha256::Digest) * 2];
+   uint8_t binaryTxid[sizeof(Sha256::Digest)];
+   if( !serialStream.read(hashHex, sizeof(hashHex)) || !Hex::decode(hashHex, sizeof(hashHex), binaryTxid) )
+      throw std::runtime_error( "Invalid outpoint in transaction" );
    for( unsigned int i = 0; i < prevHash.size(); ++i )
    {
       prevHash[i] =   (binaryTxid[i * 4 + 0] << 0 * CHAR_BIT)
@@ -33,9 +36,7 @@ void TxnInput::deserialize( std::istream& serialStream )
    // Load the signature script
    int scriptSize = readVarInt( serialStream );
    assert( scriptSize <= 10000 );
-   string scriptSigStr( scriptSize * 2, 0 );
-   serialStream.read( &scriptSigStr[0], scriptSigStr.size() );
-   scriptSig = Script::deserialize( scriptSigStr );
+   scriptSig = Script::deserialize( serialStream, scriptSize, arena );
 
    // Load the sequence number
    sequence = readInt<int>( serialStream );
@@ -43,7 +44,6 @@ void TxnInput::deserialize( std::istream& serialStream )
 
 void TxnInput::serialize( std::ostream& serialStream ) const
 {
-   serialStream << std::hex << std::setfill('0');
    for( auto elem : prevHash )
    {
       writeInt( serialStream, elem );
@@ -54,16 +54,14 @@ void TxnInput::serialize( std::ostream& serialStream ) const
    writeInt( serialStream, sequence );
 }
 
-void TxnOutput::deserialize( std::istream& serialStream )
+void TxnOutput::deserialize( std::istream& serialStream, Arena* arena )
 {
    // Load the value
    value = readInt<int64_t>( serialStream );
 
    // Load the pubkey script
    int scriptSize = readVarInt( serialStream );
-   string scriptPubKeyStr( scriptSize * 2, 0 );
-   serialStream.read( &scriptPubKeyStr[0], scriptPubKeyStr.size() );
-   scriptPubKey = Script::deserialize( scriptPubKeyStr );
+   scriptPubKey = Script::deserialize( serialStream, scriptSize, arena );
 }
 
 void TxnOutput::serialize( std::ostream& serialStream ) const
@@ -73,10 +71,19 @@ void TxnOutput::serialize( std::ostream& serialStream ) const
    serialStream << scriptPubKey;
 }
 
-void Transaction::serialize( std::ostream& serialStream ) const
+void Transaction::serialize( std::ostream& serialStream, bool withWitness ) const
 {
+   withWitness = withWitness && hasWitness();
+
    writeInt( serialStream, version );
 
+   // Marker and flag
+   if( withWitness )
+   {
+      writeInt<uint8_t>( serialStream, 0 );
+      writeInt<uint8_t>( serialStream, 1 );
+   }
+
    writeVarInt( serialStream, inputs.size() );
    for( auto& input : inputs )
       input.serialize( serialStream );
@@ -85,10 +92,41 @@ void Transaction::serialize( std::ostream& serialStream ) const
    for( auto& output : outputs )
       output.serialize( serialStream );
 
+   if( withWitness )
+   {
+      for( auto& input : inputs )
+      {
+         writeVarInt( serialStream, input.witness.size() );
+         for( auto& item : input.witness )
+         {
+            writeVarInt( serialStream, item.size() );
+            serialStream << item;
+         }
+      }
+   }
+
    writeInt( serialStream, lockTime );
 }
 
+bool Transaction::hasWitness() const
+{
+   for( auto& input : inputs )
+   {
+      if( !input.witness.empty() )
+         return true;
+   }
+   return false;
+}
+
 ByteArray Transaction::id() const
+{
+   std::ostringstream stream;
+   serialize( stream, false );
+   ByteArray binaryData = hexStringToBinary( stream.str() );
+   return Sha256::doubleHash( binaryData );
+}
+
+ByteArray Transaction::witnessId() const
 {
    std::ostringstream stream;
    serialize( stream );
@@ -96,23 +134,81 @@ ByteArray Transaction::id() const
    return Sha256::doubleHash( binaryData );
 }
 
+void Transaction::setWitnessCommitment( const Sha256::RawDigest& witnessRoot )
+{
+   static const uint8_t COMMITMENT_HEADER[] = { 0xaa, 0x21, 0xa9, 0xed };
+
+   // The root is committed along with a reserved value, which the coinbase's
+   // witness gives (all zeros, as no soft fork has given it a meaning yet)
+   ByteArray reserved( sizeof(Sha256::RawDigest), 0 );
+   ByteArray preimage( witnessRoot.begin(), witnessRoot.end() );
+   preimage.insert( preimage.end(), reserved.begin(), reserved.end() );
+
+   ByteArray commitment( COMMITMENT_HEADER, COMMITMENT_HEADER + sizeof(COMMITMENT_HEADER) );
+   auto hash = Sha256::doubleHash( preimage );
+   commitment.insert( commitment.end(), hash.begin(), hash.end() );
+
+   auto arena = outputs.get_allocator().arena();
+   Script script( arena );
+   script << OP_RETURN << Script::Data(commitment);
+
+   // Validation uses the last output that looks like a commitment
+   Output* existing = nullptr;
+   for( auto& output : outputs )
+   {
+      auto& pubKey = output.scriptPubKey;
+      if( pubKey.size() >= 2 + commitment.size() && pubKey[0] == OP_RETURN && pubKey[1] == commitment.size() &&
+          std::equal(COMMITMENT_HEADER, COMMITMENT_HEADER + sizeof(COMMITMENT_HEADER), pubKey.begin() + 2) )
+      {
+         existing = &output;
+      }
+   }
+
+   if( existing == nullptr )
+   {
+      outputs.emplace_back();
+      existing = &outputs.back();
+      existing->value = 0;
+   }
+   existing->scriptPubKey = std::move( script );
+
+   auto& witness = inputs[0].witness;
+   witness = Witness( ArenaAllocator<Script>(arena) );
+   witness.emplace_back( arena );
+   witness.back().assign( reserved.begin(), reserved.end() );
+}
+
+Transaction::Transaction( Arena* arena )
+ : inputs(ArenaAllocator<Input>(arena)),
+   outputs(ArenaAllocator<Output>(arena))
+{
+}
+
 TransactionPtr Transaction::createCoinbase( int blockHeight,
                                             int64_t coinbaseValue,
-                                            const ByteArray& pubKeyHash )
+                                            const ByteArray& pubKeyHash,
+                                            Arena* arena,
+                                            const ByteArray& extraData )
 {
-   TransactionPtr coinbaseTxn( new Transaction );
+   auto coinbaseTxn = makeArenaPtr<Transaction>( arena, arena );
 
    coinbaseTxn->version = 1;
    coinbaseTxn->inputs.resize( 1 );
    auto& coinbaseInput = coinbaseTxn->inputs[0];
    coinbaseInput.prevHash.fill( 0 );
    coinbaseInput.prevN = -1;
+   coinbaseInput.scriptSig = Script( arena );
    coinbaseInput.scriptSig << Script::Data(blockHeight)
                            << 0 << 0 << 0 << 0;
+   if( !extraData.empty() )
+   {
+      coinbaseInput.scriptSig << Script::Data(extraData);
+   }
    coinbaseInput.sequence = 0;
    coinbaseTxn->outputs.resize( 1 );
    auto& coinbaseOutput = coinbaseTxn->outputs[0];
    coinbaseOutput.value = coinbaseValue;
+   coinbaseOutput.scriptPubKey = Script( arena );
    coinbaseOutput.scriptPubKey << OP_DUP << OP_HASH160
                                << Script::Data(pubKeyHash)
                                << OP_EQUALVERIFY << OP_CHECKSIG;
@@ -120,22 +216,52 @@ TransactionPtr Transaction::createCoinbase( int blockHeight,
    return coinbaseTxn;
 }
 
-TransactionPtr Transaction::deserialize( const std::string& serializedTxnStr )
+TransactionPtr Transaction::deserialize( const std::string& serializedTxnStr, Arena* arena )
+{
+   MemoryStreamBuf buffer( serializedTxnStr.data(), serializedTxnStr.size() );
+   std::istream txnSerialStream( &buffer );
+   return deserialize( txnSerialStream, arena );
+}
+
+TransactionPtr Transaction::deserialize( std::istream& txnSerialStream, Arena* arena )
 {
-   TransactionPtr txn( new Transaction );
-   std::istringstream txnSerialStream( serializedTxnStr );
+   TRACE_SCOPE( "Transaction::deserialize" );
+
+   auto txn = makeArenaPtr<Transaction>( arena, arena );
 
    txn->version = readInt<int>( txnSerialStream );
 
+   // An empty input list is the segwit marker, followed by the flag
+   auto inputCount = readVarInt( txnSerialStream );
+   bool segwit = (inputCount == 0);
+   if( segwit )
+   {
+      if( readInt<uint8_t>(txnSerialStream) != 1 )
+         throw std::runtime_error( "Unknown transaction serialization flag" );
+      inputCount = readVarInt( txnSerialStream );
+   }
+
    // Load inputs
-   txn->inputs.resize( readVarInt(txnSerialStream) );
+   txn->inputs.resize( inputCount );
    for( auto& input : txn->inputs )
-      input.deserialize( txnSerialStream );
+      input.deserialize( txnSerialStream, arena );
 
    // Load outputs
    txn->outputs.resize( readVarInt(txnSerialStream) );
    for( auto& output : txn->outputs )
-      output.deserialize( txnSerialStream );
+      output.deserialize( txnSerialStream, arena );
+
+   // Load witnesses, one stack per input
+   if( segwit )
+   {
+      for( auto& input : txn->inputs )
+      {
+         input.witness = Witness( ArenaAllocator<Script>(arena) );
+         input.witness.resize( readVarInt(txnSerialStream), Script(arena) );
+         for( auto& item : input.witness )
+            item = Script::deserialize( txnSerialStream, readVarInt(txnSerialStream), arena );
+      }
+   }
 
    txn->lockTime = readInt<int>( txnSerialStream );
 
@@ -7,30 +7,36 @@
 #include "Sha256.h"
 #include "Util.h"
 #include "Script.h"
+#include "Arena.h"
 
 #include <string>
 #include <limits>
+#include <memory>
 
 class Transaction;
-typedef std::unique_ptr<Transaction> TransactionPtr;
+typedef ArenaPtr<Transaction> TransactionPtr;
 
 class Transaction
 {
 public:
+   // Witness stack items
+   typedef std::vector<Script, ArenaAllocator<Script>> Witness;
+
    struct Input
    {
-      void deserialize( std::istream& inStream );
+      void deserialize( std::istream& inStream, Arena* arena = nullptr );
       void serialize( std::ostream& outStream ) const;
 
       Sha256::Digest prevHash;
       int            prevN;
       Script         scriptSig;
       int            sequence;
+      Witness        witness;
    };
 
    struct Output
    {
-      void deserialize( std::istream& inStream );
+      void deserialize( std::istream& inStream, Arena* arena = nullptr );
       void serialize( std::ostream& outStream ) const;
 
       int64_t  value;
@@ -38,21 +44,45 @@ public:
    };
 
 public:
-   void serialize( std::ostream& outStream ) const;
+   /*
+    * Transactions belonging to a template live in its arena (see Block).
+    */
+   Transaction( Arena* arena = nullptr );
+
+   /*
+    * Witness data is only serialized if there is any (BIP 144).
+    */
+   void serialize( std::ostream& outStream, bool withWitness = true ) const;
+   bool hasWitness() const;
+
    ByteArray id() const;
+   ByteArray witnessId() const;
+
+   /*
+    * Commit a coinbase to the block's witness merkle root (BIP 141), adding
+    * the commitment output, or updating it if there already is one.
+    */
+   void setWitnessCommitment( const Sha256::RawDigest& witnessRoot );
 
 public:
-   int                  version;
-   int                  lockTime;
-   std::vector<Input>   inputs;
-   std::vector<Output>  outputs;
+   int                                             version;
+   int                                             lockTime;
+   std::vector<Input, ArenaAllocator<Input>>       inputs;
+   std::vector<Output, ArenaAllocator<Output>>     outputs;
 
 public:
+   /*
+    * Any extra data (e.g. a merged mining commitment) is pushed onto the end
+    * of the scriptSig.
+    */
    static TransactionPtr createCoinbase( int blockHeight,
                                          int64_t coinbaseValue,
-                                         const ByteArray& pubKeyHash );
+                                         const ByteArray& pubKeyHash,
+                                         Arena* arena = nullptr,
+                                         const ByteArray& extraData = ByteArray() );
 
-   static TransactionPtr deserialize( const std::string& serializedTxnStr );
+   static TransactionPtr deserialize( const std::string& serializedTxnStr, Arena* arena = nullptr );
+   static TransactionPtr deserialize( std::istream& serialStream, Arena* arena = nullptr );
 };
 
 typedef Transaction::Input TxnInput;
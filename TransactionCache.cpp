@@ -0,0 +1,92 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "TransactionCache.h"
+
+#include <iterator>
+
+TransactionCache::TransactionCache( size_t capacity )
+ : _capacity(capacity),
+   _hits(0),
+   _misses(0),
+   _evictions(0)
+{
+   _index.reserve( capacity );
+}
+
+const TransactionCache::Entry* TransactionCache::find( const std::string& key )
+{
+   auto found = _index.find( key );
+   if( found == _index.end() )
+   {
+      ++_misses;
+      return nullptr;
+   }
+
+   ++_hits;
+   _entries.splice( _entries.begin(), _entries, found->second );
+   return &found->second->second;
+}
+
+void TransactionCache::insert( const std::string& key, const uint8_t* raw, size_t size,
+                               const Sha256::RawDigest& txid, const Sha256::RawDigest& wtxid )
+{
+   if( _capacity == 0 )
+   {
+      return;
+   }
+
+   auto found = _index.find( key );
+   if( found != _index.end() )
+   {
+      _entries.splice( _entries.begin(), _entries, found->second );
+   }
+   else
+   {
+      // Reuse the evicted entry's node (and buffer) for the new one
+      if( _entries.size() >= _capacity )
+      {
+         _index.erase( _entries.back().first );
+         _entries.splice( _entries.begin(), _entries, std::prev(_entries.end()) );
+         ++_evictions;
+      }
+      else
+      {
+         _entries.emplace_front();
+      }
+
+      _entries.front().first = key;
+      _index.emplace( key, _entries.begin() );
+   }
+
+   auto& entry = _entries.front().second;
+   entry.raw.assign( raw, raw + size );
+   entry.txid = txid;
+   entry.wtxid = wtxid;
+}
+
+size_t TransactionCache::size() const
+{
+   return _entries.size();
+}
+
+size_t TransactionCache::capacity() const
+{
+   return _capacity;
+}
+
+uint64_t TransactionCache::hits() const
+{
+   return _hits;
+}
+
+uint64_t TransactionCache::misses() const
+{
+   return _misses;
+}
+
+uint64_t TransactionCache::evictions() const
+{
+   return _evictions;
+}
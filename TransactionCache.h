@@ -0,0 +1,71 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef TRANSACTION_CACHE_H
+#define TRANSACTION_CACHE_H
+
+#include "Sha256.h"
+#include "Util.h"
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Bounded LRU cache of decoded template transactions and their IDs, keyed
+ * by the txid the template gives for them. Consecutive templates share most
+ * of their transactions, so only the newly arrived ones need hashing.
+ */
+class TransactionCache
+{
+public:
+   struct Entry
+   {
+      ByteArray         raw;
+      Sha256::RawDigest txid;
+      Sha256::RawDigest wtxid;
+   };
+
+public:
+   /*
+    * A capacity of 0 disables the cache.
+    */
+   explicit TransactionCache( size_t capacity );
+
+   /*
+    * Returns nullptr if the key isn't cached. A hit becomes the most
+    * recently used entry.
+    */
+   const Entry* find( const std::string& key );
+
+   /*
+    * Add (or replace) an entry, evicting the least recently used one if
+    * the cache is full.
+    */
+   void insert( const std::string& key, const uint8_t* raw, size_t size,
+                const Sha256::RawDigest& txid, const Sha256::RawDigest& wtxid );
+
+   /*
+    * Statistics
+    */
+   size_t size() const;
+   size_t capacity() const;
+   uint64_t hits() const;
+   uint64_t misses() const;
+   uint64_t evictions() const;
+
+private:
+   // Most recently used first
+   typedef std::list<std::pair<std::string, Entry>> EntryList;
+
+   size_t                                                _capacity;
+   EntryList                                             _entries;
+   std::unordered_map<std::string, EntryList::iterator>  _index;
+
+   uint64_t _hits;
+   uint64_t _misses;
+   uint64_t _evictions;
+};
+
+#endif // !TRANSACTION_CACHE_H
@@ -0,0 +1,333 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+
+#include "TransactionList.h"
+#include "Hex.h"
+#include "TaskPool.h"
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <numeric>
+#include <sstream>
+
+// Transactions hashed per pool task
+const size_t HASH_GRAIN = 64;
+
+// Bounds-checked cursor over a raw transaction; any overrun makes it invalid
+class RawCursor
+{
+public:
+   RawCursor( const uint8_t* data, size_t size )
+    : _data(data),
+      _pos(0),
+      _size(size),
+      _valid(true)
+   {
+   }
+
+   void skip( uint64_t bytes )
+   {
+      if( bytes > _size - _pos )
+      {
+         _valid = false;
+         _pos = _size;
+         return;
+      }
+      _pos += bytes;
+   }
+
+   uint8_t byte()
+   {
+      if( _pos >= _size )
+      {
+         _valid = false;
+         return 0;
+      }
+      return _data[_pos++];
+   }
+
+   uint64_t varInt()
+   {
+      uint8_t prefix = byte();
+      int bytes = prefix == 0xff ? 8 : prefix == 0xfe ? 4 : prefix == 0xfd ? 2 : 0;
+      if( bytes == 0 )
+      {
+         return prefix;
+      }
+
+      uint64_t n = 0;
+      for( int i = 0; i < bytes; ++i )
+      {
+         n |= static_cast<uint64_t>( byte() ) << (i * CHAR_BIT);
+      }
+      return n;
+   }
+
+   size_t pos() const   { return _pos; }
+   bool valid() const   { return _valid; }
+
+private:
+   const uint8_t* _data;
+   size_t         _pos;
+   size_t         _size;
+   bool           _valid;
+};
+
+size_t TransactionList::hashRaw( const uint8_t* data, size_t size,
+                                 Sha256::RawDigest& txid, Sha256::RawDigest& wtxid, ByteArray& scratch )
+{
+   RawCursor cursor( data, size );
+   cursor.skip( 4 ); // version
+
+   // A zero input count is the segwit marker, followed by the flag
+   bool segwit = false;
+   uint64_t inputCount = cursor.varInt();
+   if( inputCount == 0 )
+   {
+      if( cursor.byte() != 1 )
+      {
+         return 0;
+      }
+      segwit = true;
+      inputCount = cursor.varInt();
+   }
+
+   for( uint64_t i = 0; i < inputCount && cursor.valid(); ++i )
+   {
+      cursor.skip( 36 ); // outpoint
+      cursor.skip( cursor.varInt() ); // scriptSig
+      cursor.skip( 4 ); // sequence
+   }
+
+   uint64_t outputCount = cursor.varInt();
+   for( uint64_t i = 0; i < outputCount && cursor.valid(); ++i )
+   {
+      cursor.skip( 8 ); // value
+      cursor.skip( cursor.varInt() ); // scriptPubKey
+   }
+   size_t outputsEnd = cursor.pos();
+
+   if( segwit )
+   {
+      for( uint64_t i = 0; i < inputCount && cursor.valid(); ++i )
+      {
+         uint64_t items = cursor.varInt();
+         for( uint64_t j = 0; j < items && cursor.valid(); ++j )
+         {
+            cursor.skip( cursor.varInt() );
+         }
+      }
+   }
+   cursor.skip( 4 ); // lock time
+
+   if( !cursor.valid() )
+   {
+      return 0;
+   }
+
+   size_t end = cursor.pos();
+   Sha256::doubleHash( data, end, wtxid );
+   if( !segwit )
+   {
+      txid = wtxid;
+      return end;
+   }
+
+   // Version, then everything from the input count to the end of the
+   // outputs (skipping the marker and flag), then the lock time
+   scratch.assign( data, data + 4 );
+   scratch.insert( scratch.end(), data + 6, data + outputsEnd );
+   scratch.insert( scratch.end(), data + end - 4, data + end );
+   Sha256::doubleHash( scratch.data(), scratch.size(), txid );
+   return end;
+}
+
+TransactionList::TransactionList()
+ : _witnessCount(0)
+{
+}
+
+void TransactionList::reserve( size_t count, size_t bytes )
+{
+   _bytes.reserve( bytes );
+   _offsets.reserve( count );
+   _sizes.reserve( count );
+   _txids.reserve( count );
+   _wtxids.reserve( count );
+   _fees.reserve( count );
+}
+
+bool TransactionList::append( const uint8_t* data, size_t size, int64_t fee )
+{
+   size_t offset = _bytes.size();
+   _bytes.insert( _bytes.end(), data, data + size );
+   return _commit( offset, fee );
+}
+
+void TransactionList::append( const uint8_t* data, size_t size,
+                              const Sha256::RawDigest& txid, const Sha256::RawDigest& wtxid, int64_t fee )
+{
+   size_t offset = _bytes.size();
+   _bytes.insert( _bytes.end(), data, data + size );
+   _commit( offset, txid, wtxid, fee );
+}
+
+bool TransactionList::appendHex( const char* hex, size_t length, int64_t fee )
+{
+   size_t offset = _bytes.size();
+   _bytes.resize( offset + length / 2 );
+   if( !Hex::decode(hex, length, _bytes.data() + offset) )
+   {
+      _bytes.resize( offset );
+      return false;
+   }
+
+   return _commit( offset, fee );
+}
+
+void TransactionList::append( const Transaction& txn, int64_t fee )
+{
+   std::ostringstream stream;
+   txn.serialize( stream );
+   auto hex = stream.str();
+
+   bool decoded = appendHex( hex.data(), hex.size(), fee );
+   assert( decoded );
+   (void)decoded;
+}
+
+void TransactionList::appendUnhashed( const uint8_t* data, size_t size, int64_t fee )
+{
+   size_t offset = _bytes.size();
+   _bytes.insert( _bytes.end(), data, data + size );
+
+   _unhashed.push_back( _offsets.size() );
+   _commit( offset, Sha256::RawDigest(), Sha256::RawDigest(), fee );
+}
+
+bool TransactionList::hashPending()
+{
+   std::atomic<bool> valid( true );
+   TaskPool::parallelFor( _unhashed.size(), HASH_GRAIN, [&](size_t begin, size_t end)
+   {
+      ByteArray scratch;
+      for( size_t i = begin; i < end; ++i )
+      {
+         auto index = _unhashed[i];
+         if( hashRaw(rawData(index), rawSize(index), _txids[index], _wtxids[index], scratch) != rawSize(index) )
+         {
+            valid = false;
+         }
+      }
+   } );
+
+   for( auto index : _unhashed )
+   {
+      if( _txids[index] != _wtxids[index] )
+      {
+         ++_witnessCount;
+      }
+   }
+
+   _unhashed.clear();
+   return valid;
+}
+
+bool TransactionList::_commit( size_t offset, int64_t fee )
+{
+   size_t size = _bytes.size() - offset;
+
+   // Exactly one whole transaction
+   Sha256::RawDigest txid;
+   Sha256::RawDigest wtxid;
+   if( hashRaw(_bytes.data() + offset, size, txid, wtxid, _scratch) != size )
+   {
+      _bytes.resize( offset );
+      return false;
+   }
+
+   _commit( offset, txid, wtxid, fee );
+   return true;
+}
+
+void TransactionList::_commit( size_t offset, const Sha256::RawDigest& txid, const Sha256::RawDigest& wtxid, int64_t fee )
+{
+   _offsets.push_back( offset );
+   _sizes.push_back( _bytes.size() - offset );
+   _txids.push_back( txid );
+   _wtxids.push_back( wtxid );
+   _fees.push_back( fee );
+   if( txid != wtxid )
+   {
+      ++_witnessCount;
+   }
+}
+
+void TransactionList::setFee( size_t index, int64_t fee )
+{
+   _fees[index] = fee;
+}
+
+size_t TransactionList::count() const
+{
+   return _offsets.size();
+}
+
+int64_t TransactionList::totalFees() const
+{
+   return std::accumulate( _fees.begin(), _fees.end(), static_cast<int64_t>(0) );
+}
+
+bool TransactionList::hasWitness() const
+{
+   return _witnessCount > 0;
+}
+
+const ByteArray& TransactionList::bytes() const
+{
+   return _bytes;
+}
+
+const uint8_t* TransactionList::rawData( size_t index ) const
+{
+   return _bytes.data() + _offsets[index];
+}
+
+size_t TransactionList::rawSize( size_t index ) const
+{
+   return _sizes[index];
+}
+
+const Sha256::RawDigest& TransactionList::txid( size_t index ) const
+{
+   return _txids[index];
+}
+
+const Sha256::RawDigest& TransactionList::wtxid( size_t index ) const
+{
+   return _wtxids[index];
+}
+
+int64_t TransactionList::fee( size_t index ) const
+{
+   return _fees[index];
+}
+
+const std::vector<Sha256::RawDigest>& TransactionList::txids() const
+{
+   return _txids;
+}
+
+const std::vector<Sha256::RawDigest>& TransactionList::wtxids() const
+{
+   return _wtxids;
+}
+
+TransactionPtr TransactionList::transaction( size_t index, Arena* arena ) const
+{
+   std::string hex( rawSize(index) * 2, '\0' );
+   Hex::encode( rawData(index), rawSize(index), &hex[0] );
+   return Transaction::deserialize( hex, arena );
+}
@@ -0,0 +1,117 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+**/
+#ifndef TRANSACTION_LIST_H
+#define TRANSACTION_LIST_H
+
+#include "Arena.h"
+#include "Sha256.h"
+#include "Transaction.h"
+#include "Util.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Transactions stored contiguously: their raw (binary) serializations, with
+ * any witness data, back to back in one buffer, with parallel arrays of
+ * offsets, sizes, txids, wtxids and fees.
+ * Serializing, merkle building and per-transaction scans stream linearly
+ * through memory rather than chasing a pointer per transaction.
+ */
+class TransactionList
+{
+public:
+   TransactionList();
+
+   void reserve( size_t count, size_t bytes );
+
+   /*
+    * Append a raw transaction, computing its txid and wtxid. Returns false
+    * (and appends nothing) if it isn't a well-formed transaction.
+    */
+   bool append( const uint8_t* data, size_t size, int64_t fee = 0 );
+
+   /*
+    * Append a raw transaction whose IDs are already known.
+    */
+   void append( const uint8_t* data, size_t size,
+                const Sha256::RawDigest& txid, const Sha256::RawDigest& wtxid, int64_t fee = 0 );
+
+   /*
+    * Append a hex-encoded transaction, decoding it straight into the buffer.
+    * Returns false (and appends nothing) if the hex or transaction is invalid.
+    */
+   bool appendHex( const char* hex, size_t length, int64_t fee = 0 );
+
+   void append( const Transaction& txn, int64_t fee = 0 );
+
+   /*
+    * Append a raw transaction without hashing it yet, so that many can be
+    * hashed at once by hashPending(). Its IDs aren't valid until then.
+    */
+   void appendUnhashed( const uint8_t* data, size_t size, int64_t fee = 0 );
+
+   /*
+    * Compute the IDs of everything appended unhashed, spread over the task
+    * pool. Returns false if any of them isn't exactly one well-formed
+    * transaction, which leaves the list unusable.
+    */
+   bool hashPending();
+
+   void setFee( size_t index, int64_t fee );
+
+   size_t count() const;
+   int64_t totalFees() const;
+
+   /*
+    * Whether any of the transactions has witness data, so the block needs a
+    * witness commitment.
+    */
+   bool hasWitness() const;
+
+   /*
+    * All the raw transactions, back to back.
+    */
+   const ByteArray& bytes() const;
+
+   const uint8_t* rawData( size_t index ) const;
+   size_t rawSize( size_t index ) const;
+   const Sha256::RawDigest& txid( size_t index ) const;
+   const Sha256::RawDigest& wtxid( size_t index ) const;
+   int64_t fee( size_t index ) const;
+
+   const std::vector<Sha256::RawDigest>& txids() const;
+   const std::vector<Sha256::RawDigest>& wtxids() const;
+
+   /*
+    * Decode one transaction into an object, for code that needs its fields.
+    */
+   TransactionPtr transaction( size_t index, Arena* arena = nullptr ) const;
+
+   /*
+    * Parse the raw transaction at the start of the data just far enough to
+    * compute its txid and wtxid in one pass (they're the same hash unless it
+    * has witness data, which is cut out of a copy for the txid). Returns the
+    * transaction's size, or 0 if it's malformed or truncated.
+    */
+   static size_t hashRaw( const uint8_t* data, size_t size,
+                          Sha256::RawDigest& txid, Sha256::RawDigest& wtxid, ByteArray& scratch );
+
+private:
+   bool _commit( size_t offset, int64_t fee );
+   void _commit( size_t offset, const Sha256::RawDigest& txid, const Sha256::RawDigest& wtxid, int64_t fee );
+
+private:
+   ByteArray                        _bytes;
+   std::vector<uint32_t>            _offsets;
+   std::vector<uint32_t>            _sizes;
+   std::vector<Sha256::RawDigest>   _txids;
+   std::vector<Sha256::RawDigest>   _wtxids;
+   std::vector<int64_t>             _fees;
+   size_t                           _witnessCount;
+   std::vector<uint32_t>            _unhashed;
+   ByteArray                        _scratch;
+};
+
+#endif // !TRANSACTION_LIST_H
@@ -4,9 +4,11 @@
 
 #include "Util.h"
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
 #include <iomanip>
+#include <stdexcept>
 
 using namespace std;
 
@@ -34,15 +36,15 @@ void reverseHexBytes( string& ba )
 
 int64_t readVarInt( std::istream& ss )
 {
-   uint8_t prefix = hexToInt(ss.get()) << 4 | hexToInt(ss.get());
+   uint8_t prefix = readInt<uint8_t>( ss );
    switch( prefix )
    {
    case 0xff:
-      return readInt<int64_t>( ss );
+      return readInt<uint64_t>( ss );
    case 0xfe:
-      return readInt<int32_t>( ss );
+      return readInt<uint32_t>( ss );
    case 0xfd:
-      return readInt<int16_t>( ss );
+      return readInt<uint16_t>( ss );
    default:
       return prefix;
    }
@@ -50,26 +52,26 @@ int64_t readVarInt( std::istream& ss )
 
 void writeVarInt( std::ostream& ss, int64_t n )
 {
+   // Multi-byte values are little-endian, like all other integers
    uint64_t un = n;
-   ss << hex << setfill('0');
    if( un < 0xfd )
    {
-      ss << setw(2) << static_cast<unsigned int>(un);
+      writeInt( ss, static_cast<uint8_t>(un) );
    }
-   else if( un < 0xffff )
+   else if( un <= 0xffff )
    {
       ss << "fd";
-      ss << setw(4) << static_cast<unsigned int>(un);
+      writeInt( ss, static_cast<uint16_t>(un) );
    }
-   else if( un < 0xffffffff )
+   else if( un <= 0xffffffff )
    {
       ss << "fe";
-      ss << setw(8) << static_cast<unsigned int>(un);
+      writeInt( ss, static_cast<uint32_t>(un) );
    }
    else
    {
       ss << "ff";
-      ss << setw(16) << un;
+      writeInt( ss, un );
    }
 }
 
@@ -94,11 +96,14 @@ ByteArray bitsToTarget( uint32_t bits )
    }
    else
    {
+      // Bytes shifted past the top of the target are dropped (callers
+      // check for overflow)
       int shf = size - 3;
-      result[31 - shf] = word & 0xFF; word >>= 8;
-      result[30 - shf] = word & 0xFF; word >>= 8;
-      result[29 - shf] = word & 0xFF; word >>= 8;
-      result[28 - shf] = word & 0xFF;
+      for( int i = 31; i >= 28 && i - shf >= 0; --i )
+      {
+         result[i - shf] = word & 0xFF;
+         word >>= 8;
+      }
    }
 
    return result;
@@ -117,31 +122,31 @@ int hexToInt( char c )
 
 ByteArray hexStringToBinary( const string& str )
 {
-   assert( str.size() % 2 == 0 );
-
-   ByteArray result;
-
-   for( unsigned i = 0; i < str.size(); i += 2 )
-   {
-      uint8_t val = hexToInt( str[i] );
-      val <<= 4;
-      val |= hexToInt( str[i+1] );
-      result.push_back( val );
-   }
+   ByteArray result( str.size() / 2 );
+   if( !Hex::decode(str.data(), str.size(), result.data()) )
+      throw runtime_error( "Invalid hex string" );
 
    return result;
 }
 
 std::ostream& operator <<( std::ostream& outputStream, const ByteArray& byteArray )
 {
-   outputStream << std::hex << std::setfill('0');
+   writeHex( outputStream, byteArray.data(), byteArray.size() );
+   return outputStream;
+}
+
+void writeHex( std::ostream& outputStream, const uint8_t* data, size_t size )
+{
+   // Encode in blocks, to avoid allocating a string for large data
+   const size_t BLOCK_SIZE = 2048;
+   char hex[BLOCK_SIZE * 2];
 
-   for( auto byte : byteArray )
+   for( size_t offset = 0; offset < size; offset += BLOCK_SIZE )
    {
-      outputStream << std::setw(2) << static_cast<int>(byte);
+      auto count = std::min( BLOCK_SIZE, size - offset );
+      Hex::encode( data + offset, count, hex );
+      outputStream.write( hex, count * 2 );
    }
-
-   return outputStream;
 }
 
 bool isLittleEndian()
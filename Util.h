@@ -4,12 +4,16 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include "Hex.h"
+
 #include <string>
 #include <istream>
 #include <cstdint>
 #include <vector>
 #include <iomanip>
 #include <climits>
+#include <streambuf>
+#include <stdexcept>
 
 #define SATOSHIS_PER_BITCOIN 100000000
 
@@ -23,9 +27,24 @@ ByteArray bitsToTarget( uint32_t bits );
 int hexToInt( char c );
 ByteArray hexStringToBinary( const std::string& str );
 std::ostream& operator <<( std::ostream& outputStream, const ByteArray& byteArray );
+void writeHex( std::ostream& outputStream, const uint8_t* data, size_t size );
 bool isLittleEndian();
 bool isPowerOfTwo( int n );
 
+//
+// Read-only stream buffer over existing memory, so data can be parsed with
+// an istream without being copied first (as std::istringstream would).
+//
+class MemoryStreamBuf : public std::streambuf
+{
+public:
+   MemoryStreamBuf( const char* data, size_t size )
+   {
+      char* begin = const_cast<char*>(data);
+      setg( begin, begin, begin + size );
+   }
+};
+
 //
 // Functions that can read and write integers on a stream of hex characters
 //
@@ -35,24 +54,32 @@ void     writeVarInt( std::ostream& ss, int64_t n );
 template<typename T>
 T readInt( std::istream& ss )
 {
-   std::string str( sizeof(T) * 2, '\0' );
-   for( auto& ch : str )
-      ss.get( ch );
+   char hex[sizeof(T) * 2];
+   uint8_t bytes[sizeof(T)];
+   if( !ss.read(hex, sizeof(hex)) || !Hex::decode(hex, sizeof(hex), bytes) )
+      throw std::runtime_error( "Invalid serialized integer" );
 
-   reverseHexBytes( str );
+   // Little-endian
+   uint64_t n = 0;
+   for( int i = sizeof(T) - 1; i >= 0; --i )
+      n = n << CHAR_BIT | bytes[i];
 
-   return static_cast<T>(std::stoll(str,nullptr,16));
+   return static_cast<T>(n);
 }
 
 template<typename T>
 void writeInt( std::ostream& ss, T n )
 {
-   ss << std::hex << std::setfill('0');
+   uint8_t bytes[sizeof(T)];
    for( unsigned int i = 0; i < sizeof(T); ++i )
    {
-      ss << std::setw(2) << (n & 0xff);
+      bytes[i] = n & 0xff;
       n >>= CHAR_BIT;
    }
+
+   char hex[sizeof(T) * 2];
+   Hex::encode( bytes, sizeof(bytes), hex );
+   ss.write( hex, sizeof(hex) );
 }
 
 #endif // UTIL_H
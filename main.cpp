@@ -10,6 +10,18 @@
 #include "Radix.h"
 #include "Block.h"
 #include "Miner.h"
+#include "Scheduler.h"
+#include "Benchmark.h"
+#include "Autotune.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "SelfTest.h"
+#include "TemplateParser.h"
+#include "BlockAssembler.h"
+#include "MergedMining.h"
+#include "P2pPeer.h"
+#include "ShareLog.h"
+#include "ControlSocket.h"
 
 #include <cassert>
 #include <algorithm>
@@ -25,25 +37,24 @@
 
 using namespace std;
 
-std::unique_ptr<Block> createBlockTemplate( JsonRpc& rpc, const ByteArray& coinbasePubKeyHash )
+std::unique_ptr<Block> buildBlock( const Json::Value& blockTemplate, TransactionList&& txns, const ByteArray& coinbasePubKeyHash,
+                                   const ByteArray& auxCommitment )
 {
-   // Get block template
-   Json::Value params;
-   params[0u]["capabilities"] = Json::arrayValue;
-   auto blockTemplate = rpc.call( "getblocktemplate", params );
-
    if( blockTemplate.isMember("coinbasetxn") )
       throw std::runtime_error( "Coinbase txn already exists" );
 
+   std::unique_ptr<Block> block( new Block );
+
    auto coinbaseValue = blockTemplate["coinbasevalue"].asInt64();
 
    // Create coinbase transaction
    auto coinbaseTxn = Transaction::createCoinbase( blockTemplate["height"].asInt(),
                                                    coinbaseValue,
-                                                   coinbasePubKeyHash );
+                                                   coinbasePubKeyHash,
+                                                   block->arena(),
+                                                   auxCommitment );
 
-   // Create block
-   std::unique_ptr<Block> block( new Block );
+   // Fill in the header
    block->header.version = blockTemplate["version"].asInt();
    block->header.time = blockTemplate["curtime"].asInt();
    block->header.bits = stoi( blockTemplate["bits"].asString(), nullptr, 16 );
@@ -51,22 +62,90 @@ std::unique_ptr<Block> createBlockTemplate( JsonRpc& rpc, const ByteArray& coinb
    std::reverse( prevBlockHash.begin(), prevBlockHash.end() );
    block->setPrevBlockHash( prevBlockHash );
    // Add all the transactions
-   block->appendTransaction( std::move(coinbaseTxn) );
-   auto txnArray = blockTemplate["transactions"];
-   assert( txnArray.isArray() );
-   for( unsigned i = 0; i < txnArray.size(); ++i )
+   block->setCoinbase( std::move(coinbaseTxn) );
+   block->setTransactions( std::move(txns) );
+   block->updateHeader();
+
+   return block;
+}
+
+// Returns null if the node would accept the block, apart from its proof of
+// work, otherwise the reason it wouldn't
+Json::Value proposeBlock( JsonRpc& rpc, const Block& block )
+{
+   TRACE_SCOPE( "proposeBlock" );
+
+   std::ostringstream stream;
+   block.serialize( stream );
+
+   Json::Value params;
+   params[0u]["mode"] = "proposal";
+   params[0u]["data"] = stream.str();
+   return rpc.call( "getblocktemplate", params );
+}
+
+std::unique_ptr<Block> createBlockTemplate( JsonRpc& rpc, TransactionCache& txCache,
+                                            BlockAssembler* assembler, const ByteArray& coinbasePubKeyHash,
+                                            const ByteArray& auxCommitment )
+{
+   TRACE_SCOPE( "createBlockTemplate" );
+
+   if( assembler != nullptr )
    {
-      auto txnData = txnArray[i]["data"].asString();
-      auto txn = Transaction::deserialize( txnData );
-      block->appendTransaction( std::move(txn) );
+      Json::Value fields;
+      TransactionList txns;
+      if( assembler->assemble(fields, txns) )
+      {
+         auto block = buildBlock( fields, std::move(txns), coinbasePubKeyHash, auxCommitment );
+         auto rejection = proposeBlock( rpc, *block );
+         if( rejection.isNull() )
+         {
+            Metrics::templateCreated();
+            return block;
+         }
+
+         cout << "Assembled block rejected (" << rejection.asString() << "), "
+              << "falling back to getblocktemplate" << endl;
+         assembler->reset();
+      }
    }
-   block->updateHeader();
+
+   // Get block template, decoding the transactions as the reply streams in
+   // Nodes refuse templates to miners that don't follow segwit's rules
+   Json::Value params;
+   params[0u]["capabilities"] = Json::arrayValue;
+   params[0u]["rules"].append( "segwit" );
+   TemplateParser parser( &txCache );
+   auto hits = txCache.hits();
+   rpc.call( "getblocktemplate", params, parser );
+
+   if( Settings::debug() )
+   {
+      auto count = parser.transactions().count();
+      auto templateHits = txCache.hits() - hits;
+      auto lookups = txCache.hits() + txCache.misses();
+      cout << "Transaction cache: " << templateHits << " of " << count << " template transactions cached, "
+           << txCache.size() << " entries, "
+           << (lookups > 0 ? 100.0 * txCache.hits() / lookups : 0.0) << "% hit rate overall, "
+           << txCache.evictions() << " evictions" << endl;
+   }
+
+   if( assembler != nullptr )
+   {
+      assembler->setBase( parser.fields(), parser.transactions().totalFees() );
+   }
+
+   auto block = buildBlock( parser.fields(), std::move(parser.transactions()), coinbasePubKeyHash, auxCommitment );
+
+   Metrics::templateCreated();
 
    return block;
 }
 
 Json::Value submitBlock( JsonRpc& rpc, const Block& block )
 {
+   TRACE_SCOPE( "submitBlock" );
+
    std::ostringstream stream;
    block.serialize( stream );
 
@@ -75,26 +154,78 @@ Json::Value submitBlock( JsonRpc& rpc, const Block& block )
    return rpc.call( "submitblock", params );
 }
 
-Miner::Result mineSingleBlock( JsonRpc& rpc, Miner& miner, const ByteArray& coinbasePubKeyHash )
+Miner::Result mineSingleBlock( JsonRpc& rpc, Scheduler& scheduler, TransactionCache& txCache,
+                               BlockAssembler* assembler, MergedMining& merged, P2pPeer* peer,
+                               ShareLog& shares, const ByteArray& coinbasePubKeyHash )
 {
-   auto block = createBlockTemplate( rpc, coinbasePubKeyHash );
+   auto auxCommitment = merged.update();
+   auto block = createBlockTemplate( rpc, txCache, assembler, coinbasePubKeyHash, auxCommitment );
+
+   Miner::Result result;
+   if( auxCommitment.empty() && !shares.enabled() )
+   {
+      result = scheduler.mine( *block );
+   }
+   else
+   {
+      // Search at the easiest target, so every chain's solutions and every
+      // share are seen
+      auto target = bitsToTarget( block->header.bits );
+      auto searchTarget = merged.easiestTarget( target );
+      if( shares.enabled() && shares.target() > searchTarget )
+      {
+         searchTarget = shares.target();
+      }
 
-   auto result = miner.mine( *block );
+      result = scheduler.mine( *block, searchTarget, [&](const Block::Header& header)
+      {
+         if( shares.enabled() && !shares.record(header, searchTarget) )
+         {
+            std::cout << "Kernel found a nonce that doesn't meet the target: " << header.nonce << std::endl;
+            return false;
+         }
+
+         if( !auxCommitment.empty() )
+         {
+            merged.submit( *block, header );
+         }
+         return Block::hashMeetsTarget( header, target );
+      } );
+   }
+
+   if( shares.enabled() )
+   {
+      shares.report( std::cout, scheduler.hashCount() );
+   }
    if( result == Miner::SolutionFound )
    {
       std::cout << "Solution found: " << std::endl
          << "\tHeader: " << block->headerData() << std::endl
          << "\tHash:   " << Sha256::doubleHash( &block->header, sizeof(block->header) ) << std::endl;
 
+      // The P2P message doesn't wait for the node to decode a hex block, so
+      // it usually wins, and submitblock then finds a duplicate
+      bool relayed = peer != nullptr && peer->sendBlock( *block );
       auto response = submitBlock( rpc, *block );
+      if( relayed && response.asString() == "duplicate" )
+      {
+         response = Json::Value();
+      }
+
       if( !response.isNull() )
       {
          std::cout << "Solution rejected! (" << response.asString() << ")" << std::endl;
+         Metrics::solutionRejected();
          return Miner::NoSolutionFound;
       }
       else
       {
          std::cout << "Solution accepted!" << std::endl;
+         Metrics::solutionAccepted();
+         if( assembler != nullptr )
+         {
+            assembler->blockAccepted( *block );
+         }
       }
    }
    else
@@ -106,19 +237,85 @@ Miner::Result mineSingleBlock( JsonRpc& rpc, Miner& miner, const ByteArray& coin
    return result;
 }
 
-void doMining( JsonRpc& rpc, Miner& miner, int blocksToMine )
+void doMining( JsonRpc& rpc, Scheduler& scheduler, int blocksToMine )
 {
-   // Get coinbase destination
-   auto coinbaseAddress = rpc.call( "getnewaddress" ).asString();
+   // Get coinbase destination, and some information about the network
+   auto replies = rpc.batch( { JsonRpc::Call("getnewaddress"), JsonRpc::Call("getmininginfo") } );
+   if( replies[0].failed() )
+   {
+      throw runtime_error( "Unable to get a coinbase address: " + replies[0].error["message"].asString() );
+   }
+
+   if( !replies[1].failed() )
+   {
+      auto& miningInfo = replies[1].result;
+      std::cout << "Mining on " << miningInfo["chain"].asString()
+                << " at height " << miningInfo["blocks"].asInt() + 1
+                << ", difficulty " << miningInfo["difficulty"].asDouble() << std::endl;
+   }
+
+   // The P2P network is the one the node is on
+   std::unique_ptr<P2pPeer> peer;
+   if( !Settings::p2pNode().empty() )
+   {
+      if( replies[1].failed() )
+      {
+         throw runtime_error( "Unable to find the node's network for P2P: " + replies[1].error["message"].asString() );
+      }
+      peer.reset( new P2pPeer(Settings::p2pNode(), P2pMessage::networkMagic(replies[1].result["chain"].asString())) );
+   }
+
+   auto coinbaseAddress = replies[0].result.asString();
    // Convert address to pubkey hash
    auto coinbasePubKeyHash = Radix::base58DecodeCheck( coinbaseAddress );
    // Remove leading version byte
    coinbasePubKeyHash.erase( coinbasePubKeyHash.begin() );
 
+   TransactionCache txCache( Settings::txCacheSize() );
+   std::unique_ptr<BlockAssembler> assembler;
+   if( Settings::assemble() )
+   {
+      assembler.reset( new BlockAssembler(rpc, &txCache) );
+   }
+
+   MergedMining merged( Settings::auxChains() );
+   ShareLog shares( Settings::shareDifficulty(), Settings::shareLogFile() );
+
    auto result = Miner::SolutionFound;
    while( result == Miner::SolutionFound && blocksToMine-- > 0 )
    {
-      result = mineSingleBlock( rpc, miner, coinbasePubKeyHash );
+      result = mineSingleBlock( rpc, scheduler, txCache, assembler.get(), merged, peer.get(), shares, coinbasePubKeyHash );
+   }
+}
+
+void doBenchmark()
+{
+   std::vector<std::string> types;
+   if( Settings::minerTypeSelected() && Settings::minerType() != AUTOTUNE_MINER_TYPE )
+   {
+      types.push_back( Settings::minerType() );
+   }
+   else
+   {
+      types = Miner::types();
+   }
+
+   std::chrono::seconds duration( Settings::benchmarkDuration() );
+
+   for( auto& type : types )
+   {
+      try
+      {
+         SelfTest::verifyMiner( type );
+      }
+      catch( std::exception& e )
+      {
+         std::cout << "Kernel \"" << type << "\" failed verification: " << e.what() << std::endl;
+         continue;
+      }
+
+      auto result = Benchmark::run( type, Settings::threads(), duration, Settings::benchmarkHashes() );
+      Benchmark::print( std::cout, result );
    }
 }
 
@@ -128,13 +325,60 @@ int main( int argc, char** argv )
    {
       Settings::init( argc, argv );
 
+      if( !Settings::traceFile().empty() )
+      {
+         Trace::enable( Settings::traceFile() );
+      }
+
+      Scheduler::setPinning( Settings::pinThreads() );
+
+      if( Settings::selfTest() )
+      {
+         return SelfTest::runAll( std::cout ) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+
+      if( Settings::benchmark() )
+      {
+         doBenchmark();
+         return EXIT_SUCCESS;
+      }
+
       JsonRpc rpc( Settings::RpcHost(), Settings::RpcPort(),
                    Settings::RpcUser(), Settings::RpcPassword() );
 
-      auto miner = Miner::createInstance( Settings::minerType() );
-      if( miner == nullptr )
+      // Never mine with a kernel that gives wrong answers, or submit
+      // blocks through a broken codec
+      SelfTest::verifySha256();
+      SelfTest::verifyHex();
+      SelfTest::verifyBase58();
+
+      auto minerType = Settings::minerType();
+      auto threads = Settings::threads();
+      if( minerType == AUTOTUNE_MINER_TYPE )
+      {
+         auto config = Autotune::run( Settings::threadsSelected() ? threads : 0,
+                                      Settings::tuneCacheFile() );
+         minerType = config.minerType;
+         threads = config.threads;
+      }
+      else
+      {
+         SelfTest::verifyMiner( minerType );
+      }
+
+      Scheduler scheduler( minerType, threads );
+      std::cout << "Placement: " << scheduler.placementSummary() << std::endl;
+
+      if( Settings::metricsPort() != 0 )
+      {
+         scheduler.enableMetrics();
+         Metrics::serve( Settings::metricsAddress(), Settings::metricsPort() );
+      }
+
+      std::unique_ptr<ControlSocket> control;
+      if( !Settings::controlSocket().empty() )
       {
-         throw runtime_error( "Miner implementation doesn't exist" );
+         control.reset( new ControlSocket(Settings::controlSocket(), scheduler) );
       }
 
       int blocksToMine = Settings::numBlocks();
@@ -143,7 +387,7 @@ int main( int argc, char** argv )
          blocksToMine = std::numeric_limits<int>::max();
       }
 
-      doMining( rpc, *miner, blocksToMine );
+      doMining( rpc, scheduler, blocksToMine );
 
       return EXIT_SUCCESS;
    }
@@ -0,0 +1,540 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Verifies Bitcoin Core's block files (blk*.dat): each block's header must
+ * meet the proof-of-work target given by its bits, and its merkle root must
+ * match its transactions. Files are memory-mapped and parsed in place, and the
+ * blocks are spread across all cores, so over a full chain this also serves
+ * as a throughput benchmark for the hashing and parsing code.
+**/
+
+#include "Block.h"
+#include "MerkleTree.h"
+#include "TransactionList.h"
+#include "Sha256.h"
+#include "Util.h"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+namespace BoostProgOpt = boost::program_options;
+
+typedef chrono::steady_clock Clock;
+
+// Length of Bitcoin Core's block file obfuscation key (xor.dat)
+const size_t XOR_KEY_SIZE = 8;
+
+// Size of the magic and length that precede each block in a file
+const size_t FRAME_HEADER_SIZE = 8;
+
+struct Network
+{
+   const char* name;
+   uint32_t    magic;   // As it appears on disk, read little-endian
+};
+
+static const Network NETWORKS[] = {
+   { "main",    0xd9b4bef9 },
+   { "test",    0x0709110b },
+   { "testnet4", 0x283f161c },
+   { "signet",  0x40cf030a },
+   { "regtest", 0xdab5bffa },
+};
+
+// Core (since 28.0) obfuscates block files with the key in xor.dat, kept
+// alongside them. An all-zero key means they're stored in the clear.
+static ByteArray readXorKey( const string& blockFile )
+{
+   auto slash = blockFile.rfind( '/' );
+   auto dir = (slash == string::npos) ? string(".") : blockFile.substr( 0, slash );
+
+   ifstream file( dir + "/xor.dat", ios::binary );
+   ByteArray key( XOR_KEY_SIZE );
+   if( !file.read(reinterpret_cast<char*>(key.data()), key.size()) ||
+       all_of(key.begin(), key.end(), [](uint8_t b){return b == 0;}) )
+   {
+      return ByteArray();
+   }
+   return key;
+}
+
+//
+// A block file, mapped read-only for the life of the run. If Core has
+// obfuscated it, data must be copied out with read().
+//
+class MappedFile
+{
+public:
+   MappedFile( const string& path )
+    : _path(path),
+      _xorKey(readXorKey(path)),
+      _data(nullptr),
+      _size(0)
+   {
+      int fd = open( path.c_str(), O_RDONLY );
+      if( fd < 0 )
+      {
+         throw runtime_error( "Unable to open " + path + ": " + strerror(errno) );
+      }
+
+      struct stat info;
+      if( fstat(fd, &info) == 0 && info.st_size > 0 )
+      {
+         _size = info.st_size;
+         void* data = mmap( nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0 );
+         if( data == MAP_FAILED )
+         {
+            close( fd );
+            throw runtime_error( "Unable to map " + path + ": " + strerror(errno) );
+         }
+         _data = static_cast<const uint8_t*>(data);
+         madvise( data, _size, MADV_SEQUENTIAL );
+      }
+      close( fd );
+   }
+
+   ~MappedFile()
+   {
+      if( _data != nullptr )
+      {
+         munmap( const_cast<uint8_t*>(_data), _size );
+      }
+   }
+
+   MappedFile( const MappedFile& ) = delete;
+   MappedFile& operator =( const MappedFile& ) = delete;
+
+   // Copy data out, undoing the obfuscation if there is any
+   void read( size_t offset, size_t size, uint8_t* output ) const
+   {
+      memcpy( output, _data + offset, size );
+      if( !_xorKey.empty() )
+      {
+         for( size_t i = 0; i < size; ++i )
+         {
+            output[i] ^= _xorKey[(offset + i) % XOR_KEY_SIZE];
+         }
+      }
+   }
+
+   const string& path() const    { return _path; }
+   bool obfuscated() const       { return !_xorKey.empty(); }
+   const uint8_t* data() const   { return _data; }
+   size_t size() const           { return _size; }
+
+private:
+   string         _path;
+   ByteArray      _xorKey;
+   const uint8_t* _data;
+   size_t         _size;
+};
+
+//
+// Bounds-checked reader over raw (binary) block data
+//
+class RawReader
+{
+public:
+   RawReader( const uint8_t* data, size_t size )
+    : _data(data),
+      _pos(0),
+      _size(size)
+   {
+   }
+
+   const uint8_t* skip( size_t bytes )
+   {
+      if( bytes > _size - _pos )
+      {
+         throw runtime_error( "truncated at offset " + to_string(_pos) );
+      }
+      auto start = _data + _pos;
+      _pos += bytes;
+      return start;
+   }
+
+   uint8_t byte()
+   {
+      return *skip( 1 );
+   }
+
+   uint64_t varInt()
+   {
+      uint8_t prefix = byte();
+      int bytes = prefix == 0xff ? 8 : prefix == 0xfe ? 4 : prefix == 0xfd ? 2 : 0;
+      if( bytes == 0 )
+      {
+         return prefix;
+      }
+
+      auto data = skip( bytes );
+      uint64_t n = 0;
+      for( int i = bytes - 1; i >= 0; --i )
+      {
+         n = n << CHAR_BIT | data[i];
+      }
+      return n;
+   }
+
+   size_t pos() const         { return _pos; }
+   size_t remaining() const   { return _size - _pos; }
+   const uint8_t* data() const { return _data; }
+
+private:
+   const uint8_t* _data;
+   size_t         _pos;
+   size_t         _size;
+};
+
+// Parse one transaction and compute its txid. Legacy transactions are hashed
+// straight from the mapped file; segwit ones have their witness data cut out
+// first, which needs a copy.
+static Sha256::RawDigest readTxid( RawReader& reader, vector<uint8_t>& scratch )
+{
+   Sha256::RawDigest txid;
+   Sha256::RawDigest wtxid;
+   size_t size = TransactionList::hashRaw( reader.data() + reader.pos(), reader.remaining(), txid, wtxid, scratch );
+   if( size == 0 )
+   {
+      throw runtime_error( "malformed or truncated at offset " + to_string(reader.pos()) );
+   }
+
+   reader.skip( size );
+   return txid;
+}
+
+// Returns an empty string if the block is valid, otherwise what's wrong with it
+static string verifyBlock( const uint8_t* data, size_t size, uint64_t& txCount, vector<uint8_t>& scratch )
+{
+   if( size < sizeof(Block::Header) )
+   {
+      return "block smaller than a header";
+   }
+
+   // The header is used in place
+   auto& header = *reinterpret_cast<const Block::Header*>(data);
+
+   // Proof of work
+   // Negative or overflowing targets are invalid (as in Core's SetCompact)
+   uint32_t exponent = header.bits >> 24;
+   uint32_t mantissa = header.bits & 0x007fffff;
+   if( (header.bits & 0x00800000) != 0 || mantissa == 0 ||
+       exponent > 34 || (mantissa > 0xff && exponent > 33) || (mantissa > 0xffff && exponent > 32) )
+   {
+      return "invalid bits";
+   }
+
+   Sha256::RawDigest hash;
+   Sha256::doubleHash( data, sizeof(header), hash );
+   auto target = bitsToTarget( header.bits );
+   if( std::lexicographical_compare(target.begin(), target.end(), hash.rbegin(), hash.rend()) )
+   {
+      return "hash above target";
+   }
+
+   // Merkle root
+   RawReader reader( data + sizeof(header), size - sizeof(header) );
+   vector<Sha256::RawDigest> txids;
+   try
+   {
+      txCount = reader.varInt();
+      if( txCount == 0 )
+      {
+         return "no transactions";
+      }
+
+      for( uint64_t i = 0; i < txCount; ++i )
+      {
+         txids.push_back( readTxid(reader, scratch) );
+      }
+   }
+   catch( std::exception& e )
+   {
+      return string( "bad transaction data: " ) + e.what();
+   }
+
+   if( reader.remaining() != 0 )
+   {
+      return to_string( reader.remaining() ) + " bytes after the last transaction";
+   }
+
+   auto root = MerkleTree::computeRoot( std::move(txids) );
+   if( !std::equal(root.begin(), root.end(), header.merkleRoot.begin()) )
+   {
+      return "merkle root mismatch";
+   }
+
+   return string();
+}
+
+static string displayHash( const uint8_t* header )
+{
+   Sha256::RawDigest hash;
+   Sha256::doubleHash( header, sizeof(Block::Header), hash );
+   ByteArray display( hash.rbegin(), hash.rend() );
+
+   ostringstream stream;
+   stream << display;
+   return stream.str();
+}
+
+// A block located in a file, ready to verify
+struct BlockRef
+{
+   const MappedFile* file;
+   size_t            offset;
+   size_t            size;
+};
+
+class Verifier
+{
+public:
+   Verifier( uint32_t magic )
+    : _magic(magic),
+      _next(0),
+      _txCount(0),
+      _byteCount(0),
+      _failures(0)
+   {
+   }
+
+   void addFile( const string& path )
+   {
+      _files.emplace_back( new MappedFile(path) );
+      auto& file = *_files.back();
+
+      // Walk the framing. Core preallocates files, so the tail is zeros.
+      size_t pos = 0;
+      while( pos + FRAME_HEADER_SIZE <= file.size() )
+      {
+         uint8_t frame[FRAME_HEADER_SIZE];
+         file.read( pos, FRAME_HEADER_SIZE, frame );
+         uint32_t magic = frame[0] | frame[1] << 8 | frame[2] << 16 | static_cast<uint32_t>(frame[3]) << 24;
+         uint32_t size = frame[4] | frame[5] << 8 | frame[6] << 16 | static_cast<uint32_t>(frame[7]) << 24;
+
+         if( magic == 0 )
+         {
+            break;
+         }
+         if( magic != _magic )
+         {
+            _report( file, pos, "", "bad magic; skipping the rest of the file" );
+            break;
+         }
+
+         pos += FRAME_HEADER_SIZE;
+         if( size > file.size() - pos )
+         {
+            _report( file, pos, "", "block truncated; skipping the rest of the file" );
+            break;
+         }
+
+         _blocks.push_back( BlockRef{&file, pos, size} );
+         pos += size;
+      }
+   }
+
+   void run( int threadCount )
+   {
+      vector<thread> threads;
+      for( int i = 0; i < threadCount; ++i )
+      {
+         threads.emplace_back( &Verifier::_work, this );
+      }
+      for( auto& thread : threads )
+      {
+         thread.join();
+      }
+   }
+
+   size_t fileCount() const      { return _files.size(); }
+   size_t blockCount() const     { return _blocks.size(); }
+   uint64_t txCount() const      { return _txCount; }
+   uint64_t byteCount() const    { return _byteCount; }
+   uint64_t failures() const     { return _failures; }
+
+private:
+   void _work()
+   {
+      vector<uint8_t> scratch;
+      vector<uint8_t> deobfuscated;
+      uint64_t txCount = 0;
+      uint64_t byteCount = 0;
+
+      for( size_t i = _next++; i < _blocks.size(); i = _next++ )
+      {
+         auto& block = _blocks[i];
+         const uint8_t* data = block.file->data() + block.offset;
+         if( block.file->obfuscated() )
+         {
+            deobfuscated.resize( block.size );
+            block.file->read( block.offset, block.size, deobfuscated.data() );
+            data = deobfuscated.data();
+         }
+
+         uint64_t blockTxCount = 0;
+         auto error = verifyBlock( data, block.size, blockTxCount, scratch );
+         if( !error.empty() )
+         {
+            _report( *block.file, block.offset, block.size >= sizeof(Block::Header) ? displayHash(data) : "", error );
+         }
+
+         txCount += blockTxCount;
+         byteCount += block.size;
+      }
+
+      _txCount += txCount;
+      _byteCount += byteCount;
+   }
+
+   void _report( const MappedFile& file, size_t offset, const string& hash, const string& error )
+   {
+      lock_guard<mutex> lock( _reportMutex );
+      ++_failures;
+      cerr << file.path() << " @" << offset << (hash.empty() ? "" : " (" + hash + ")") << ": " << error << endl;
+   }
+
+private:
+   uint32_t                         _magic;
+
+   vector<unique_ptr<MappedFile>>   _files;
+   vector<BlockRef>                 _blocks;
+   atomic<size_t>                   _next;
+
+   atomic<uint64_t>                 _txCount;
+   atomic<uint64_t>                 _byteCount;
+   atomic<uint64_t>                 _failures;
+   mutex                            _reportMutex;
+};
+
+// Expand directories to the block files in them, in order
+static vector<string> blockFiles( const vector<string>& paths )
+{
+   vector<string> files;
+   for( auto& path : paths )
+   {
+      struct stat info;
+      if( stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) )
+      {
+         files.push_back( path );
+         continue;
+      }
+
+      vector<string> names;
+      DIR* dir = opendir( path.c_str() );
+      if( dir == nullptr )
+      {
+         throw runtime_error( "Unable to read directory " + path );
+      }
+      while( auto entry = readdir(dir) )
+      {
+         string name = entry->d_name;
+         if( name.size() == 12 && name.compare(0, 3, "blk") == 0 && name.compare(8, 4, ".dat") == 0 )
+         {
+            names.push_back( name );
+         }
+      }
+      closedir( dir );
+
+      sort( names.begin(), names.end() );
+      for( auto& name : names )
+      {
+         files.push_back( path + "/" + name );
+      }
+   }
+   return files;
+}
+
+int main( int argc, char** argv )
+{
+   try
+   {
+      vector<string> paths;
+      string networkName;
+      int threadCount;
+
+      BoostProgOpt::options_description options( "Options" );
+      options.add_options()
+         ("help,h",     "Print this help.")
+         ("blocks",     BoostProgOpt::value<vector<string>>(&paths), "Block file, or a directory of blk*.dat files. May be repeated.")
+         ("network",    BoostProgOpt::value<string>(&networkName)->default_value("main"), "Network the blocks are from: main, test, testnet4, signet or regtest.")
+         ("threads,j",  BoostProgOpt::value<int>(&threadCount)->default_value(0), "Number of verifier threads (0 = one per logical CPU).")
+         ;
+
+      BoostProgOpt::positional_options_description positional;
+      positional.add( "blocks", -1 );
+
+      BoostProgOpt::variables_map varMap;
+      BoostProgOpt::store( BoostProgOpt::command_line_parser(argc, argv).options(options).positional(positional).run(), varMap );
+      BoostProgOpt::notify( varMap );
+
+      if( varMap.count("help") || paths.empty() )
+      {
+         cout << "Usage: " << argv[0] << " [options] <blocksdir | blkNNNNN.dat...>" << endl << options;
+         return varMap.count( "help" ) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+
+      auto network = find_if( begin(NETWORKS), end(NETWORKS), [&](const Network& n){return networkName == n.name;} );
+      if( network == end(NETWORKS) )
+      {
+         throw runtime_error( "Unknown network: " + networkName );
+      }
+
+      if( threadCount <= 0 )
+      {
+         threadCount = max( 1u, thread::hardware_concurrency() );
+      }
+
+      auto files = blockFiles( paths );
+      if( files.empty() )
+      {
+         throw runtime_error( "No block files found" );
+      }
+
+      auto scanStart = Clock::now();
+      Verifier verifier( network->magic );
+      for( auto& file : files )
+      {
+         verifier.addFile( file );
+      }
+
+      auto verifyStart = Clock::now();
+      verifier.run( threadCount );
+      auto end = Clock::now();
+
+      double scanSeconds = chrono::duration<double>( verifyStart - scanStart ).count();
+      double seconds = chrono::duration<double>( end - verifyStart ).count();
+      cout << "Verified " << verifier.blockCount() << " blocks (" << verifier.txCount() << " transactions, "
+           << verifier.byteCount() / 1e6 << " MB) from " << verifier.fileCount() << " files on "
+           << threadCount << " threads" << endl
+           << "Scanned in " << scanSeconds << " s, verified in " << seconds << " s: "
+           << verifier.byteCount() / 1e6 / seconds << " MB/s, "
+           << verifier.blockCount() / seconds << " blocks/s, "
+           << verifier.txCount() / seconds << " transactions/s" << endl
+           << verifier.failures() << " failures" << endl;
+
+      return verifier.failures() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+   catch( std::exception& e )
+   {
+      cerr << "ERROR: " << e.what() << endl;
+      return EXIT_FAILURE;
+   }
+}
@@ -0,0 +1,1304 @@
+/**
+ * This is free and unencumbered software released into the public domain.
+ *
+ * A stand-in for Bitcoin Core's JSON-RPC interface, for exercising the miner
+ * end-to-end on one machine. It answers getnewaddress, getblocktemplate
+ * (including longpoll and proposals), getrawmempool, getrawtransaction and
+ * submitblock, serving either recorded templates
+ * (the "result" of bitcoin-cli getblocktemplate, saved to a file) or
+ * synthetic mainnet-sized ones. Submitted blocks are fully validated against
+ * the template they were built from, and each accepted block advances the
+ * chain so that the next template builds on it.
+ *
+ * It can also stand in for an auxiliary chain's node for merged mining
+ * (createauxblock, getauxblock and submitauxblock), checking each AuxPoW
+ * proof as Namecoin does, and for the node's P2P port, taking solved blocks
+ * as BIP 152 compact blocks (rebuilt from the template's transactions) or
+ * whole ones.
+**/
+
+#include "HttpServer.h"
+#include "Block.h"
+#include "MerkleTree.h"
+#include "P2pMessage.h"
+#include "Radix.h"
+#include "Sha256.h"
+#include "Transaction.h"
+#include "Util.h"
+
+#include <boost/program_options.hpp>
+#include <json/json.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+namespace BoostProgOpt = boost::program_options;
+
+typedef chrono::steady_clock Clock;
+
+// Height used for synthetic templates
+const int SYNTHETIC_HEIGHT = 800000;
+
+// Difficulty for synthetic templates: about a million hashes per block
+const char* const SYNTHETIC_BITS = "1e0fffff";
+
+static string displayHex( ByteArray hash )
+{
+   std::reverse( hash.begin(), hash.end() );
+   ostringstream stream;
+   stream << hash;
+   return stream.str();
+}
+
+static ByteArray rawFromDisplayHex( const string& hex )
+{
+   auto hash = hexStringToBinary( hex );
+   std::reverse( hash.begin(), hash.end() );
+   return hash;
+}
+
+static int64_t blockSubsidy( int height )
+{
+   int halvings = height / 210000;
+   return halvings >= 64 ? 0 : (50LL * SATOSHIS_PER_BITCOIN) >> halvings;
+}
+
+// Compare a raw (little-endian) hash against the target for the given bits
+static bool hashMeetsTarget( const ByteArray& hash, uint32_t bits )
+{
+   auto target = bitsToTarget( bits );
+   ByteArray bigEndianHash( hash.rbegin(), hash.rend() );
+   return !std::lexicographical_compare( target.begin(), target.end(),
+                                         bigEndianHash.begin(), bigEndianHash.end() );
+}
+
+class MockNode
+{
+public:
+   struct Options
+   {
+      vector<string> templateFiles;
+      string         bits;
+      int            txCount;
+      int            longpollTimeout;
+      int            chainId;
+      int            p2pMissing;
+      bool           debug;
+   };
+
+public:
+   MockNode( const Options& options )
+    : _options(options),
+      _rng(random_device()()),
+      _nextTemplate(0),
+      _height(SYNTHETIC_HEIGHT),
+      _longpollSeq(0),
+      _tipFetched(false),
+      _accepted(0),
+      _rejected(0),
+      _restartLatencySum(0),
+      _restartCount(0),
+      _start(Clock::now())
+   {
+      for( auto& file : options.templateFiles )
+      {
+         _templates.push_back( loadTemplate(file) );
+      }
+
+      if( _templates.empty() )
+      {
+         cout << "Generating a synthetic template with " << options.txCount << " transactions" << endl;
+         _templates.push_back( syntheticTemplate(options.txCount) );
+      }
+      else
+      {
+         _height = _templates[0]["height"].asInt() - 1;
+      }
+
+      ByteArray tip( 32 );
+      for( auto& byte : tip )
+      {
+         byte = _rng();
+      }
+
+      lock_guard<mutex> lock( _mutex );
+      _advanceTip( displayHex(tip) );
+
+      // Don't count the miner's startup as restart latency
+      _tipFetched = true;
+   }
+
+   HttpServer::Response handle( const HttpServer::Request& httpRequest )
+   {
+      HttpServer::Response httpResponse;
+      httpResponse.contentType = "application/json";
+
+      Json::Reader reader;
+      Json::Value request;
+      Json::Value response;
+      if( httpRequest.method != "POST" || !reader.parse(httpRequest.body, request)
+          || !(request.isObject() || (request.isArray() && request.size() > 0)) )
+      {
+         httpResponse.status = 400;
+         return httpResponse;
+      }
+
+      // Batches always succeed at the HTTP level, like Bitcoin Core
+      if( request.isArray() )
+      {
+         response = Json::arrayValue;
+         for( auto& call : request )
+         {
+            response.append( dispatch(call, httpResponse.status) );
+         }
+         httpResponse.status = 200;
+      }
+      else
+      {
+         response = dispatch( request, httpResponse.status );
+      }
+
+      Json::FastWriter writer;
+      httpResponse.body = writer.write( response );
+      return httpResponse;
+   }
+
+   Json::Value dispatch( const Json::Value& request, int& httpStatus )
+   {
+      Json::Value response;
+      response["id"] = request["id"];
+      response["result"] = Json::Value();
+      response["error"] = Json::Value();
+
+      auto method = request["method"].asString();
+      auto& params = request["params"];
+
+      if( _options.debug )
+      {
+         cout << "REQUEST: " << method << endl;
+      }
+
+      try
+      {
+         if( method == "getnewaddress" )
+         {
+            response["result"] = getNewAddress();
+         }
+         else if( method == "getblocktemplate" )
+         {
+            response["result"] = getBlockTemplate( params );
+         }
+         else if( method == "submitblock" )
+         {
+            response["result"] = submitBlock( params[0u].asString() );
+         }
+         else if( method == "getmininginfo" )
+         {
+            response["result"] = getMiningInfo();
+         }
+         else if( method == "getrawmempool" )
+         {
+            response["result"] = getRawMempool( params[0u].asBool() );
+         }
+         else if( method == "getrawtransaction" )
+         {
+            response["result"] = getRawTransaction( params[0u].asString() );
+         }
+         else if( method == "createauxblock" )
+         {
+            response["result"] = createAuxBlock();
+         }
+         else if( method == "getauxblock" )
+         {
+            // With no arguments it creates, with two it submits
+            response["result"] = params.size() >= 2 ? submitAuxBlock( params[0u].asString(), params[1u].asString() )
+                                                    : createAuxBlock();
+         }
+         else if( method == "submitauxblock" )
+         {
+            response["result"] = submitAuxBlock( params[0u].asString(), params[1u].asString() );
+         }
+         else if( method == "getbestblockhash" )
+         {
+            lock_guard<mutex> lock( _mutex );
+            response["result"] = _current["previousblockhash"];
+         }
+         else
+         {
+            response["error"]["code"] = -32601;
+            response["error"]["message"] = "Method not found";
+            httpStatus = 404;
+         }
+      }
+      catch( std::exception& e )
+      {
+         response["error"]["code"] = -1;
+         response["error"]["message"] = e.what();
+         httpStatus = 500;
+      }
+
+      return response;
+   }
+
+   Json::Value getMiningInfo()
+   {
+      lock_guard<mutex> lock( _mutex );
+
+      // Difficulty relative to the minimum target, from the compact bits
+      auto bits = static_cast<uint32_t>( stoul(_current["bits"].asString(), nullptr, 16) );
+      double difficulty = double(0xffff) / (bits & 0x00ffffff);
+      for( int shift = bits >> 24; shift < 0x1d; ++shift )
+      {
+         difficulty *= 256;
+      }
+      for( int shift = bits >> 24; shift > 0x1d; --shift )
+      {
+         difficulty /= 256;
+      }
+
+      Json::Value info;
+      info["blocks"] = _height - 1;
+      info["difficulty"] = difficulty;
+      info["currentblocktx"] = _current["transactions"].size();
+      info["chain"] = "regtest";
+      info["warnings"] = "";
+      return info;
+   }
+
+   Json::Value getNewAddress()
+   {
+      // Testnet pay-to-pubkey-hash
+      ByteArray payload( 21 );
+      lock_guard<mutex> lock( _mutex );
+      payload[0] = 0x6f;
+      for( unsigned i = 1; i < payload.size(); ++i )
+      {
+         payload[i] = _rng();
+      }
+      return Radix::base58EncodeCheck( payload );
+   }
+
+   Json::Value getBlockTemplate( const Json::Value& params )
+   {
+      unique_lock<mutex> lock( _mutex );
+
+      // Longpoll: hold the request until the template changes
+      if( params.isArray() && params[0u].isObject() && params[0u].isMember("longpollid") )
+      {
+         auto longpollId = params[0u]["longpollid"].asString();
+         _changed.wait_for( lock, chrono::seconds(_options.longpollTimeout), [&]()
+         {
+            return _current["longpollid"].asString() != longpollId;
+         } );
+      }
+
+      if( !_tipFetched )
+      {
+         _tipFetched = true;
+         _restartLatencySum += chrono::duration<double>( Clock::now() - _tipTime ).count();
+         ++_restartCount;
+      }
+
+      // Check a block without its proof of work (BIP 23). Miners assembling
+      // their own blocks propose one instead of fetching a template.
+      if( params.isArray() && params[0u].isObject() && params[0u]["mode"].asString() == "proposal" )
+      {
+         auto reason = _validate( params[0u]["data"].asString(), false );
+         return reason.empty() ? Json::Value() : Json::Value( reason );
+      }
+
+      _current["curtime"] = static_cast<Json::Int64>( time(nullptr) );
+      return _current;
+   }
+
+   Json::Value getRawMempool( bool verbose )
+   {
+      lock_guard<mutex> lock( _mutex );
+
+      auto& txns = _current["transactions"];
+      Json::Value result = verbose ? Json::Value( Json::objectValue ) : Json::Value( Json::arrayValue );
+      for( auto& txn : txns )
+      {
+         auto txid = txn["txid"].asString();
+         if( !verbose )
+         {
+            result.append( txid );
+            continue;
+         }
+
+         // Template dependencies are 1-based indices, the mempool's are txids
+         Json::Value entry;
+         entry["weight"] = txn["weight"];
+         entry["vsize"] = (txn["weight"].asInt() + 3) / 4;
+         entry["fees"]["base"] = txn["fee"].asDouble() / SATOSHIS_PER_BITCOIN;
+         entry["fees"]["modified"] = entry["fees"]["base"];
+         entry["depends"] = Json::arrayValue;
+         for( auto& index : txn["depends"] )
+         {
+            entry["depends"].append( txns[index.asUInt() - 1]["txid"] );
+         }
+         result[txid] = entry;
+      }
+
+      return result;
+   }
+
+   Json::Value getRawTransaction( const string& txid )
+   {
+      lock_guard<mutex> lock( _mutex );
+
+      for( auto& txn : _current["transactions"] )
+      {
+         if( txn["txid"].asString() == txid )
+         {
+            return txn["data"];
+         }
+      }
+
+      throw runtime_error( "No such mempool transaction" );
+   }
+
+   Json::Value submitBlock( const string& blockHex, const string& via = "submitblock" )
+   {
+      auto received = Clock::now();
+
+      lock_guard<mutex> lock( _mutex );
+
+      // Already accepted by another route, as Bitcoin Core reports it
+      const int headerHexSize = sizeof(Block::Header) * 2;
+      if( blockHex.size() >= headerHexSize &&
+          displayHex(Sha256::doubleHash(hexStringToBinary(blockHex.substr(0, headerHexSize)))) == _current["previousblockhash"].asString() )
+      {
+         return "duplicate";
+      }
+
+      auto reason = _validate( blockHex );
+      auto validated = Clock::now();
+
+      if( !reason.empty() )
+      {
+         ++_rejected;
+         cout << "Block rejected: " << reason << endl;
+         return reason;
+      }
+
+      ++_accepted;
+      double minutes = chrono::duration<double>( received - _start ).count() / 60;
+      cout << "Block " << _accepted << " accepted via " << via << " at height " << _height
+           << ": solved in " << chrono::duration<double>( received - _tipTime ).count() << " s"
+           << ", validated in " << chrono::duration<double,milli>( validated - received ).count() << " ms"
+           << ", mean restart latency " << (_restartCount ? _restartLatencySum * 1000 / _restartCount : 0) << " ms"
+           << ", " << _accepted / minutes << " blocks/minute"
+           << " (" << _rejected << " rejected)" << endl;
+
+      _advanceTip( _submittedHash );
+      return Json::Value();
+   }
+
+   /*
+    * The raw mempool transactions by their short IDs in a compact block with
+    * the given keys, less every p2pMissing-th one, to make peers fill them in.
+    */
+   unordered_map<uint64_t, ByteArray> compactMempool( uint64_t k0, uint64_t k1 )
+   {
+      lock_guard<mutex> lock( _mutex );
+
+      unordered_map<uint64_t, ByteArray> mempool;
+      auto& txns = _current["transactions"];
+      for( unsigned i = 0; i < txns.size(); ++i )
+      {
+         if( _options.p2pMissing > 0 && i % _options.p2pMissing == 0 )
+         {
+            continue;
+         }
+
+         auto wtxid = rawFromDisplayHex( txns[i]["hash"].asString() );
+         Sha256::RawDigest digest;
+         std::copy( wtxid.begin(), wtxid.end(), digest.begin() );
+         mempool[P2pMessage::shortId(k0, k1, digest)] = hexStringToBinary( txns[i]["data"].asString() );
+      }
+      return mempool;
+   }
+
+   /*
+    * An aux block for merged mining: the next block on this chain, needing
+    * only a proof of work from a parent chain.
+    */
+   Json::Value createAuxBlock()
+   {
+      lock_guard<mutex> lock( _mutex );
+
+      auto bits = static_cast<uint32_t>( stoul(_current["bits"].asString(), nullptr, 16) );
+      auto target = bitsToTarget( bits );
+      std::reverse( target.begin(), target.end() );
+      ostringstream littleEndianTarget;
+      littleEndianTarget << target;
+
+      Json::Value auxBlock;
+      auxBlock["hash"] = _auxBlockHash();
+      auxBlock["chainid"] = _options.chainId;
+      auxBlock["previousblockhash"] = _current["previousblockhash"];
+      auxBlock["coinbasevalue"] = _current["coinbasevalue"];
+      auxBlock["bits"] = _current["bits"];
+      auxBlock["height"] = _height;
+      auxBlock["_target"] = littleEndianTarget.str();
+      return auxBlock;
+   }
+
+   Json::Value submitAuxBlock( const string& hash, const string& auxPowHex )
+   {
+      lock_guard<mutex> lock( _mutex );
+
+      string reason;
+      try
+      {
+         reason = _validateAuxPow( hash, auxPowHex );
+      }
+      catch( std::exception& e )
+      {
+         reason = "bad-auxpow-encoding";
+      }
+
+      if( !reason.empty() )
+      {
+         ++_rejected;
+         cout << "Aux block rejected: " << reason << endl;
+         return false;
+      }
+
+      ++_accepted;
+      cout << "Aux block " << _accepted << " accepted at height " << _height
+           << " (" << _rejected << " rejected)" << endl;
+      _advanceTip( hash );
+      return true;
+   }
+
+   /*
+    * Simulate a block found elsewhere on the network.
+    */
+   void externalBlock()
+   {
+      ByteArray tip( 32 );
+      lock_guard<mutex> lock( _mutex );
+      for( auto& byte : tip )
+      {
+         byte = _rng();
+      }
+      cout << "New block from the network at height " << _height << endl;
+      _advanceTip( displayHex(tip) );
+   }
+
+private:
+   static Json::Value loadTemplate( const string& fileName )
+   {
+      ifstream file( fileName );
+      Json::Reader reader;
+      Json::Value value;
+      if( !file || !reader.parse(file, value) )
+      {
+         throw runtime_error( "Unable to load template " + fileName );
+      }
+
+      // Accept full JSON-RPC replies as well as bare results
+      if( value.isMember("result") )
+      {
+         value = value["result"];
+      }
+
+      if( !value.isMember("transactions") || !value.isMember("previousblockhash") )
+      {
+         throw runtime_error( fileName + " doesn't look like a getblocktemplate result" );
+      }
+
+      cout << "Loaded template " << fileName << " with " << value["transactions"].size() << " transactions" << endl;
+      return value;
+   }
+
+   Json::Value syntheticTemplate( int txCount )
+   {
+      Json::Value tmpl;
+      tmpl["version"] = 0x20000000;
+      tmpl["rules"] = Json::arrayValue;
+      tmpl["capabilities"].append( "proposal" );
+      tmpl["height"] = _height + 1;
+      tmpl["bits"] = SYNTHETIC_BITS;
+
+      int64_t fees = 0;
+      auto& txns = tmpl["transactions"] = Json::arrayValue;
+      for( int i = 0; i < txCount; ++i )
+      {
+         Transaction txn;
+         txn.version = 2;
+         txn.lockTime = 0;
+
+         // One input with a typical signature and compressed pubkey, as a
+         // legacy or (every other transaction) segwit spend
+         txn.inputs.resize( 1 );
+         for( auto& word : txn.inputs[0].prevHash )
+         {
+            word = _rng();
+         }
+         txn.inputs[0].prevN = _rng() % 4;
+         if( i % 2 == 0 )
+         {
+            for( int j = 0; j < 107; ++j )
+            {
+               txn.inputs[0].scriptSig << static_cast<uint8_t>( _rng() );
+            }
+         }
+         else
+         {
+            txn.inputs[0].witness.resize( 2 );
+            txn.inputs[0].witness[0].resize( 72 );
+            txn.inputs[0].witness[1].resize( 33 );
+            for( auto& item : txn.inputs[0].witness )
+            {
+               for( auto& byte : item )
+               {
+                  byte = _rng();
+               }
+            }
+         }
+         txn.inputs[0].sequence = -1;
+
+         // Payment and change
+         txn.outputs.resize( 2 );
+         for( auto& output : txn.outputs )
+         {
+            ByteArray pubKeyHash( 20 );
+            for( auto& byte : pubKeyHash )
+            {
+               byte = _rng();
+            }
+            output.value = _rng() % SATOSHIS_PER_BITCOIN;
+            output.scriptPubKey << OP_DUP << OP_HASH160 << Script::Data(pubKeyHash)
+                                << OP_EQUALVERIFY << OP_CHECKSIG;
+         }
+
+         ostringstream data;
+         ostringstream baseData;
+         txn.serialize( data );
+         txn.serialize( baseData, false );
+         int64_t fee = 1000 + _rng() % 50000;
+         fees += fee;
+
+         Json::Value entry;
+         entry["data"] = data.str();
+         entry["txid"] = displayHex( txn.id() );
+         entry["hash"] = displayHex( txn.witnessId() );
+         entry["fee"] = static_cast<Json::Int64>( fee );
+         entry["depends"] = Json::arrayValue;
+         entry["sigops"] = 4;
+         entry["weight"] = static_cast<Json::UInt>( baseData.str().size() / 2 * 3 + data.str().size() / 2 );
+         txns.append( entry );
+      }
+
+      tmpl["coinbasevalue"] = static_cast<Json::Int64>( blockSubsidy(_height + 1) + fees );
+      return tmpl;
+   }
+
+   // Start a new template on top of the given block. Caller holds the lock.
+   void _advanceTip( const string& tipHash )
+   {
+      auto& source = _templates[_nextTemplate++ % _templates.size()];
+
+      ++_height;
+      _current = source;
+      _current["previousblockhash"] = tipHash;
+      _current["height"] = _height;
+      _current["curtime"] = static_cast<Json::Int64>( time(nullptr) );
+      _current["mintime"] = static_cast<Json::Int64>( time(nullptr) - 3600 );
+      _current["longpollid"] = tipHash + to_string( ++_longpollSeq );
+      _current["noncerange"] = "00000000ffffffff";
+      if( !_options.bits.empty() )
+      {
+         _current["bits"] = _options.bits;
+      }
+
+      // Recorded templates have the subsidy of their own height
+      int64_t fees = 0;
+      for( auto& txn : _current["transactions"] )
+      {
+         fees += txn["fee"].asInt64();
+      }
+      _current["coinbasevalue"] = static_cast<Json::Int64>( blockSubsidy(_height) + fees );
+
+      auto bits = static_cast<uint32_t>( stoul(_current["bits"].asString(), nullptr, 16) );
+      ostringstream target;
+      target << bitsToTarget( bits );
+      _current["target"] = target.str();
+
+      _tipTime = Clock::now();
+      _tipFetched = false;
+      _changed.notify_all();
+   }
+
+   // Check a submitted block against the current template, returning a
+   // BIP 22 style reject reason, or an empty string if the block is good.
+   // Caller holds the lock.
+   string _validate( const string& blockHex, bool checkProofOfWork = true )
+   {
+      const int headerHexSize = sizeof(Block::Header) * 2;
+      if( blockHex.size() < headerHexSize )
+      {
+         return "bad-header";
+      }
+
+      Block::Header header;
+      auto headerData = hexStringToBinary( blockHex.substr(0, headerHexSize) );
+      std::memcpy( &header, headerData.data(), sizeof(header) );
+
+      auto prevBlock = rawFromDisplayHex( _current["previousblockhash"].asString() );
+      if( !std::equal(prevBlock.begin(), prevBlock.end(), header.prevBlock.begin()) )
+      {
+         return "inconclusive-not-best-prevblk";
+      }
+
+      if( header.bits != stoul(_current["bits"].asString(), nullptr, 16) )
+      {
+         return "bad-diffbits";
+      }
+
+      auto hash = Sha256::doubleHash( &header, sizeof(header) );
+      if( checkProofOfWork && !hashMeetsTarget(hash, header.bits) )
+      {
+         return "high-hash";
+      }
+
+      // Check the transactions are from the template, each at most once and
+      // after the ones it depends on, following a valid coinbase
+      istringstream stream( blockHex.substr(headerHexSize) );
+      auto txCount = readVarInt( stream );
+      auto& templateTxns = _current["transactions"];
+      if( txCount < 1 || txCount > templateTxns.size() + 1 )
+      {
+         return "bad-txns-count";
+      }
+
+      map<string, unsigned> templateIndex;
+      int64_t templateFees = 0;
+      for( unsigned i = 0; i < templateTxns.size(); ++i )
+      {
+         templateIndex[templateTxns[i]["txid"].asString()] = i;
+         templateFees += templateTxns[i]["fee"].asInt64();
+      }
+
+      vector<bool> included( templateTxns.size() );
+      int64_t coinbaseValue = 0;
+      int64_t fees = 0;
+      MerkleTree merkleTree;
+      TransactionPtr coinbase;
+      bool hasWitness = false;
+      vector<Sha256::RawDigest> wtxids( 1 );
+      for( int i = 0; i < txCount; ++i )
+      {
+         auto txn = Transaction::deserialize( stream );
+         if( !stream )
+         {
+            return "bad-txns-truncated";
+         }
+
+         auto txid = txn->id();
+         merkleTree.append( txid );
+
+         if( i == 0 )
+         {
+            for( auto& output : txn->outputs )
+            {
+               coinbaseValue += output.value;
+            }
+
+            if( txn->inputs.size() != 1 || txn->inputs[0].prevN != -1 )
+            {
+               return "bad-cb-missing";
+            }
+            coinbase = std::move( txn );
+            continue;
+         }
+
+         auto wtxid = txn->witnessId();
+         wtxids.emplace_back();
+         std::copy( wtxid.begin(), wtxid.end(), wtxids.back().begin() );
+         hasWitness = hasWitness || txn->hasWitness();
+
+         auto found = templateIndex.find( displayHex(txid) );
+         if( found == templateIndex.end() )
+         {
+            return "bad-txns-inputs-missingorspent";
+         }
+
+         auto& templateTxn = templateTxns[found->second];
+         for( auto& depends : templateTxn["depends"] )
+         {
+            if( !included[depends.asUInt() - 1] )
+            {
+               return "bad-txns-inputs-missingorspent";
+            }
+         }
+
+         if( included[found->second] )
+         {
+            return "bad-txns-duplicate";
+         }
+         included[found->second] = true;
+         fees += templateTxn["fee"].asInt64();
+      }
+
+      if( coinbaseValue > _current["coinbasevalue"].asInt64() - templateFees + fees )
+      {
+         return "bad-cb-amount";
+      }
+
+      if( hasWitness )
+      {
+         auto reason = _checkWitnessCommitment( *coinbase, MerkleTree::computeRoot(wtxids) );
+         if( !reason.empty() )
+         {
+            return reason;
+         }
+      }
+
+      if( stream.peek() != EOF )
+      {
+         return "bad-txns-trailing";
+      }
+
+      auto merkleRoot = merkleTree.rootHash();
+      if( !std::equal(merkleRoot.begin(), merkleRoot.end(), header.merkleRoot.begin()) )
+      {
+         return "bad-txnmrklroot";
+      }
+
+      _submittedHash = displayHex( hash );
+      return "";
+   }
+
+   // The current aux block's hash, which stands in for a whole block header:
+   // it commits to the tip and height. Caller holds the lock.
+   string _auxBlockHash() const
+   {
+      auto seed = rawFromDisplayHex( _current["previousblockhash"].asString() );
+      for( int i = 0; i < 4; ++i )
+      {
+         seed.push_back( static_cast<uint8_t>(_height >> (i * 8)) );
+      }
+      return displayHex( Sha256::doubleHash(seed) );
+   }
+
+   // Check an AuxPoW proof for the current aux block, returning the reason
+   // it's bad, or an empty string if it's good. Caller holds the lock.
+   string _validateAuxPow( const string& hash, const string& auxPowHex )
+   {
+      static const uint8_t magic[] = { 0xfa, 0xbe, 0x6d, 0x6d };
+
+      if( hash != _auxBlockHash() )
+      {
+         return "stale";
+      }
+
+      istringstream stream( auxPowHex );
+      auto coinbase = Transaction::deserialize( stream );
+      auto readHash = [&stream]()
+      {
+         char hex[64];
+         Sha256::RawDigest hash;
+         if( !stream.read(hex, sizeof(hex)) || !Hex::decode(hex, sizeof(hex), hash.data()) )
+         {
+            throw runtime_error( "Invalid hash" );
+         }
+         return hash;
+      };
+      auto readBranch = [&](vector<Sha256::RawDigest>& branch)
+      {
+         branch.resize( readVarInt(stream) );
+         for( auto& sibling : branch )
+         {
+            sibling = readHash();
+         }
+         return readInt<int32_t>( stream );
+      };
+
+      readHash(); // The parent's hash, which isn't checked
+      vector<Sha256::RawDigest> coinbaseBranch;
+      vector<Sha256::RawDigest> chainBranch;
+      auto coinbaseIndex = readBranch( coinbaseBranch );
+      auto chainIndex = readBranch( chainBranch );
+
+      Block::Header header;
+      auto headerData = hexStringToBinary( auxPowHex.substr(stream.tellg()) );
+      if( headerData.size() != sizeof(header) )
+      {
+         return "bad-auxpow-header";
+      }
+      std::memcpy( &header, headerData.data(), sizeof(header) );
+
+      // The coinbase must be the parent's first transaction
+      auto coinbaseId = coinbase->id();
+      Sha256::RawDigest leaf;
+      std::copy( coinbaseId.begin(), coinbaseId.end(), leaf.begin() );
+      if( coinbaseIndex != 0 || coinbase->inputs.empty() ||
+          MerkleTree::rootFromBranch(leaf, coinbaseBranch) != header.merkleRoot )
+      {
+         return "bad-auxpow-coinbase-branch";
+      }
+
+      // This block's place in the aux tree
+      auto auxHash = rawFromDisplayHex( hash );
+      Sha256::RawDigest root;
+      std::copy( auxHash.begin(), auxHash.end(), root.begin() );
+      uint32_t index = chainIndex;
+      for( auto& sibling : chainBranch )
+      {
+         Sha256::RawDigest pair[2] = { root, sibling };
+         if( index & 1 )
+         {
+            std::swap( pair[0], pair[1] );
+         }
+         Sha256::doubleHash( pair, sizeof(pair), root );
+         index >>= 1;
+      }
+
+      // The coinbase commits to the tree's root (reversed), size and nonce,
+      // and the nonce puts this chain in the slot it claims
+      auto& script = coinbase->inputs[0].scriptSig;
+      auto found = std::search( script.begin(), script.end(), magic, magic + sizeof(magic) );
+      if( found == script.end() || script.end() - found < 44 ||
+          !std::equal(root.rbegin(), root.rend(), found + sizeof(magic)) )
+      {
+         return "bad-auxpow-commitment";
+      }
+
+      auto readLittleEndian = [](Script::const_iterator data)
+      {
+         return uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24;
+      };
+      auto size = readLittleEndian( found + 36 );
+      auto nonce = readLittleEndian( found + 40 );
+      uint32_t expected = nonce * 1103515245 + 12345;
+      expected += _options.chainId;
+      expected = expected * 1103515245 + 12345;
+      if( size != (1u << chainBranch.size()) || uint32_t(chainIndex) != expected % size )
+      {
+         return "bad-auxpow-chain-index";
+      }
+
+      if( !hashMeetsTarget(Sha256::doubleHash(&header, sizeof(header)), stoul(_current["bits"].asString(), nullptr, 16)) )
+      {
+         return "high-hash";
+      }
+
+      return "";
+   }
+
+   // BIP 141: the last commitment-shaped output of the coinbase must commit to
+   // the witness root and the reserved value in the coinbase's witness
+   static string _checkWitnessCommitment( const Transaction& coinbase, const Sha256::RawDigest& witnessRoot )
+   {
+      static const uint8_t header[] = { 0x6a, 0x24, 0xaa, 0x21, 0xa9, 0xed };
+
+      const Script* commitment = nullptr;
+      for( auto& output : coinbase.outputs )
+      {
+         auto& script = output.scriptPubKey;
+         if( script.size() >= 38 && std::equal(header, header + sizeof(header), script.begin()) )
+         {
+            commitment = &script;
+         }
+      }
+
+      auto& witness = coinbase.inputs[0].witness;
+      if( commitment == nullptr || witness.size() != 1 || witness[0].size() != 32 )
+      {
+         return "bad-witness-nonce-size";
+      }
+
+      ByteArray preimage( witnessRoot.begin(), witnessRoot.end() );
+      preimage.insert( preimage.end(), witness[0].begin(), witness[0].end() );
+      auto expected = Sha256::doubleHash( preimage );
+      if( !std::equal(expected.begin(), expected.end(), commitment->begin() + sizeof(header)) )
+      {
+         return "bad-witness-merkle-match";
+      }
+
+      return "";
+   }
+
+private:
+   Options                 _options;
+   mt19937_64              _rng;
+
+   mutex                   _mutex;
+   condition_variable      _changed;
+
+   vector<Json::Value>     _templates;
+   size_t                  _nextTemplate;
+   Json::Value             _current;
+   int                     _height;
+   int                     _longpollSeq;
+   string                  _submittedHash;
+
+   Clock::time_point       _tipTime;
+   bool                    _tipFetched;
+   int                     _accepted;
+   int                     _rejected;
+   double                  _restartLatencySum;
+   int                     _restartCount;
+   Clock::time_point       _start;
+};
+
+/*
+ * The node's P2P port, as far as a miner needs it: the version handshake,
+ * pings, and solved blocks. It asks for compact blocks (BIP 152, version 2),
+ * requesting any transactions it's missing with getblocktxn.
+ */
+class MockPeerServer
+{
+public:
+   MockPeerServer( MockNode& node, const string& address, int port, uint32_t magic )
+    : _node(node),
+      _magic(magic),
+      _stop(false)
+   {
+      sockaddr_in addr;
+      std::memset( &addr, 0, sizeof(addr) );
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons( port );
+      if( inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1 )
+      {
+         throw runtime_error( "Invalid P2P address: " + address );
+      }
+
+      _listenSocket = ::socket( AF_INET, SOCK_STREAM, 0 );
+      int reuse = 1;
+      ::setsockopt( _listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse) );
+      if( _listenSocket < 0 || ::bind(_listenSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+          || ::listen(_listenSocket, SOMAXCONN) != 0 )
+      {
+         throw runtime_error( "Failed to listen for P2P on " + address + ":" + to_string(port) + ": " + strerror(errno) );
+      }
+
+      _acceptThread = thread( &MockPeerServer::_acceptLoop, this );
+   }
+
+   ~MockPeerServer()
+   {
+      _stop = true;
+      _acceptThread.join();
+      ::close( _listenSocket );
+
+      lock_guard<mutex> lock( _mutex );
+      for( auto& connection : _connections )
+      {
+         ::shutdown( connection.first, SHUT_RDWR );
+      }
+      for( auto& connection : _connections )
+      {
+         connection.second.join();
+         ::close( connection.first );
+      }
+   }
+
+private:
+   void _acceptLoop()
+   {
+      while( !_stop )
+      {
+         pollfd pfd = { _listenSocket, POLLIN, 0 };
+         if( ::poll(&pfd, 1, 200) <= 0 )
+         {
+            continue;
+         }
+
+         int connection = ::accept( _listenSocket, nullptr, nullptr );
+         if( connection >= 0 )
+         {
+            lock_guard<mutex> lock( _mutex );
+            _connections.emplace_back( connection, thread(&MockPeerServer::_serve, this, connection) );
+         }
+      }
+   }
+
+   void _serve( int socket )
+   {
+      cout << "P2P peer connected" << endl;
+
+      // A compact block waiting for the transactions it's missing
+      ByteArray header;
+      vector<ByteArray> txns;
+      vector<uint64_t> missing;
+
+      try
+      {
+         P2pMessage message;
+         while( message.read(socket, _magic) )
+         {
+            if( message.command == "version" )
+            {
+               ByteArray version( message.payload );
+               P2pMessage( "version", std::move(version) ).write( socket, _magic );
+               P2pMessage( "verack", ByteArray() ).write( socket, _magic );
+
+               ByteArray sendCompact;
+               P2pMessage::appendInteger( sendCompact, 0, 1 );
+               P2pMessage::appendInteger( sendCompact, 2, 8 );
+               P2pMessage( "sendcmpct", std::move(sendCompact) ).write( socket, _magic );
+            }
+            else if( message.command == "ping" )
+            {
+               P2pMessage( "pong", std::move(message.payload) ).write( socket, _magic );
+            }
+            else if( message.command == "block" )
+            {
+               ostringstream hex;
+               writeHex( hex, message.payload.data(), message.payload.size() );
+               _node.submitBlock( hex.str(), "P2P block" );
+            }
+            else if( message.command == "cmpctblock" )
+            {
+               _compactBlock( socket, message.payload, header, txns, missing );
+            }
+            else if( message.command == "blocktxn" )
+            {
+               _blockTransactions( message.payload, header, txns, missing );
+            }
+         }
+      }
+      catch( std::exception& e )
+      {
+         cout << "P2P peer: " << e.what() << endl;
+      }
+
+      cout << "P2P peer disconnected" << endl;
+   }
+
+   void _compactBlock( int socket, const ByteArray& payload, ByteArray& header,
+                       vector<ByteArray>& txns, vector<uint64_t>& missing )
+   {
+      P2pMessage::Reader reader( payload );
+      Block::Header blockHeader;
+      std::memcpy( &blockHeader, reader.bytes(sizeof(blockHeader)), sizeof(blockHeader) );
+      header.assign( reinterpret_cast<uint8_t*>(&blockHeader), reinterpret_cast<uint8_t*>(&blockHeader + 1) );
+
+      uint64_t k0, k1;
+      P2pMessage::shortIdKeys( blockHeader, reader.integer(8), k0, k1 );
+      auto mempool = _node.compactMempool( k0, k1 );
+
+      // Short IDs fill the slots the prefilled transactions don't
+      vector<uint64_t> shortIds( reader.varInt() );
+      for( auto& shortId : shortIds )
+      {
+         shortId = reader.integer( 6 );
+      }
+
+      auto prefilledCount = reader.varInt();
+      if( !reader.valid() || shortIds.size() + prefilledCount > 1000000 )
+      {
+         throw runtime_error( "Invalid cmpctblock" );
+      }
+
+      txns.assign( shortIds.size() + prefilledCount, ByteArray() );
+      vector<bool> prefilled( txns.size() );
+      uint64_t index = 0;
+      for( uint64_t i = 0; i < prefilledCount; ++i )
+      {
+         index += reader.varInt() + (i > 0 ? 1 : 0);
+         size_t size;
+         auto data = reader.transaction( size );
+         if( !reader.valid() || index >= txns.size() )
+         {
+            throw runtime_error( "Invalid cmpctblock" );
+         }
+         txns[index].assign( data, data + size );
+         prefilled[index] = true;
+      }
+
+      missing.clear();
+      auto shortId = shortIds.begin();
+      for( uint64_t i = 0; i < txns.size(); ++i )
+      {
+         if( prefilled[i] )
+         {
+            continue;
+         }
+
+         auto found = mempool.find( *shortId++ );
+         if( found == mempool.end() )
+         {
+            missing.push_back( i );
+         }
+         else
+         {
+            txns[i] = found->second;
+         }
+      }
+
+      if( missing.empty() )
+      {
+         _submit( header, txns, "P2P compact block" );
+         return;
+      }
+
+      // Indexes are each sent as the difference from the one before, less one
+      ByteArray request;
+      auto hash = Sha256::doubleHash( header );
+      P2pMessage::appendBytes( request, hash.data(), hash.size() );
+      P2pMessage::appendVarInt( request, missing.size() );
+      for( size_t i = 0; i < missing.size(); ++i )
+      {
+         P2pMessage::appendVarInt( request, i == 0 ? missing[i] : missing[i] - missing[i - 1] - 1 );
+      }
+      P2pMessage( "getblocktxn", std::move(request) ).write( socket, _magic );
+   }
+
+   void _blockTransactions( const ByteArray& payload, const ByteArray& header,
+                            vector<ByteArray>& txns, vector<uint64_t>& missing )
+   {
+      P2pMessage::Reader reader( payload );
+      auto hash = reader.digest();
+      auto expected = Sha256::doubleHash( header );
+      if( missing.empty() || !std::equal(hash.begin(), hash.end(), expected.begin()) ||
+          reader.varInt() != missing.size() )
+      {
+         throw runtime_error( "Unrequested blocktxn" );
+      }
+
+      for( auto index : missing )
+      {
+         size_t size;
+         auto data = reader.transaction( size );
+         if( !reader.valid() )
+         {
+            throw runtime_error( "Invalid blocktxn" );
+         }
+         txns[index].assign( data, data + size );
+      }
+
+      _submit( header, txns, "P2P compact block (" + to_string(missing.size()) + " transactions requested)" );
+      missing.clear();
+   }
+
+   void _submit( const ByteArray& header, const vector<ByteArray>& txns, const string& via )
+   {
+      ostringstream hex;
+      hex << header;
+      writeVarInt( hex, txns.size() );
+      for( auto& txn : txns )
+      {
+         writeHex( hex, txn.data(), txn.size() );
+      }
+      _node.submitBlock( hex.str(), via );
+   }
+
+private:
+   MockNode&                     _node;
+   uint32_t                      _magic;
+   int                           _listenSocket;
+   atomic<bool>                  _stop;
+   thread                        _acceptThread;
+
+   mutex                         _mutex;
+   vector<pair<int, thread>>     _connections;
+};
+
+static volatile sig_atomic_t _interrupted = 0;
+
+static void onInterrupt( int )
+{
+   _interrupted = 1;
+}
+
+int main( int argc, char** argv )
+{
+   try
+   {
+      MockNode::Options nodeOptions;
+      int port;
+      string address;
+      int blockInterval;
+      int p2pPort;
+
+      BoostProgOpt::options_description options( "Options" );
+      options.add_options()
+         ("help,h",        "Print this help.")
+         ("debug,d",       "Log each request.")
+         ("rpcport",       BoostProgOpt::value<int>(&port)->default_value(18332), "Port to listen on.")
+         ("rpcbind",       BoostProgOpt::value<string>(&address)->default_value("127.0.0.1"), "Address to listen on.")
+         ("template",      BoostProgOpt::value<vector<string>>(&nodeOptions.templateFiles), "Recorded getblocktemplate result to replay. May be repeated, to cycle through several.")
+         ("bits",          BoostProgOpt::value<string>(&nodeOptions.bits), "Override the templates' difficulty bits (hex), e.g. 1f00ffff for an easy target.")
+         ("txcount",       BoostProgOpt::value<int>(&nodeOptions.txCount)->default_value(4000), "Number of transactions in the synthetic template, when none are recorded.")
+         ("longpolltimeout", BoostProgOpt::value<int>(&nodeOptions.longpollTimeout)->default_value(60), "Seconds to hold a longpoll request.")
+         ("chainid",       BoostProgOpt::value<int>(&nodeOptions.chainId)->default_value(1), "Chain ID of aux blocks, as a merged mining aux chain.")
+         ("blockinterval", BoostProgOpt::value<int>(&blockInterval)->default_value(0), "Simulate a block from the network every this many seconds (0 = never).")
+         ("p2pport",       BoostProgOpt::value<int>(&p2pPort)->default_value(0), "Port to take blocks on over the P2P protocol, as a regtest node (0 = disabled).")
+         ("p2pmissing",    BoostProgOpt::value<int>(&nodeOptions.p2pMissing)->default_value(0), "Leave every this many template transactions out of the mempool that compact blocks are rebuilt from, so peers must send them (0 = none).")
+         ;
+
+      BoostProgOpt::positional_options_description positional;
+      positional.add( "template", -1 );
+
+      BoostProgOpt::variables_map varMap;
+      BoostProgOpt::store( BoostProgOpt::command_line_parser(argc, argv).options(options).positional(positional).run(), varMap );
+      BoostProgOpt::notify( varMap );
+      nodeOptions.debug = varMap.count( "debug" );
+
+      if( varMap.count("help") )
+      {
+         cout << "Usage: " << argv[0] << " [options] [template.json...]" << endl << options;
+         return EXIT_SUCCESS;
+      }
+
+      MockNode node( nodeOptions );
+      HttpServer server( address, port, [&node](const HttpServer::Request& request)
+      {
+         return node.handle( request );
+      } );
+      cout << "Listening on " << address << ":" << server.port() << endl;
+
+      std::unique_ptr<MockPeerServer> peerServer;
+      if( p2pPort != 0 )
+      {
+         peerServer.reset( new MockPeerServer(node, address, p2pPort, P2pMessage::networkMagic("regtest")) );
+         cout << "Listening for P2P on " << address << ":" << p2pPort << endl;
+      }
+
+      signal( SIGINT, onInterrupt );
+      signal( SIGTERM, onInterrupt );
+
+      auto nextExternalBlock = Clock::now() + chrono::seconds( blockInterval );
+      while( !_interrupted )
+      {
+         this_thread::sleep_for( chrono::milliseconds(100) );
+
+         if( blockInterval > 0 && Clock::now() >= nextExternalBlock )
+         {
+            node.externalBlock();
+            nextExternalBlock += chrono::seconds( blockInterval );
+         }
+      }
+
+      return EXIT_SUCCESS;
+   }
+   catch( std::exception& e )
+   {
+      cerr << "ERROR: " << e.what() << endl;
+      return EXIT_FAILURE;
+   }
+}